@@ -0,0 +1,53 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+// Measure fragmentation before and after compaction: fill the heap with
+// relocatable objects of random sizes, free a random half of them, then
+// compact in steps of BUDGET bytes, timing each step. Build with
+// `make compact` and run `./compact [BUDGET]`.
+
+static void print_fragmentation(const char* name) {
+    m61_fragmentation frag = m61_get_fragmentation();
+    printf("%-10s %10zu %10zu %10zu %8.3f\n", name, frag.free_size,
+           frag.nfree_blocks, frag.largest_free, frag.ratio);
+}
+
+int main(int argc, char** argv) {
+    size_t budget = argc > 1 ? strtoul(argv[1], nullptr, 0) : 64 << 10;
+    std::vector<m61_handle> handles;
+    m61_handle h;
+
+    srand(61);
+    while ((h = m61_halloc(16 + rand() % 2000)) != nullptr) {
+        handles.push_back(h);
+    }
+    for (m61_handle& hh : handles) {
+        if (rand() % 2) {
+            m61_hfree(hh);
+            hh = nullptr;
+        }
+    }
+
+    printf("phase      free bytes free blocks    largest    ratio\n");
+    print_fragmentation("before");
+    double total = 0, worst = 0;
+    size_t moved = 0, n, steps = 0;
+    do {
+        auto start = std::chrono::steady_clock::now();
+        n = m61_compact(budget);
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        total += elapsed.count();
+        worst = elapsed.count() > worst ? elapsed.count() : worst;
+        moved += n;
+        ++steps;
+    } while (n != 0);
+    print_fragmentation("after");
+    printf("moved %zu bytes in %zu steps: %.1f us total, %.1f us worst step\n",
+           moved, steps, total, worst);
+
+    for (m61_handle hh : handles) {
+        m61_hfree(hh);
+    }
+}
@@ -0,0 +1,60 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+// Measure the memory held for many mostly idle threads: each thread
+// allocates and frees a few small blocks, then waits while the resident
+// set is measured. Compare `make PTHREAD=1 idle` with `make PERCPU=1 idle`
+// and run `./idle [NTHREADS]`.
+
+static long resident_kib() {
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+int main(int argc, char** argv) {
+    int nthreads = argc > 1 ? strtol(argv[1], nullptr, 0) : 1000;
+    std::atomic<int> ready(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+
+    long before = resident_kib();
+    for (int t = 0; t != nthreads; ++t) {
+        threads.emplace_back([&ready, &done, t] {
+            void* ptrs[8];
+            for (int i = 0; i != 8; ++i) {
+                ptrs[i] = m61_malloc(16 + (t + i) % 8 * 64);
+                assert(ptrs[i]);
+            }
+            for (void* ptr : ptrs) {
+                m61_free(ptr);
+            }
+            ++ready;
+            while (!done) {
+                usleep(1000);
+            }
+        });
+    }
+    while (ready != nthreads) {
+        usleep(1000);
+    }
+    long idle = resident_kib();
+    done = true;
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    printf("%d idle threads: %ld KiB resident, %.1f KiB per thread\n",
+           nthreads, idle - before, (double) (idle - before) / nthreads);
+}
@@ -0,0 +1,43 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <thread>
+// Measure a producer/consumer workload: one thread allocates blocks and
+// hands them over a ring to another thread, which frees them. Build with
+// `make PTHREAD=1 pingpong` and run `./pingpong [NBLOCKS]`.
+
+#define RING_SIZE 1024
+
+static std::atomic<void*> ring[RING_SIZE];
+
+int main(int argc, char** argv) {
+    long nblocks = argc > 1 ? strtol(argv[1], nullptr, 0) : 1000000;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([nblocks] {
+        for (long i = 0; i != nblocks; ++i) {
+            void* ptr;
+            while ((ptr = ring[i % RING_SIZE].exchange(nullptr)) == nullptr) {
+                std::this_thread::yield();
+            }
+            m61_free(ptr);
+        }
+    });
+    for (long i = 0; i != nblocks; ++i) {
+        void* ptr = m61_malloc(16 + i % 512);
+        assert(ptr);
+        while (ring[i % RING_SIZE].load() != nullptr) {
+            std::this_thread::yield();
+        }
+        ring[i % RING_SIZE].store(ptr);
+    }
+    consumer.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    m61_statistics stat = m61_get_statistics();
+    printf("%ld blocks in %.3f s: %.2f Mops/s, %llu active\n", nblocks, elapsed.count(),
+           nblocks / elapsed.count() / 1e6, stat.nactive);
+}
@@ -0,0 +1,46 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <vector>
+// Compare containers on std::allocator, on m61_allocator, and as std::pmr
+// containers on an m61_memory_resource. Each round fills a list, a map and
+// a growing vector, then destroys them. Build with `make pmr` and run
+// `./pmr [ELEMENTS]`.
+
+template <typename List, typename Map, typename Vector, typename... Args>
+static double run(long n, Args&... args) {
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round != 10; ++round) {
+        List l(args...);
+        Map m(args...);
+        Vector v(args...);
+        for (long i = 0; i != n; ++i) {
+            l.push_back(i);
+            m.emplace(i * 7919 % n, i);
+            v.push_back(i);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    long n = argc > 1 ? strtol(argv[1], nullptr, 0) : 10000;
+    m61_memory_resource resource;
+
+    double base = run<std::list<long>, std::map<long, long>, std::vector<long>>(n);
+    double m61 = run<std::list<long, m61_allocator<long>>,
+                     std::map<long, long, std::less<long>, m61_allocator<std::pair<const long, long>>>,
+                     std::vector<long, m61_allocator<long>>>(n);
+    std::pmr::memory_resource* pmr = &resource;
+    double m61_pmr = run<std::pmr::list<long>, std::pmr::map<long, long>, std::pmr::vector<long>>(n, pmr);
+
+    printf("allocator            sec   relative\n");
+    printf("std::allocator  %8.3f   %8.2f\n", base, 1.0);
+    printf("m61_allocator   %8.3f   %8.2f\n", m61, m61 / base);
+    printf("std::pmr on m61 %8.3f   %8.2f\n", m61_pmr, m61_pmr / base);
+}
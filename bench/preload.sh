@@ -0,0 +1,40 @@
+#!/bin/sh
+# Time unmodified programs on the system allocator and on m61 through
+# LD_PRELOAD. Build with `make libm61.so` and run `bench/preload.sh`, or
+# `bench/preload.sh COMMAND...` to time a command of your own.
+
+root="$(cd "$(dirname "$0")/.." && pwd)"
+lib="$root/libm61.so"
+if [ ! -f "$lib" ]; then
+    echo "$lib: not found; run \`make libm61.so\` first" 1>&2
+    exit 1
+fi
+
+run() {
+    start=$(date +%s.%N)
+    "$@" >/dev/null 2>&1
+    status=$?
+    end=$(date +%s.%N)
+    elapsed=$(awk "BEGIN { printf \"%.3f\", $end - $start }")
+    if [ $status -ne 0 ]; then
+        elapsed="failed($status)"
+    fi
+}
+
+bench() {
+    run "$@"
+    base=$elapsed
+    run env LD_PRELOAD="$lib" "$@"
+    printf "%-40.40s %10s %10s\n" "$*" "$base" "$elapsed"
+}
+
+printf "%-40s %10s %10s\n" "command" "system" "m61"
+if [ $# -ne 0 ]; then
+    bench "$@"
+    exit
+fi
+bench ls -lR /usr/include
+bench sort -R /usr/share/common-licenses/GPL-3
+bench python3 -c "d = {str(i): [i] * 8 for i in range(500000)}"
+bench perl -e 'my %h; $h{$_} = $_ x 8 for 1..500000'
+bench g++ -std=gnu++2a -O2 -I"$root" -c -o /dev/null "$root/m61.cc"
@@ -0,0 +1,41 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+// Measure the latency of allocations that split fresh heap memory, which
+// also faults its pages in, against allocations served from blocks set
+// aside by `m61_reserve`. Each phase allocates untouched parts of the heap.
+// Build with `make reserve` and run `./reserve [COUNT [SIZE]]`.
+
+static void run(const char* name, long n, size_t sz) {
+    std::vector<void*> ptrs(n);
+    double total = 0, worst = 0;
+
+    for (long i = 0; i != n; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        ptrs[i] = m61_malloc(sz);
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        if (ptrs[i] == nullptr) {
+            fprintf(stderr, "%s: out of memory after %ld allocations\n", name, i);
+            exit(1);
+        }
+        total += elapsed.count();
+        worst = elapsed.count() > worst ? elapsed.count() : worst;
+    }
+    printf("%-10s %10.1f %10.1f\n", name, total / n, worst);
+}
+
+int main(int argc, char** argv) {
+    long n = argc > 1 ? strtol(argv[1], nullptr, 0) : 1000;
+    size_t sz = argc > 2 ? strtoul(argv[2], nullptr, 0) : 2000;
+
+    m61_free(m61_malloc(1));        // set the heap up outside the timings
+    printf("phase       mean (ns)   max (ns)\n");
+    run("fresh", n, sz);
+    if (m61_reserve(sz, n) != (size_t) n) {
+        fprintf(stderr, "reserve: out of memory\n");
+        return 1;
+    }
+    run("reserved", n, sz);
+}
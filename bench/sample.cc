@@ -0,0 +1,38 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+// Measure the cost of sampled allocations: time rounds of COUNT
+// allocations of random sizes up to 512 bytes, then their frees, with
+// sampling off and at a few rates. Build with `make sample` and run
+// `./sample [COUNT]`.
+
+static void run(unsigned rate, long n) {
+    std::vector<void*> ptrs(n);
+    unsigned long long sampled = m61_get_statistics().nsampled;
+
+    m61_set_sample_rate(rate);
+    srand(61);
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round != 100; ++round) {
+        for (long i = 0; i != n; ++i) {
+            ptrs[i] = m61_malloc(1 + rand() % 512);
+        }
+        for (long i = 0; i != n; ++i) {
+            m61_free(ptrs[i]);
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%8u %12.1f %10llu\n", rate, elapsed.count() / (100 * n),
+           m61_get_statistics().nsampled - sampled);
+}
+
+int main(int argc, char** argv) {
+    long n = argc > 1 ? strtol(argv[1], nullptr, 0) : 1000;
+
+    printf("    rate  ns per pair    sampled\n");
+    for (unsigned rate : {0, 10000, 1000, 100, 10}) {
+        run(rate, n);
+    }
+}
@@ -0,0 +1,47 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <chrono>
+#include <thread>
+#include <vector>
+// Measure allocation throughput from 1 to 64 threads. Build with
+// `make PTHREAD=1 scaling` and run `./scaling [OPS-PER-THREAD]`.
+
+static void work(unsigned seed, long nops) {
+    void* live[32] = {};
+
+    for (long i = 0; i != nops; ++i) {
+        seed = seed * 1103515245 + 12345;
+        unsigned slot = (seed >> 8) % 32;
+        m61_free(live[slot]);
+        live[slot] = m61_malloc(16 + (seed >> 16) % 512);
+        assert(live[slot]);
+    }
+    for (void* ptr : live) {
+        m61_free(ptr);
+    }
+}
+
+int main(int argc, char** argv) {
+    long nops = argc > 1 ? strtol(argv[1], nullptr, 0) : 200000;
+
+    printf("threads     Mops/s   speedup\n");
+    double base = 0;
+    for (int nthreads = 1; nthreads <= 64; nthreads *= 2) {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t != nthreads; ++t) {
+            threads.emplace_back(work, t + 1, nops);
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double mops = nthreads * nops / elapsed.count() / 1e6;
+        if (nthreads == 1) {
+            base = mops;
+        }
+        printf("%7d %10.2f %9.2f\n", nthreads, mops, mops / base);
+    }
+}
@@ -266,6 +266,7 @@ sub read_expected ($) {
     my(@expected);
     my($line, $skippable, $unordered) = (0, 0, 0);
     my($allow_asan_warning, $time) = (0, 0, 0);
+    my($checks, $preload) = (0, 0);
     while (defined($_ = <EXPECTED>)) {
         ++$line;
         if (m{^//! \?\?\?\s*$}) {
@@ -274,11 +275,16 @@ sub read_expected ($) {
             $unordered = 1;
         } elsif (m{^//!!TIME\s*$}) {
             $time = 1;
+        } elsif (m{^//!!PRELOAD\s*$}) {
+            $preload = 1;
         } elsif (m{^//!!(ALLOW_|DISALLOW_)ASAN_WARNING\s*$}) {
             $allow_asan_warning = $1 eq "ALLOW_";
         } elsif (m{^//! }) {
             s{^....(.*?)\s*$}{$1};
             $allow_asan_warning = 1 if /^alloc count:.*fail +[1-9]/;
+            # reported bugs need validation; locating wild frees needs search
+            $checks = 1 if /MEMORY BUG/ && $checks < 1;
+            $checks = 2 if /bytes inside a/;
             my($m) = {"t" => $_, "line" => $line, "skip" => $skippable,
                       "r" => "", "match" => []};
             foreach my $x (split(/(\?\?\?|\?\?\{.*?\}(?:=\w+)?\?\?|\?\?>=\d+\?\?)/)) {
@@ -324,6 +330,7 @@ sub read_expected ($) {
     }
     return {"l" => \@expected, "nl" => scalar(@expected),
             "skip" => $skippable, "unordered" => $unordered, "time" => $time,
+            "checks" => $checks, "preload" => $preload,
             "allow_asan_warning" => $allow_asan_warning};
 }
 
@@ -448,6 +455,8 @@ sub run_compare ($$$$$$) {
 
 my ($KeepGoing) = 0;
 my ($Sanitizer) = 0;
+my (%CheckLevels) = ("none" => 0, "cheap" => 1, "full" => 2);
+my ($Checks) = $CheckLevels{$ENV{"CHECKS"} // "full"} // 2;
 
 while (@ARGV > 0) {
     if ($ARGV[0] eq "-c" && @ARGV > 1 && $ARGV[1] =~ /^\d+$/) {
@@ -480,6 +489,7 @@ while (@ARGV > 0) {
     } elsif ($ARGV[0] =~ /=/) {
         push @Makeargs, $ARGV[0];
         $Sanitizer = 1 if $ARGV[0] =~ /\ASAN=(?!\z|0\z)/;
+        $Checks = $CheckLevels{$1} // 2 if $ARGV[0] =~ /\ACHECKS=(.*)\z/;
     } elsif ($ARGV[0] =~ /\A-/) {
         print STDERR "Usage: ./check.pl [-c CONTEXT] [-l] [TESTS...]\n";
         print STDERR "       ./check.pl -x EXECFILE\n";
@@ -494,6 +504,7 @@ while (@ARGV > 0) {
 foreach my $arg (@ARGV) {
     if ($arg =~ /=/) {
         push @Makeargs, $arg;
+        $Checks = $CheckLevels{$1} // 2 if $arg =~ /\ACHECKS=(.*)\z/;
     } else {
         $arg =~ s/test//g;
         foreach my $t (split_testmatch($arg)) {
@@ -557,7 +568,10 @@ if ($Exec) {
     die "bad -x option\n" if $Exec !~ m{\A(?![\./])[^/]+\z};
     run_make($Exec) if $Make;
     $ENV{"ASAN_OPTIONS"} = asan_options($Exec);
-    $out = run_sh61("./" . $Exec, "stdout" => "pipe", "stdin" => "/dev/null",
+    my($expected) = read_expected($Exec . ".cc");
+    my($command) = $expected->{preload}
+        ? ["env", "LD_PRELOAD=" . getcwd() . "/libm61.so", "./" . $Exec] : "./" . $Exec;
+    $out = run_sh61($command, "stdout" => "pipe", "stdin" => "/dev/null",
                     "time_limit" => 10, "size_limit" => 80000);
     if (exists($out->{killed})) {
         print_killed($Exec, $out);
@@ -569,7 +583,7 @@ if ($Exec) {
         close OUT;
     }
     exit(run_compare([split("\n", $out->{output})],
-                     read_expected($Exec . ".cc"),
+                     $expected,
                      $ofile, $Exec . ".cc", $Exec, $out));
 } else {
     my(@tests) = ();
@@ -583,7 +597,7 @@ if ($Exec) {
         return (int($a1) <=> int($b1)) || ($a cmp $b);
     } @tests;
 
-    my($ntest, $ntestfailed) = (0, 0);
+    my($ntest, $ntestfailed, $ntestskipped) = (0, 0, 0);
 
     if ($Test) {
         foreach my $tn (@tests) {
@@ -611,11 +625,25 @@ if ($Exec) {
     $ENV{"MALLOC_CHECK_"} = 0;
     foreach my $tn (@tests) {
         next if !testid_runnable($tn);
+        my($expected) = read_expected("${tn}.cc");
+        if ($expected->{checks} > $Checks) {
+            print STDERR "${Cyan}${tn} SKIP (needs more checking than this build does)$Off\n";
+            ++$ntestskipped;
+            next;
+        }
+        if ($expected->{preload} && $Sanitizer) {
+            print STDERR "${Cyan}${tn} SKIP (sanitizers cannot run under LD_PRELOAD)$Off\n";
+            ++$ntestskipped;
+            next;
+        }
         ++$ntest;
         $ENV{"ASAN_OPTIONS"} = asan_options($tn);
         run_make($tn) if exists($need_make{$tn});
         printf STDERR "${tn} ";
-        $out = run_sh61("./${tn}",
+        # preload tests are unmodified programs run on libm61.so
+        my($command) = $expected->{preload}
+            ? ["env", "LD_PRELOAD=" . getcwd() . "/libm61.so", "./${tn}"] : "./${tn}";
+        $out = run_sh61($command,
             "stdout" => "pipe", "stdin" => "/dev/null",
             "time_limit" => time_limit($tn),
             "size_limit" => 80000);
@@ -625,7 +653,7 @@ if ($Exec) {
             $failed = 1;
         } else {
             $failed = run_compare([split("\n", $out->{output})],
-                    read_expected("${tn}.cc"),
+                    $expected,
                     "output", "${tn}.cc", "\r$tn ", $out);
         }
         if ($failed) {
@@ -637,7 +665,7 @@ if ($Exec) {
     if ($ntest == 0) {
         print STDERR "${Red}No tests match$Off\n";
         exit(2);
-    } if ($ntest == @tests && $ntestpassed == $ntest) {
+    } if ($ntest + $ntestskipped == @tests && $ntestpassed == $ntest) {
         print STDERR "${Green}All tests passed!$Off\n";
         exit(0);
     } else {
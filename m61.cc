@@ -4,41 +4,419 @@
 #include <cstring>
 #include <cstdio>
 #include <cinttypes>
+#include <climits>
 #include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sched.h>
+// restartable sequences are written for x86-64, and ThreadSanitizer cannot
+// see the ordering they provide
+#if M61_PERCPU && defined(__x86_64__) && !defined(__SANITIZE_THREAD__)
+#define M61_CPU_CACHES 1
+#include <linux/membarrier.h>
+#include <sys/rseq.h>
+#include <sys/syscall.h>
+#else
+#define M61_CPU_CACHES 0
+#endif
+#include <sys/stat.h>
+#include <unistd.h>
 
-// only external objects are pointers and the statistics struct
+// threads are spread across M61_HEAP_ARENAS independent heaps, each with its
+// own buffer, lists, statistics and lock. The first arena is the default heap;
+// the others get their buffers the first time a thread is assigned to them.
+#ifndef M61_HEAP_ARENAS
+#define M61_HEAP_ARENAS (M61_THREADS ? 8 : 1)
+#endif
+#define HEAP_ARENA_SWITCH 16    // contended lock acquisitions before a thread
+                                // moves to another arena
+
+// only external objects are the heap roots and pointers to them
 // all metadata is internal
+static m61_heap heap_arenas[M61_HEAP_ARENAS] = {{nullptr, nullptr, nullptr, nullptr,
+                                                 {0, 0, 0, 0, 0, 0, 0, 0, UINTPTR_MAX, 0, 0, 0, 0}, 0, nullptr, nullptr, 0, {},
+                                                 PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP}};
+static m61_heap& default_heap = heap_arenas[0];
+static size_t nheap_arenas = 1;             // arenas with a buffer
+#if M61_THREADS
+static pthread_mutex_t heap_arenas_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t next_heap_arena = 0;          // round-robin assignment counter
+static thread_local m61_heap* heap = &default_heap;   // the heap this thread's allocation
+                                                      // functions operate on
+static thread_local m61_heap* thread_heap = nullptr;  // this thread's arena
+static thread_local unsigned thread_heap_contention = 0;
+static thread_local size_t* thread_scope = nullptr;  // this thread's innermost open scope's marker
+#else
+static m61_heap* heap = &default_heap;   // the heap all allocation functions operate on
+static size_t* thread_scope = nullptr;
+#endif
 static m61_memory_buffer default_buffer;
-static m61_statistics statistics = {0, 0, 0, 0, 0, 0, 0, 0, UINTPTR_MAX, 0};
-static size_t* free_list_start;
-static size_t* alloc_list_start;
-static size_t* top_of_heap;
-static size_t* end_of_heap;
+static pthread_once_t default_heap_once = PTHREAD_ONCE_INIT;
+static char* default_heap_buffer = nullptr;
+static bool default_heap_ready = false;
+static inline void m61_init_default_heap();
 
-m61_memory_buffer::m61_memory_buffer() {
-    size_t* prologue_header;
-    size_t* free_header;
-    size_t* end_header;
-    size_t free_header_size;
-    size_t prologue_size;
+// file name recorded in the marker block of an open allocation scope
+static const char scope_marker[] = "<scope>";
+
+// kept in the payload of a scope's marker block. A thread's blocks go in
+// front of its innermost marker in the heap, so each thread's scopes
+// cover a run of the allocated list that ends at its outermost marker.
+// The outermost markers of a heap are linked in list order, the last
+// being `heap->scope_tail`; blocks of threads with no scope open in the
+// heap go behind it, outside every run.
+struct m61_scope_info {
+    size_t* enclosing;          // this thread's previous open scope, in any heap
+    m61_link outer_prev;        // neighboring outermost markers, if outermost
+    m61_link outer_next;
+    size_t outermost;
+};
+#define SCOPE_INFO(header) ((m61_scope_info*) GET_PAYLOAD(header))
+
+// file name recorded in a block held in a thread's cache
+static const char tcache_marker[] = "<cached>";
+
+// file name recorded in a block queued for its arena by another thread
+static const char remote_marker[] = "<remote>";
+
+// file name recorded in a block retired by `m61_retire`
+static const char retired_marker[] = "<retired>";
+
+// file name recorded in a block set aside by `m61_reserve`
+static const char reserved_marker[] = "<reserved>";
+
+// statistics are updated without the heap lock by the thread caches. The
+// counters of the default heap are kept in per-thread shards (see
+// m61_stat_add); heap_min and heap_max stay in each heap.
+#if M61_THREADS
+#define STAT_ADD(field, n) (m61_stat_add(&m61_statistics::field, (n)))
+#define STAT_SUB(field, n) (m61_stat_add(&m61_statistics::field, -(unsigned long long)(n)))
+#define STAT_LOAD(field)   (__atomic_load_n(&heap->statistics.field, __ATOMIC_RELAXED))
+#else
+#define STAT_ADD(field, n) (heap->statistics.field += (n))
+#define STAT_SUB(field, n) (heap->statistics.field -= (n))
+#define STAT_LOAD(field)   (heap->statistics.field)
+#endif
+
+// tagged blocks are counted in their tag's statistics as well, from any
+// thread and any heap
+static m61_statistics tag_statistics[M61_MAX_TAGS];
+static size_t tag_budgets[M61_MAX_TAGS];
+#define TAG_STAT_ADD(tag, field, n) (__atomic_fetch_add(&tag_statistics[tag].field, (n), __ATOMIC_RELAXED))
+#define TAG_STAT_SUB(tag, field, n) (__atomic_fetch_sub(&tag_statistics[tag].field, (n), __ATOMIC_RELAXED))
+
+/// m61_heap_guard
+///    Holds the lock of heap `h` from construction to destruction. Only
+///    locks in threaded builds; shared heaps are locked by their callers.
+struct m61_heap_guard {
+    m61_heap* h;
+    m61_heap_guard(m61_heap* locked) : h(locked) {
+        if (M61_THREADS)
+            pthread_mutex_lock(&h->lock);
+    }
+    m61_heap_guard(m61_heap* locked, std::adopt_lock_t) : h(locked) {
+    }
+    ~m61_heap_guard() {
+        if (M61_THREADS)
+            pthread_mutex_unlock(&h->lock);
+    }
+};
+#define M61_LOCK_HEAP() m61_heap_guard heap_guard(heap)
+#define M61_LOCK_THREAD_HEAP() m61_heap_guard heap_guard(m61_lock_thread_heap(), std::adopt_lock)
+
+static size_t* m61_tcache_pop(size_t asize);
+static bool m61_tcache_push(void* ptr, const char* file, int line, size_t* header = nullptr);
+static bool m61_remote_push(void* ptr, size_t* header = nullptr);
+static bool m61_tcache_flush_all();
+static bool m61_reclaim_memory();
+static size_t* m61_reserved_pop(size_t asize);
+static size_t m61_compact_heap(size_t budget);
+static bool m61_drain_remote_frees();
+static void m61_record_heap_bounds(uintptr_t min, uintptr_t max);
+static void* m61_heap_malloc_class(size_t sz, size_t asize, const char* file, int line);
+static inline bool m61_sample_allocation(size_t sz);
+static void* m61_guarded_alloc(size_t sz, const char* file, int line);
+static inline bool m61_is_guarded(void* ptr);
+static void m61_guarded_free(void* ptr, size_t sz, const char* file, int line);
+static size_t m61_guarded_size(void* ptr);
+static void m61_guarded_retire(void* ptr, const char* file, int line);
+static void m61_release_guarded_limbo(unsigned long epoch);
+static void m61_print_guarded_leaks();
+static const char* m61_intern_file(m61_heap* h, const char* file);
+static void m61_link_allocated(size_t* first, size_t* last);
+static void m61_scope_close(size_t* marker);
+
+/// m61_is_heap_arena(h)
+///    Return true if `h` is one of the arenas behind the default heap.
+static inline bool m61_is_heap_arena(m61_heap* h) {
+    return h >= heap_arenas && h < heap_arenas + M61_HEAP_ARENAS;
+}
+
+/// m61_heap_bound(h, bound)
+///    Return the address heap_min or heap_max `bound` of `h` stands for.
+///    The bounds are offsets from `top_of_heap`, so that a shared heap's
+///    bounds hold in every process; the empty bounds UINTPTR_MAX and 0 are
+///    kept as they are.
+static inline uintptr_t m61_heap_bound(m61_heap* h, uintptr_t bound) {
+    return bound == UINTPTR_MAX || bound == 0 ? bound : (uintptr_t) h->top_of_heap.get() + bound;
+}
+#define HEAP_BOUND(field) (m61_heap_bound(heap, STAT_LOAD(field)))
+
+/// m61_heap_range(first, last)
+///    Set [`first`, `last`) to the heaps the default statistics and leak
+///    report cover: every arena when `heap` is one, otherwise `heap` alone.
+static void m61_heap_range(m61_heap** first, m61_heap** last) {
+    if (m61_is_heap_arena(heap)) {
+        *first = heap_arenas;
+        *last = heap_arenas + __atomic_load_n(&nheap_arenas, __ATOMIC_ACQUIRE);
+    } else {
+        *first = heap;
+        *last = heap + 1;
+    }
+}
+
+#if M61_THREADS
+// each thread counts the allocations it makes on the default heap in its own
+// shard: the owning thread is the only writer, so counters are updated with
+// plain relaxed stores to a cache line no other thread writes, and only
+// m61_get_statistics reads them all. A thread's shard is linked into
+// stat_shards on its first allocation or free, and folded into
+// retired_stats when it exits.
+struct alignas(64) m61_stat_shard {
+    m61_statistics stats;
+    pthread_t thread;
+    m61_stat_shard* next;
+    bool linked;
+    bool exited;
+};
+static thread_local m61_stat_shard stat_shard;
+static m61_stat_shard* stat_shards = nullptr;
+static m61_statistics retired_stats;
+static pthread_mutex_t stat_shards_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// m61_stat_shard_owner
+///    Folds this thread's shard into retired_stats when the thread exits.
+struct m61_stat_shard_owner {
+    ~m61_stat_shard_owner();
+};
+static thread_local m61_stat_shard_owner stat_shard_owner;
+
+/// m61_stat_add(field, n)
+///    Add `n` to counter `field` of the statistics `heap` reports: this
+///    thread's shard for the default heap, otherwise the heap's own.
+static inline void m61_stat_add(unsigned long long m61_statistics::* field, unsigned long long n) {
+    if (!m61_is_heap_arena(heap)) {
+        __atomic_fetch_add(&(heap->statistics.*field), n, __ATOMIC_RELAXED);
+        return;
+    }
+    if (!stat_shard.linked) {
+        if (stat_shard.exited) {        // counted from another thread-exit destructor
+            __atomic_fetch_add(&(retired_stats.*field), n, __ATOMIC_RELAXED);
+            return;
+        }
+        (void) &stat_shard_owner;       // registers the owner's destructor
+        pthread_mutex_lock(&stat_shards_lock);
+        stat_shard.thread = pthread_self();
+        stat_shard.next = stat_shards;
+        stat_shards = &stat_shard;
+        stat_shard.linked = true;
+        pthread_mutex_unlock(&stat_shards_lock);
+    }
+    __atomic_store_n(&(stat_shard.stats.*field), stat_shard.stats.*field + n, __ATOMIC_RELAXED);
+}
+
+// the counters a shard holds
+static unsigned long long m61_statistics::* const stat_counters[] = {
+    &m61_statistics::nactive, &m61_statistics::active_size, &m61_statistics::nfree,
+    &m61_statistics::freed_size, &m61_statistics::ntotal, &m61_statistics::total_size,
+    &m61_statistics::nfail, &m61_statistics::fail_size,
+    &m61_statistics::nreserved, &m61_statistics::nreserved_used, &m61_statistics::nsampled
+};
+
+m61_stat_shard_owner::~m61_stat_shard_owner() {
+    pthread_mutex_lock(&stat_shards_lock);
+    for (m61_stat_shard** link = &stat_shards; *link != nullptr; link = &(*link)->next) {
+        if (*link == &stat_shard) {
+            *link = stat_shard.next;
+            break;
+        }
+    }
+    for (auto field : stat_counters)
+        __atomic_fetch_add(&(retired_stats.*field), stat_shard.stats.*field, __ATOMIC_RELAXED);
+    stat_shard.linked = false;
+    stat_shard.exited = true;
+    pthread_mutex_unlock(&stat_shards_lock);
+}
+
+/// m61_sum_stat_shards(stats)
+///    Add the counters of every shard, live or retired, to `stats`.
+static void m61_sum_stat_shards(m61_statistics* stats) {
+    pthread_mutex_lock(&stat_shards_lock);
+    for (auto field : stat_counters) {
+        stats->*field += __atomic_load_n(&(retired_stats.*field), __ATOMIC_RELAXED);
+        for (m61_stat_shard* shard = stat_shards; shard != nullptr; shard = shard->next)
+            stats->*field += __atomic_load_n(&(shard->stats.*field), __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stat_shards_lock);
+}
+
+/// m61_heap_arena_for(ptr)
+///    Return the arena whose buffer holds `ptr`, or nullptr if none does.
+static m61_heap* m61_heap_arena_for(void* ptr) {
+    size_t n = __atomic_load_n(&nheap_arenas, __ATOMIC_ACQUIRE);
+
+    for (size_t i = 0; i != n; ++i) {
+        if ((size_t*)ptr > heap_arenas[i].top_of_heap && (size_t*)ptr < heap_arenas[i].end_of_heap)
+            return &heap_arenas[i];
+    }
+    return nullptr;
+}
+
+/// m61_next_heap_arena()
+///    Return the next arena in round-robin order, mapping its buffer the
+///    first time it is handed out. If that fails, returns the first arena.
+static m61_heap* m61_next_heap_arena() {
+    size_t i = __atomic_fetch_add(&next_heap_arena, 1, __ATOMIC_RELAXED) % M61_HEAP_ARENAS;
+    pthread_mutexattr_t attr;
+    void* buf;
+
+    if (i < __atomic_load_n(&nheap_arenas, __ATOMIC_ACQUIRE))
+        return &heap_arenas[i];
+
+    pthread_mutex_lock(&heap_arenas_lock);
+    while (nheap_arenas <= i) {
+        buf = mmap(nullptr, M61_HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (buf == MAP_FAILED) {
+            i = 0;
+            break;
+        }
+        m61_heap_init(&heap_arenas[nheap_arenas], (char*)buf, M61_HEAP_SIZE);
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&heap_arenas[nheap_arenas].lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        __atomic_store_n(&nheap_arenas, nheap_arenas + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&heap_arenas_lock);
+    return &heap_arenas[i];
+}
+
+/// m61_use_heap_arena()
+///    Assign this thread an arena the first time it allocates from the
+///    default heap.
+static inline void m61_use_heap_arena() {
+    m61_init_default_heap();
+    if (thread_heap == nullptr && heap == &default_heap)
+        heap = thread_heap = m61_next_heap_arena();
+}
+
+/// m61_lock_thread_heap()
+///    Lock the heap this thread allocates from and return it. A thread that
+///    keeps finding its arena's lock taken moves on to the next arena,
+///    returning its cached blocks to the old one first, unless it has a
+///    scope open: a scope covers only the arena its marker is in. Blocks other
+///    threads have freed into the heap are released before returning.
+static m61_heap* m61_lock_thread_heap() {
+    if (heap != thread_heap || pthread_mutex_trylock(&heap->lock) != 0) {
+        pthread_mutex_lock(&heap->lock);
+        if (heap == thread_heap && M61_HEAP_ARENAS > 1 && thread_scope == nullptr
+            && ++thread_heap_contention == HEAP_ARENA_SWITCH) {
+            thread_heap_contention = 0;
+            m61_tcache_flush_all();
+            pthread_mutex_unlock(&heap->lock);
+            heap = thread_heap = m61_next_heap_arena();
+            pthread_mutex_lock(&heap->lock);
+        }
+    }
+    m61_drain_remote_frees();
+    return heap;
+}
+
+/// m61_heap_route
+///    Points `heap` at the arena holding `ptr` for the lifetime of the
+///    route, so that a block is freed into the arena it came from.
+struct m61_heap_route {
+    m61_heap* prev;
+    m61_heap_route(void* ptr) : prev(heap) {
+        m61_heap* owner;
+        if (m61_is_heap_arena(heap)
+            && ((size_t*)ptr <= heap->top_of_heap || (size_t*)ptr >= heap->end_of_heap)
+            && (owner = m61_heap_arena_for(ptr)) != nullptr)
+            heap = owner;
+    }
+    ~m61_heap_route() {
+        heap = prev;
+    }
+};
+#else
+static inline void m61_sum_stat_shards(m61_statistics*) {
+}
+static inline void m61_use_heap_arena() {
+    m61_init_default_heap();
+}
+static inline m61_heap* m61_lock_thread_heap() {
+    return heap;
+}
+struct m61_heap_route {
+    m61_heap_route(void*) {
+    }
+};
+#endif
+#define M61_ROUTE_HEAP(ptr) m61_heap_route heap_route(ptr)
 
+/// m61_map_default_heap()
+///    Map the default heap's buffer and lay the heap out in it.
+static void m61_map_default_heap() {
     void* buf = mmap(nullptr,    // Place the buffer at a random address
-        this->size,              // Buffer should be 8 MiB big
+        M61_HEAP_SIZE,           // Buffer should be M61_HEAP_SIZE big
         PROT_WRITE,              // We want to read and write the buffer
         MAP_ANON | MAP_PRIVATE, -1, 0);
                                  // We want memory freshly allocated by the OS
     assert(buf != MAP_FAILED);
-    this->buffer = (char*) buf;
+    default_heap_buffer = (char*) buf;
+    m61_heap_init(&default_heap, default_heap_buffer, M61_HEAP_SIZE);
+    if (const char* rate = getenv("M61_SAMPLE_RATE"))
+        m61_set_sample_rate(strtoul(rate, nullptr, 0));
+    __atomic_store_n(&default_heap_ready, true, __ATOMIC_RELEASE);
+}
+
+/// m61_init_default_heap()
+///    Lay out the default heap the first time it is used. That can come
+///    before static initialization reaches `default_buffer`: a preloaded
+///    m61 serves the allocations of other libraries' constructors.
+static inline void m61_init_default_heap() {
+    if (__builtin_expect(!__atomic_load_n(&default_heap_ready, __ATOMIC_ACQUIRE), false))
+        pthread_once(&default_heap_once, m61_map_default_heap);
+}
+
+m61_memory_buffer::m61_memory_buffer() {
+    m61_init_default_heap();
+    this->buffer = default_heap_buffer;
+}
+
+/// m61_heap_init(h, buffer, size)
+///    Lay out an empty heap in the `size` bytes at `buffer` and point the
+///    root `h` at it. Statistics are reset; the lock is left untouched.
+void m61_heap_init(m61_heap* h, char* buffer, size_t size) {
+    size_t* prologue_header;
+    size_t* free_header;
+    size_t* end_header;
+    size_t free_header_size;
+    size_t prologue_size;
 
     // create three initial blocks (see test52 for assertions re: heap initialization)
     // prologue (allocated)
-    prologue_header = (size_t*)this->buffer + 1; // for alignment reasons
+    prologue_header = (size_t*)buffer + 1; // for alignment reasons
     prologue_size = WORD_SIZE * 2;
     m61_set_header_and_footer(prologue_header, prologue_size, ALLOC_BIT | PREV_ALLOC_BIT);
 
     // initial free block (free)
     free_header = NEXT_FROM_HEADER(prologue_header);
-    free_header_size = this->size - GET_SIZE(prologue_header) - WORD_SIZE * 2;
+    free_header_size = size - GET_SIZE(prologue_header) - WORD_SIZE * 2;
     m61_set_header_and_footer(free_header, free_header_size, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
 
     // free block list pointers
@@ -52,16 +430,25 @@ m61_memory_buffer::m61_memory_buffer() {
 
     // initialize free & allocated lists
     // see test58 for validation of list structures
-    free_list_start = free_header;
-    alloc_list_start = nullptr;
+    h->free_list_start = free_header;
+    h->alloc_list_start = nullptr;
 
     // keep track of where the heap starts & ends
-    top_of_heap = prologue_header;
-    end_of_heap = end_header;
+    h->top_of_heap = prologue_header;
+    h->end_of_heap = end_header;
+
+    h->statistics = {0, 0, 0, 0, 0, 0, 0, 0, UINTPTR_MAX, 0, 0, 0, 0};
+    h->open_scopes = 0;
+    h->scope_tail = nullptr;
+    h->remote_frees = nullptr;
+    h->nreserved = 0;
+    for (m61_reserved_class& rc : h->reserved)
+        rc = {0, 0, nullptr};
 }
 
+// the default heap stays mapped until the process exits: destructors that
+// run after this one may still free into it
 m61_memory_buffer::~m61_memory_buffer() {
-    munmap(this->buffer, this->size);
 }
 
 /// m61_malloc(sz, file, line)
@@ -71,34 +458,87 @@ m61_memory_buffer::~m61_memory_buffer() {
 ///    The allocation request was made at source code location `file`:`line`.
 
 void* m61_malloc(size_t sz, const char* file, int line) {
-    size_t asize;
-    size_t* header;
-
     if (sz == 0)
         return nullptr;
 
     // detect unsigned integer overflow
     if (sz > SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE)) {
-        goto fail;
+        STAT_ADD(nfail, 1);
+        STAT_ADD(fail_size, sz);
+        return nullptr;
     }
 
-    asize = m61_get_adjusted_size(sz);
+    return m61_malloc_class(sz, m61_get_adjusted_size(sz), file, line);
+}
 
-    if ((header = m61_find_fit(asize)) != nullptr) {
-        assert(!IS_ALLOC(header));  // we are allocating a free block
-        m61_place(header, asize);
-        assert(IS_ALLOC(header));   // the free block has been allocated
+/// m61_malloc_class(sz, asize, file, line)
+///    Allocate `sz` bytes in a block of size class `asize`, which is
+///    `m61_get_adjusted_size(sz)`; `sz` is neither 0 nor big enough to
+///    overflow. `m61_malloc` checks and computes these at run time,
+///    `m61_malloc<N>` at compile time. The allocation may be sampled.
+void* m61_malloc_class(size_t sz, size_t asize, const char* file, int line) {
+    void* ptr;
+
+    m61_use_heap_arena();
+    if (m61_sample_allocation(sz) && (ptr = m61_guarded_alloc(sz, file, line)) != nullptr)
+        return ptr;
+    return m61_heap_malloc_class(sz, asize, file, line);
+}
+
+/// m61_malloc_in_heap(sz, file, line)
+///    Like `m61_malloc`, but never sampled: the block is always in the
+///    heap, with boundary tags that tagged and relocatable allocations
+///    update.
+static void* m61_malloc_in_heap(size_t sz, const char* file, int line) {
+    if (sz == 0 || sz > SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE))
+        return m61_malloc(sz, file, line);      // fails as m61_malloc does
+    m61_use_heap_arena();
+    return m61_heap_malloc_class(sz, m61_get_adjusted_size(sz), file, line);
+}
+
+/// m61_heap_malloc_class(sz, asize, file, line)
+///    Allocate `sz` bytes in a heap block of size class `asize`, as
+///    `m61_malloc_class` does for allocations that are not sampled.
+static void* m61_heap_malloc_class(size_t sz, size_t asize, const char* file, int line) {
+    size_t* header;
+
+    if (__atomic_load_n(&heap->nreserved, __ATOMIC_RELAXED) != 0) {
+        M61_LOCK_THREAD_HEAP();
+        if ((header = m61_reserved_pop(asize)) != nullptr) {   // set aside by m61_reserve
+            m61_set_alloc_metadata(header, sz, file, line);
+            m61_record_malloc(header, sz);
+            return GET_PAYLOAD(header);
+        }
+    }
+
+    if ((header = m61_tcache_pop(asize)) != nullptr) {   // cached block, no lock needed
+        M61_ROUTE_HEAP(GET_PAYLOAD(header));             // counted by the arena holding it
         m61_set_alloc_metadata(header, sz, file, line);
         m61_record_malloc(header, sz);
         return GET_PAYLOAD(header);
     }
 
-fail:
-    statistics.nfail += 1;
-    statistics.fail_size += sz;
+    {
+        M61_LOCK_THREAD_HEAP();
+        if ((header = m61_find_fit(asize)) != nullptr
+            || (m61_reclaim_memory() && (header = m61_find_fit(asize)) != nullptr)) {
+            assert(!IS_ALLOC(header));  // we are allocating a free block
+            m61_place(header, asize);
+            assert(IS_ALLOC(header));   // the free block has been allocated
+            m61_set_alloc_metadata(header, sz, file, line);
+            m61_record_malloc(header, sz);
+            return GET_PAYLOAD(header);
+        }
+    }
+
+    STAT_ADD(nfail, 1);
+    STAT_ADD(fail_size, sz);
     return nullptr;
 }
 
+static_assert(m61_size_class(1) == MIN_BLOCK && m61_size_class(MIN_PAYLOAD + 1) == MIN_BLOCK + ALIGNMENT,
+              "size classes must match m61_get_adjusted_size");
+
 /// m61_get_adjusted_size(sz)
 ///    Return the size of a block needed to allocate sz bytes
 size_t m61_get_adjusted_size(size_t sz) {
@@ -121,7 +561,7 @@ size_t m61_get_adjusted_size(size_t sz) {
 ///    Return a pointer to `asize` bytes by traversing the explicit
 ///    free list. Returns nullptr if no suitable free block found.
 size_t* m61_find_fit(size_t asize) {
-    size_t* header = free_list_start;
+    size_t* header = heap->free_list_start;
 
     while (header != nullptr) {
         if (GET_SIZE(header) >= asize)
@@ -134,14 +574,17 @@ size_t* m61_find_fit(size_t asize) {
 /// m61_place(header, asize)
 ///    Places a block of `asize` bytes in the free block with header
 ///    `header`, splitting the remainder into a new free block if
-///    it exceeds the minimum block size
+///    it exceeds the minimum block size. The block keeps its PREV_ALLOC
+///    bit, which is clear only after `m61_find_aligned_fit` split off
+///    leading slack.
 void m61_place(size_t* header, size_t asize) {
-    size_t** prev_free = LIST_PREV(header);
-    size_t** next_free = LIST_NEXT(header);
+    m61_link* prev_free = LIST_PREV(header);
+    m61_link* next_free = LIST_NEXT(header);
+    char prev_bit = GET_BITS(header) & PREV_ALLOC_BIT;
     size_t* new_free_header;
     size_t new_free_size;
 
-    m61_unstitch_list(prev_free, next_free, &free_list_start);    // remove the block from the free list
+    m61_unstitch_list(prev_free, next_free, &heap->free_list_start);    // remove the block from the free list
 
     if (GET_SIZE(header) - asize >= MIN_BLOCK) {       // split the block
 
@@ -149,31 +592,33 @@ void m61_place(size_t* header, size_t asize) {
         new_free_size = GET_SIZE(header) - asize;
         new_free_header = INCREMENT_SIZE_T_PTR(header, asize);
         m61_set_header_and_footer(new_free_header, new_free_size, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
-        m61_push_to_front(new_free_header, free_list_start);
+        m61_push_to_front(new_free_header, heap->free_list_start);
 
         // create allocated block
-        m61_set_header_and_footer(header, asize, ALLOC_BIT | PREV_ALLOC_BIT);
+        m61_set_header_and_footer(header, asize, ALLOC_BIT | prev_bit);
 
     } else {                                           // don't split
 
-        m61_set_header_and_footer(header, GET_SIZE(header), ALLOC_BIT | PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
+        m61_set_header_and_footer(header, GET_SIZE(header), ALLOC_BIT | prev_bit | NEXT_ALLOC_BIT);
         TOGGLE_NEXT_BITS(header, PREV_ALLOC_BIT);      // let the next block know
 
     }
 
     TOGGLE_PREV_BITS(header, NEXT_ALLOC_BIT);          // let the prev block know
-    m61_push_to_front(header, alloc_list_start);       // push to front of alloc list
+    m61_link_allocated(header, header);                 // link into alloc list
 }
 
-/// m61_set_alloc_metadata(header, sz, file, line)
+/// m61_set_alloc_metadata(header, sz, file, line, tag)
 ///    Store the metadata for an allocated block in the block, including
-///    requested size `sz` and file and line number of the allocation.
-void m61_set_alloc_metadata(size_t* header, unsigned int sz, const char* file, int line) {
+///    requested size `sz`, file and line number of the allocation and tag.
+void m61_set_alloc_metadata(size_t* header, unsigned int sz, const char* file, int line, unsigned tag) {
+    if (!m61_is_heap_arena(heap))       // other processes can't read our strings
+        file = m61_intern_file(heap, file);
     SET_REQ_SIZE(header, sz);
     set_footer_magic_number(header, sz);
     SET_LINE_NUMBER(header, line);
     SET_FILENAME(header, file);
-    SET_HEADER_ADDR(header, header);
+    SET_HEADER_ADDR(header, heap->top_of_heap.get(), header, tag);
 }
 
 /// m61_record_malloc(sz)
@@ -181,17 +626,46 @@ void m61_set_alloc_metadata(size_t* header, unsigned int sz, const char* file, i
 ///    statistics object
 void m61_record_malloc(size_t* header, size_t sz) {
 
-    void* payload = GET_PAYLOAD(header);
+    uintptr_t payload = (uintptr_t) GET_PAYLOAD(header);
+    unsigned tag = GET_TAG(header);
 
     // increment counters
-    statistics.ntotal += 1;
-    statistics.nactive += 1;
-    statistics.active_size += sz;
-    statistics.total_size += sz;
+    STAT_ADD(ntotal, 1);
+    STAT_ADD(nactive, 1);
+    STAT_ADD(active_size, sz);
+    STAT_ADD(total_size, sz);
+    if (tag != 0) {
+        TAG_STAT_ADD(tag, ntotal, 1);
+        TAG_STAT_ADD(tag, nactive, 1);
+        TAG_STAT_ADD(tag, active_size, sz);
+        TAG_STAT_ADD(tag, total_size, sz);
+    }
+
+    m61_record_heap_bounds(payload, payload + sz);
+}
+
+/// m61_record_heap_bounds(min, max)
+///    Widen the statistics' heap_min and heap_max to cover [min, max)
+static void m61_record_heap_bounds(uintptr_t min, uintptr_t max) {
+    uintptr_t base = (uintptr_t) heap->top_of_heap.get();
 
-    // update heap min & max
-    statistics.heap_max = (uintptr_t)payload + sz > statistics.heap_max ? (uintptr_t)payload + sz : statistics.heap_max;
-    statistics.heap_min = (uintptr_t)payload < statistics.heap_min ? (uintptr_t)payload : statistics.heap_min;
+    min -= base;
+    max -= base;
+#if M61_THREADS
+    uintptr_t bound = STAT_LOAD(heap_max);
+    while (max > bound
+           && !__atomic_compare_exchange_n(&heap->statistics.heap_max, &bound, max,
+                                           true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    bound = STAT_LOAD(heap_min);
+    while (min < bound
+           && !__atomic_compare_exchange_n(&heap->statistics.heap_min, &bound, min,
+                                           true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+#else
+    heap->statistics.heap_max = max > heap->statistics.heap_max ? max : heap->statistics.heap_max;
+    heap->statistics.heap_min = min < heap->statistics.heap_min ? min : heap->statistics.heap_min;
+#endif
 }
 
 /// m61_free(ptr, file, line)
@@ -203,186 +677,916 @@ void m61_record_malloc(size_t* header, size_t sz) {
 void m61_free(void* ptr, const char* file, int line) {
     size_t* header;
     size_t requested_size;
+    unsigned tag;
 
     if (ptr == nullptr)
         return;
+    if (m61_is_guarded(ptr)) {
+        m61_guarded_free(ptr, 0, file, line);
+        return;
+    }
+    M61_ROUTE_HEAP(ptr);
+    if (m61_tcache_push(ptr, file, line))   // cached (or reported) without the lock
+        return;
+    if (m61_remote_push(ptr))               // queued for another thread's arena
+        return;
+
+    M61_LOCK_HEAP();
     if (m61_validate_free(ptr, file, line)) {
         header = GET_HEADER_FROM_PAYLOAD(ptr);
         assert(IS_ALLOC(header));    // we are freeing an allocated block
-        m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &alloc_list_start);   // remove from allocated list
-        requested_size = *REQ_SIZE_FROM_HEADER(header);;
+        m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->alloc_list_start);   // remove from allocated list
+        requested_size = *REQ_SIZE_FROM_HEADER(header);
+        tag = GET_TAG(header);
         header = m61_coalesce(header);
         assert(!IS_ALLOC(header));   // the allocated block has been freed
-        m61_record_free(requested_size);
+        m61_record_free(requested_size, tag);
     }
 }
 
-/// m61_validate_free(ptr, file, line)
-///    Validate a particular free request. Checks for double frees,
-///    wild frees, wild writes, and buffer overflows.
-bool m61_validate_free(void* ptr, const char* file, int line) {
-    const char* container_file;
+/// m61_release_block(header, file, line)
+///    Return allocated block `header` to the free list without validating
+///    it, recording the free unless the block is a scope marker or was
+///    already counted as freed when it entered a thread's cache or an
+///    arena's remote-free queue. Retired blocks have already left the
+///    allocated list. Reports a wild write if the block's magic number was
+///    overwritten.
+static void m61_release_block(size_t* header, const char* file, int line) {
+    size_t requested_size = *REQ_SIZE_FROM_HEADER(header);
+    unsigned tag = GET_TAG(header);
+    bool marker = *GET_FILENAME(header) == scope_marker || *GET_FILENAME(header) == tcache_marker
+        || *GET_FILENAME(header) == remote_marker;
+    bool retired = *GET_FILENAME(header) == retired_marker;
+
+    if (*GET_FILENAME(header) == scope_marker)
+        m61_scope_close(header);
+
+    if (!check_footer_magic_number(header, requested_size))
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, GET_PAYLOAD(header));
+    if (!retired)
+        m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->alloc_list_start);
+    m61_coalesce(header);
+    if (!marker)
+        m61_record_free(requested_size, tag);
+}
+
+// a block holds a reserve when it has room for a block's worth more than
+// it was asked for, which only growing reallocs leave
+#define HAS_RESERVE(header) \
+    (GET_SIZE(header) - m61_get_adjusted_size(*REQ_SIZE_FROM_HEADER(header)) >= MIN_BLOCK)
+
+/// m61_quick_check_free(ptr)
+///    Make the checks of `m61_validate_free` that read no shared state.
+///    Returns the header of `ptr`'s block if they pass, or nullptr, in
+///    which case `m61_free` repeats the full validation under the lock.
+///    Blocks are never freed without the lock while a scope is open.
+static size_t* m61_quick_check_free(void* ptr) {
     uintptr_t ptr_val = (uintptr_t) ptr;
     size_t* header = GET_HEADER_FROM_PAYLOAD(ptr);
-    size_t* footer;
-    size_t* container;
-    size_t diff;
-    unsigned int container_line;
-    unsigned int container_size;
+    const char* file;
 
-    // not in heap
-    if (ptr_val < statistics.heap_min || ptr_val > statistics.heap_max) {
-        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
-        return false;
-    }
+    if (__atomic_load_n(&heap->open_scopes, __ATOMIC_RELAXED) != 0
+        || ptr_val < HEAP_BOUND(heap_min) || ptr_val > HEAP_BOUND(heap_max)
+        || ptr_val % ALIGNMENT != 0
+        || !IS_ALLOC(header)
+        || header != GET_HEADER_ADDR(header, heap->top_of_heap.get())
+        || !IS_ALLOC(FOOTER_FROM_HEADER(header))
+        || !check_footer_magic_number(header, *REQ_SIZE_FROM_HEADER(header))
+        || HAS_RESERVE(header))      // m61_trim_reserves may resize it under the lock
+        return nullptr;
 
-    // we never would have allocated a misaligned block
-    if (ptr_val % alignof(std::max_align_t) != 0) {
-        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
-        return false;
+    file = GET_FILENAME(header)->load();
+    if (file == scope_marker || file == tcache_marker || file == remote_marker
+        || file == retired_marker || file == reserved_marker)
+        return nullptr;
+    return header;
+}
+
+/// m61_free_sized(ptr, sz, file, line)
+///    Like `m61_free`, but `sz`, the size the caller allocated, stands in
+///    for the checks that read the heap's lists: a block that passes
+///    `m61_quick_check_free` and has room for `sz` bytes is freed without
+///    them. Anything else gets `m61_free`'s full validation.
+void m61_free_sized(void* ptr, size_t sz, const char* file, int line) {
+    size_t* header;
+
+    if (ptr == nullptr)
+        return;
+    if (m61_is_guarded(ptr)) {
+        m61_guarded_free(ptr, sz, file, line);
+        return;
+    }
+    M61_ROUTE_HEAP(ptr);
+    if ((header = m61_quick_check_free(ptr)) == nullptr) {
+        m61_free(ptr, file, line);
+        return;
+    }
+    if (sz > *REQ_SIZE_FROM_HEADER(header)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, size %zu larger than the %u bytes allocated\n",
+                file, line, ptr, sz, *REQ_SIZE_FROM_HEADER(header));
+        return;
     }
+    if (m61_tcache_push(ptr, file, line, header) || m61_remote_push(ptr, header))
+        return;
 
-    // if the block *looks* like a free block...
-    if (!IS_ALLOC(header)) {
+    M61_LOCK_HEAP();
+    if (m61_quick_check_free(ptr) != nullptr     // unless something changed before the lock
+        || m61_validate_free(ptr, file, line))
+        m61_release_block(header, file, line);
+}
 
-        if (m61_is_free_block(header)) {                // check if it's a *real* free block
-            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
-            return false;
-        }
-        
-        footer = INCREMENT_SIZE_T_PTR(header, GET_SIZE(header)); // this is where the footer should be
-        if (HEADER_FROM_FOOTER(footer) != header) {     // check if the footer points to the header
+#if M61_THREADS
+// recently freed blocks of up to TCACHE_MAX_SIZE bytes are cached, one bin
+// per block size. Cached blocks stay allocated as far as the heap is
+// concerned (they keep their boundary tags and their place in the allocated
+// list), so caching and reusing them touches no shared heap state.
+// Bins are arrays rather than lists threaded through the blocks, so a
+// double free into a cache is caught by scanning the bin.
+// While any scope is open the caches stand aside, so that every block
+// allocated inside a scope is pushed in front of its marker.
+//
+// Caches are per thread and hold blocks of the thread's arena. Built with
+// PERCPU=1 they are per CPU instead and hold blocks of any arena: a thread
+// pushes and pops the cache of the CPU it runs on in a restartable sequence
+// (rseq). The kernel sends the thread to the sequence's abort handler if
+// it is preempted, migrated or signaled before the single store that
+// commits the push or pop, so the sequences take no lock and use no atomic
+// instruction. A thread that needs the caches of other CPUs, to flush
+// them, marks every cache stopped, which the sequences check, and issues
+// an rseq membarrier so that no sequence begun before the mark can commit.
+// A cache that is full, empty or stopped sends its thread to the heap. A
+// block in a CPU cache carries the cache marker, so freeing it again fails
+// `m61_quick_check_free` and is reported under the heap lock. Without
+// x86-64, rseq or the rseq membarrier, threads fall back to their own
+// caches. The lock serializing stops nests inside heap locks.
+#define TCACHE_BINS     64
+#define TCACHE_COUNT    16
+#define TCACHE_REFILL   (TCACHE_COUNT / 2)
+#define TCACHE_MAX_SIZE (MIN_BLOCK + (TCACHE_BINS - 1) * ALIGNMENT)
+#define TCACHE_BIN(asize) (((asize) - MIN_BLOCK) / ALIGNMENT)
 
-            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
-            if ((container = m61_contains_ptr(ptr)) != nullptr) {   // check if ptr is inside an allocated block
+struct alignas(64) m61_tcache {
+    size_t* bins[TCACHE_BINS][TCACHE_COUNT];
+    unsigned counts[TCACHE_BINS];
+    int stopped;                    // CPU caches only: set while another
+                                    // thread flushes the cache
+};
 
-                diff = ptr_val - (uintptr_t)GET_PAYLOAD(container);
-                container_file = *GET_FILENAME(container);
-                container_line = *GET_LINE_NUMBER(container);
-                container_size = *REQ_SIZE_FROM_HEADER(container);
-                fprintf(stderr, "\t%s:%d: %p is %zu bytes inside a %d byte region allocated here\n", container_file, container_line, ptr, diff, container_size);
+// this thread's cache, only mapped once the thread uses it
+static thread_local m61_tcache* thread_cache = nullptr;
 
-            }
-            return false;
+/// m61_thread_cache_owner
+///    Flushes this thread's cache when the thread exits. The cache pointer
+///    lives outside the owner so that frees from later exit handlers see
+///    it cleared: a store to a dying object may be optimized away.
+struct m61_thread_cache_owner {
+    ~m61_thread_cache_owner();
+};
+static thread_local m61_thread_cache_owner thread_cache_owner;
 
-        }
+#if M61_CPU_CACHES
+static m61_tcache* cpu_caches = nullptr;    // one per configured CPU, or
+static unsigned ncpu_caches = 0;            // nullptr without rseq
+static pthread_once_t cpu_caches_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t cpu_caches_stop_lock = PTHREAD_MUTEX_INITIALIZER;
 
-        assert(false);   // a "free" block must fall into one of the two above categories
+/// m61_init_cpu_caches()
+///    Map a cache for every configured CPU if the kernel and glibc
+///    maintain an rseq area for each thread and the process can register
+///    for rseq membarriers.
+static void m61_init_cpu_caches() {
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    void* buf;
 
-    // if the block doesn't look like a free block...
-    } else {
+    if (__rseq_size == 0 || ncpus <= 0
+        || syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ, 0, 0) != 0)
+        return;
+    buf = mmap(nullptr, ncpus * sizeof(m61_tcache), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (buf == MAP_FAILED)
+        return;
+    cpu_caches = (m61_tcache*) buf;
+    ncpu_caches = ncpus;
+}
 
-        if (!check_footer_magic_number(header, *REQ_SIZE_FROM_HEADER(header))) { // check for buffer overrun
-            fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
-            return false;
-        }
+/// m61_cpu_caches()
+///    Return the array of CPU caches, or nullptr if threads use their own.
+static inline m61_tcache* m61_cpu_caches() {
+    pthread_once(&cpu_caches_once, m61_init_cpu_caches);
+    return cpu_caches;
+}
 
-        if (header != *GET_HEADER_ADDR(header)) { // check that the block is where the block thinks it is
-            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
-            return false;
-        }
+/// m61_rseq_area()
+///    Return the rseq area glibc registered for this thread.
+static inline struct rseq* m61_rseq_area() {
+    return (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+}
 
-        if (!m61_validate_block_ptrs(header)) {   // check in constant time that the block is actually in the allocated list 
-            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
-            return false;
-        }
+// M61_RSEQ_SEQUENCE(setup, commit) is the text of a restartable sequence.
+// It installs its descriptor, loads the current CPU's cache into %rax, and
+// leaves through label 5 if the CPU has no cache or the cache is stopped.
+// `setup` runs next and must jump to label 5 if the operation cannot be
+// done, or to label 9 if the block is already cached; `commit` is the
+// single store that publishes it. The sequence leaves 0 in `status` if it
+// committed, 1 if it jumped to label 5, 2 if it was aborted, and 3 if it
+// jumped to label 9. The abort handler is preceded by RSEQ_SIG, as the kernel
+// requires.
+#define M61_RSEQ_STR2(x) #x
+#define M61_RSEQ_STR(x) M61_RSEQ_STR2(x)
+#define M61_RSEQ_SEQUENCE(setup, commit)                                    \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                                    \
+    ".balign 32\n"                                                          \
+    "3:\n\t"                                                                \
+    ".long 0, 0\n\t"                                                        \
+    ".quad 1f, 2f - 1f, 4f\n\t"                                             \
+    ".popsection\n\t"                                                       \
+    "xorl %k[status], %k[status]\n\t"                                       \
+    "leaq 3b(%%rip), %%rax\n\t"                                             \
+    "movq %%rax, %c[rseq_cs](%[area])\n"                                    \
+    "1:\n\t"                                                                \
+    "movl %c[cpu_id](%[area]), %%eax\n\t"                                   \
+    "cmpl %[ncpu], %%eax\n\t"                                               \
+    "jae 5f\n\t"                                                            \
+    "imulq %[cache_size], %%rax, %%rax\n\t"                                 \
+    "addq %[caches], %%rax\n\t"                                             \
+    "cmpl $0, %c[stopped](%%rax)\n\t"                                       \
+    "jne 5f\n\t"                                                            \
+    setup                                                                   \
+    commit                                                                  \
+    "2:\n\t"                                                                \
+    "jmp 6f\n"                                                              \
+    "5:\n\t"                                                                \
+    "movl $1, %k[status]\n\t"                                               \
+    "jmp 6f\n"                                                              \
+    "9:\n\t"                                                                \
+    "movl $3, %k[status]\n\t"                                               \
+    "jmp 6f\n\t"                                                            \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                               \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                            \
+    ".long " M61_RSEQ_STR(RSEQ_SIG) "\n"                                    \
+    "4:\n\t"                                                                \
+    "movl $2, %k[status]\n\t"                                               \
+    "jmp 6f\n\t"                                                            \
+    ".popsection\n"                                                         \
+    "6:\n\t"
+#define M61_RSEQ_INPUTS                                                     \
+    [area] "r" (m61_rseq_area()), [caches] "r" (cpu_caches),                \
+    [ncpu] "r" (ncpu_caches), [cache_size] "i" (sizeof(m61_tcache)),        \
+    [rseq_cs] "i" (offsetof(struct rseq, rseq_cs)),                         \
+    [cpu_id] "i" (offsetof(struct rseq, cpu_id)),                           \
+    [stopped] "i" (offsetof(m61_tcache, stopped))
 
-    }
+/// m61_cpu_cache_pop(bin)
+///    Pop a block from bin `bin` of the current CPU's cache, restarting if
+///    the sequence is aborted. Returns nullptr if the bin is empty or the
+///    cache is stopped.
+static inline size_t* m61_cpu_cache_pop(size_t bin) {
+    size_t count_offset = offsetof(m61_tcache, counts) + bin * sizeof(unsigned);
+    size_t bin_offset = offsetof(m61_tcache, bins) + bin * sizeof(cpu_caches->bins[0]);
+    size_t* header;
+    unsigned status;
 
-    return true;
+    do {
+        __asm__ __volatile__(
+            M61_RSEQ_SEQUENCE(
+                "movl (%%rax, %[count]), %%ecx\n\t"
+                "testl %%ecx, %%ecx\n\t"
+                "jz 5f\n\t"
+                "subl $1, %%ecx\n\t"
+                "leaq (%%rax, %[bin]), %%rdx\n\t"
+                "movq (%%rdx, %%rcx, 8), %[header]\n\t",
+                "movl %%ecx, (%%rax, %[count])\n")
+            : [status] "=&r" (status), [header] "=&r" (header)
+            : M61_RSEQ_INPUTS, [count] "r" (count_offset), [bin] "r" (bin_offset)
+            : "rax", "rcx", "rdx", "memory", "cc");
+    } while (status == 2);
+    return status == 0 ? header : nullptr;
 }
 
-/// m61_is_free_block(header)
-///    Determines if a header represents a valid free block by 
-///    checking that the footer matches the header, the size is not 0,
-///    the footer is also marked free, and the header & footer sizes match
-bool m61_is_free_block(size_t* header) {
-    size_t* footer = header + (GET_SIZE(header) / WORD_SIZE) - 1;          // get the footer manually to avoid scary dereferences
-    if (HEADER_FROM_FOOTER(footer) == header && (GET_SIZE(header) != 0)) { // if the footer points to the header...
-        if (!IS_ALLOC(footer) && (GET_SIZE(footer) == GET_SIZE(header)))   // and both are free & match, it's a free block
-            return true;
-    }
-    return false;
-}
+/// m61_cpu_cache_push(bin, header)
+///    Push block `header` onto bin `bin` of the current CPU's cache,
+///    restarting if the sequence is aborted. Returns 0 if it was pushed, 1
+///    if the bin is full or the cache is stopped, and 3 if the bin already
+///    holds the block.
+static inline unsigned m61_cpu_cache_push(size_t bin, size_t* header) {
+    size_t count_offset = offsetof(m61_tcache, counts) + bin * sizeof(unsigned);
+    size_t bin_offset = offsetof(m61_tcache, bins) + bin * sizeof(cpu_caches->bins[0]);
+    unsigned status;
 
-/// m61_validate_block_ptrs(header)
-///    Validates that a block is a member of the list it thinks it's in
-///    by checking that the previous and next blocks point back to `header`
-bool m61_validate_block_ptrs(size_t* header) {
-    size_t** next = LIST_NEXT(header);
-    size_t** prev = LIST_PREV(header);
-    if (*next != nullptr && *LIST_PREV(*next) != header)
-        return false;
-    if (*prev != nullptr && *LIST_NEXT(*prev) != header)
-        return false;
-    return true;
+    do {
+        __asm__ __volatile__(
+            M61_RSEQ_SEQUENCE(
+                "movl (%%rax, %[count]), %%ecx\n\t"
+                "cmpl %[capacity], %%ecx\n\t"
+                "jae 5f\n\t"
+                "leaq (%%rax, %[bin]), %%rdx\n\t"
+                "xorl %%r8d, %%r8d\n"                         // scan the bin for the block
+                "7:\n\t"
+                "cmpl %%ecx, %%r8d\n\t"
+                "je 8f\n\t"
+                "cmpq %[header], (%%rdx, %%r8, 8)\n\t"
+                "je 9f\n\t"
+                "addl $1, %%r8d\n\t"
+                "jmp 7b\n"
+                "8:\n\t"
+                "movq %[header], (%%rdx, %%rcx, 8)\n\t"     // past the count until the commit
+                "addl $1, %%ecx\n\t",
+                "movl %%ecx, (%%rax, %[count])\n")
+            : [status] "=&r" (status)
+            : M61_RSEQ_INPUTS, [count] "r" (count_offset), [bin] "r" (bin_offset),
+              [header] "r" (header), [capacity] "i" (TCACHE_COUNT)
+            : "rax", "rcx", "rdx", "r8", "memory", "cc");
+    } while (status == 2);
+    return status;
 }
 
-/// m61_contains_ptr(ptr)
-///    Determines if any allocated block contains `ptr`, by traversing the
-///    allocated list, returning the block if so, otherwise nullptr
-size_t* m61_contains_ptr(void* ptr) {
-    uintptr_t ptr_int = (uintptr_t) ptr;
-    size_t* block = alloc_list_start;
-    size_t req_size;
-    void* payload;
-    while (block != nullptr) {
-        req_size = *REQ_SIZE_FROM_HEADER(block);
-        payload = GET_PAYLOAD(block);
-        if (ptr_int > (uintptr_t)payload && ptr_int < (uintptr_t)((char*)payload + req_size)) {
-            return block;
-        }
-        block = *LIST_NEXT(block);
-    }
+/// m61_stop_cpu_caches(), m61_start_cpu_caches()
+///    Take every CPU cache away from the restartable sequences, so the
+///    caller may change any of them, and give them back. Once the stop
+///    flags are set, the membarrier aborts any sequence still running, and
+///    sequences begun after it see the flags.
+static void m61_stop_cpu_caches() {
+    pthread_mutex_lock(&cpu_caches_stop_lock);
+    for (unsigned cpu = 0; cpu != ncpu_caches; ++cpu)
+        __atomic_store_n(&cpu_caches[cpu].stopped, 1, __ATOMIC_RELAXED);
+    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ, 0, 0);
+}
+static void m61_start_cpu_caches() {
+    for (unsigned cpu = 0; cpu != ncpu_caches; ++cpu)
+        __atomic_store_n(&cpu_caches[cpu].stopped, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&cpu_caches_stop_lock);
+}
+#else
+static inline m61_tcache* m61_cpu_caches() {
     return nullptr;
 }
+#endif
 
-/// m61_coalesce(header)
-///    Determines whether the block indicated by `header` can be coalesced
-///    up, down, or both, and calls appropriate coalescing functions as necessary.
-size_t* m61_coalesce(size_t* header) {
-    bool prev_alloc = IS_PREV_ALLOC(header);
-    bool next_alloc = IS_NEXT_ALLOC(header);
-    size_t size = GET_SIZE(header);
-    size_t* prev = PREV_FROM_HEADER(header);
-    size_t* next = NEXT_FROM_HEADER(header);
+/// m61_cache_get()
+///    Return this thread's cache, or nullptr if it cannot be mapped.
+static m61_tcache* m61_cache_get() {
+    void* buf;
 
-    if (prev_alloc && next_alloc) {             // can't coalesce
-        m61_set_header_and_footer(header, size, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
-        TOGGLE_NEXT_BITS(header, PREV_ALLOC_BIT);
-        TOGGLE_PREV_BITS(header, NEXT_ALLOC_BIT);
+    if (thread_cache == nullptr) {
+        buf = mmap(nullptr, sizeof(m61_tcache), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (buf == MAP_FAILED)
+            return nullptr;
+        (void) &thread_cache_owner;     // registers the owner's destructor
+        thread_cache = (m61_tcache*) buf;
     }
+    return thread_cache;
+}
 
-    else if (prev_alloc && !next_alloc) {       // coalesce with next block
-        header = m61_coalesce_next(header, next);
-        TOGGLE_PREV_BITS(header, NEXT_ALLOC_BIT);
-    }
+/// m61_cacheable_heap()
+///    Return true if blocks of `heap` may be cached by this thread.
+static inline bool m61_cacheable_heap() {
+    if (m61_cpu_caches() != nullptr)
+        return m61_is_heap_arena(heap);
+    return heap == thread_heap;
+}
 
-    else if (!prev_alloc && next_alloc) {       // coalesce with prev block
-        header = m61_coalesce_prev(header, prev);
-        TOGGLE_NEXT_BITS(header, PREV_ALLOC_BIT);
-    }
-    
-    else {                                      // coalesce in both directions
-        header = m61_coalesce_prev(header, prev);
-        header = m61_coalesce_next(header, next);
+/// m61_release_cached(blocks, n)
+///    Return `n` cached blocks to the arenas holding them. The caller has
+///    not stopped the CPU caches.
+static void m61_release_cached(size_t** blocks, unsigned n) {
+    for (unsigned i = 0; i != n; ++i) {
+        M61_ROUTE_HEAP(GET_PAYLOAD(blocks[i]));
+        M61_LOCK_HEAP();
+        m61_release_block(blocks[i], "?", 0);
     }
+}
 
-    m61_push_to_front(header, free_list_start);
+/// m61_cache_take_all(c, blocks)
+///    Empty cache `c` into `blocks`, which has room for a full cache, and
+///    return the number of blocks taken.
+static unsigned m61_cache_take_all(m61_tcache* c, size_t** blocks) {
+    unsigned n = 0;
 
-    return header;
+    for (size_t bin = 0; bin != TCACHE_BINS; ++bin) {
+        memcpy(blocks + n, c->bins[bin], c->counts[bin] * sizeof(size_t*));
+        n += c->counts[bin];
+        c->counts[bin] = 0;
+    }
+    return n;
 }
 
-/// m61_coalesce_next(header, next)
+/// m61_cache_flush_heap(c)
+///    Return the blocks of `heap` in cache `c` to it. The caller holds the
+///    heap lock and, for a CPU cache, has stopped the CPU caches. Returns
+///    true if any block was returned.
+static bool m61_cache_flush_heap(m61_tcache* c) {
+    bool flushed = false;
+    unsigned kept;
+
+    for (size_t bin = 0; bin != TCACHE_BINS; ++bin) {
+        kept = 0;
+        for (unsigned i = 0; i != c->counts[bin]; ++i) {
+            size_t* header = c->bins[bin][i];
+            if (header > heap->top_of_heap && header < heap->end_of_heap) {
+                m61_release_block(header, "?", 0);
+                flushed = true;
+            } else {
+                c->bins[bin][kept++] = header;
+            }
+        }
+        c->counts[bin] = kept;
+    }
+    return flushed;
+}
+
+/// m61_tcache_flush_all()
+///    Return the cached blocks of `heap` to it: those in this thread's
+///    cache, or in every CPU's. The caller holds the heap lock. Returns
+///    true if any block was returned.
+static bool m61_tcache_flush_all() {
+    bool flushed = false;
+
+    if (!m61_is_heap_arena(heap))
+        return false;
+#if M61_CPU_CACHES
+    if (m61_cpu_caches() != nullptr) {
+        m61_stop_cpu_caches();
+        for (unsigned cpu = 0; cpu != ncpu_caches; ++cpu)
+            flushed |= m61_cache_flush_heap(&cpu_caches[cpu]);
+        m61_start_cpu_caches();
+    }
+#endif
+    if (thread_cache != nullptr)
+        flushed |= m61_cache_flush_heap(thread_cache);
+    return flushed;
+}
+
+#if M61_CPU_CACHES
+/// m61_cpu_tcache_pop(asize)
+///    Take a block of `asize` bytes from the current CPU's cache. If its
+///    bin is empty, carve several blocks from the heap under the heap lock,
+///    return the first and cache the rest; those the cache has no room for
+///    go back to the heap. Returns nullptr if the heap has no room.
+static size_t* m61_cpu_tcache_pop(size_t asize) {
+    size_t bin = TCACHE_BIN(asize);
+    size_t* carved[TCACHE_REFILL];
+    size_t* header;
+    unsigned n = 0;
+
+    if ((header = m61_cpu_cache_pop(bin)) != nullptr)
+        return header;
+
+    M61_LOCK_THREAD_HEAP();
+    while (n != TCACHE_REFILL && (header = m61_find_fit(asize)) != nullptr) {
+        m61_place(header, asize);
+        m61_set_alloc_metadata(header, 0, tcache_marker, 0);
+        if (GET_SIZE(header) != asize)   // the remainder was too small to split off
+            break;
+        carved[n++] = header;
+        header = nullptr;
+    }
+    if (header == nullptr && n != 0)
+        header = carved[0];
+    // push the rest so that they are handed out in address order, as the heap would
+    for (unsigned i = n; i-- != 0; ) {
+        if (carved[i] != header && m61_cpu_cache_push(bin, carved[i]) != 0)
+            m61_release_block(carved[i], "?", 0);
+    }
+    return header;
+}
+#endif
+
+/// m61_tcache_pop(asize)
+///    Take a block of `asize` bytes from this thread's cache, or with
+///    PERCPU=1 from the current CPU's. If its bin is empty, refill it from
+///    the heap under the heap lock, carving several blocks at once.
+///    Returns nullptr if blocks of `asize` bytes are not cached or the heap
+///    has no room for one.
+static size_t* m61_tcache_pop(size_t asize) {
+    size_t bin = TCACHE_BIN(asize);
+    size_t* header = nullptr;
+    m61_tcache* c;
+
+    if (asize > TCACHE_MAX_SIZE || !m61_cacheable_heap()
+        || __atomic_load_n(&heap->open_scopes, __ATOMIC_RELAXED) != 0)
+        return nullptr;
+#if M61_CPU_CACHES
+    if (m61_cpu_caches() != nullptr)
+        return m61_cpu_tcache_pop(asize);
+#endif
+    if ((c = m61_cache_get()) == nullptr)
+        return nullptr;
+
+    if (c->counts[bin] == 0) {
+        M61_LOCK_THREAD_HEAP();
+        while (c->counts[bin] != TCACHE_REFILL && (header = m61_find_fit(asize)) != nullptr) {
+            m61_place(header, asize);
+            m61_set_alloc_metadata(header, 0, tcache_marker, 0);
+            if (GET_SIZE(header) != asize)   // the remainder was too small to split off
+                break;
+            c->bins[bin][c->counts[bin]++] = header;
+            header = nullptr;
+        }
+        // hand the carved blocks out in address order, as the heap would
+        std::reverse(c->bins[bin], c->bins[bin] + c->counts[bin]);
+    }
+
+    if (header == nullptr && c->counts[bin] != 0)
+        header = c->bins[bin][--c->counts[bin]];
+    return header;
+}
+
+/// m61_tcache_push(ptr, file, line, header)
+///    Try to free `ptr` into this thread's cache, or with PERCPU=1 into the
+///    current CPU's, without taking the heap lock. Returns false if the
+///    block fails `m61_quick_check_free` or is not cacheable. Returns true
+///    if the block was freed or a double free into this cache was
+///    reported. `header`, if given, has already passed
+///    `m61_quick_check_free`.
+static bool m61_tcache_push(void* ptr, const char* file, int line, size_t* header) {
+    size_t* spill[TCACHE_COUNT / 2];
+    unsigned nspill = 0;
+    size_t tag;
+    size_t size;
+    size_t bin;
+    m61_tcache* c;
+
+    if (!m61_cacheable_heap()
+        || (header == nullptr && (header = m61_quick_check_free(ptr)) == nullptr))
+        return false;
+
+    // a block that could coalesce with a neighbor is returned to the heap instead
+    tag = LOAD_TAG(header);
+    size = tag & ~(ALLOC_BIT | NEXT_ALLOC_BIT | PREV_ALLOC_BIT);
+    if ((tag & (NEXT_ALLOC_BIT | PREV_ALLOC_BIT)) != (NEXT_ALLOC_BIT | PREV_ALLOC_BIT)
+        || size > TCACHE_MAX_SIZE)
+        return false;
+    bin = TCACHE_BIN(size);
+
+#if M61_CPU_CACHES
+    if (m61_cpu_caches() != nullptr) {
+        // the marker goes on before another CPU's thread can pop the block;
+        // a block the cache has no room for goes back to the heap
+        unsigned requested = *REQ_SIZE_FROM_HEADER(header);
+        unsigned block_tag = GET_TAG(header);
+        SET_FILENAME(header, tcache_marker);
+        switch (m61_cpu_cache_push(bin, header)) {
+        case 3:
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+            return true;
+        case 1:
+            m61_release_cached(&header, 1);
+            break;
+        }
+        m61_record_free(requested, block_tag);
+        return true;
+    }
+#endif
+    if ((c = m61_cache_get()) == nullptr)
+        return false;
+
+    for (unsigned i = 0; i != c->counts[bin]; ++i) {
+        if (c->bins[bin][i] == header) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+            return true;
+        }
+    }
+
+    // a full bin spills its older half
+    if (c->counts[bin] == TCACHE_COUNT) {
+        nspill = TCACHE_COUNT / 2;
+        memcpy(spill, c->bins[bin], nspill * sizeof(size_t*));
+        c->counts[bin] -= nspill;
+        memmove(c->bins[bin], c->bins[bin] + nspill, c->counts[bin] * sizeof(size_t*));
+    }
+
+    m61_record_free(*REQ_SIZE_FROM_HEADER(header), GET_TAG(header));
+    SET_FILENAME(header, tcache_marker);
+    c->bins[bin][c->counts[bin]++] = header;
+    m61_release_cached(spill, nspill);
+    return true;
+}
+
+/// m61_tcache_flush()
+///    Return every block in this thread's cache, or with PERCPU=1 in every
+///    CPU's cache, to its arena.
+void m61_tcache_flush() {
+    size_t* blocks[TCACHE_BINS * TCACHE_COUNT];
+    m61_heap* prev_heap = heap;
+
+    heap = &default_heap;
+#if M61_CPU_CACHES
+    if (m61_cpu_caches() != nullptr) {
+        for (unsigned cpu = 0; cpu != ncpu_caches; ++cpu) {
+            m61_stop_cpu_caches();
+            unsigned n = m61_cache_take_all(&cpu_caches[cpu], blocks);
+            m61_start_cpu_caches();
+            m61_release_cached(blocks, n);
+        }
+    }
+#endif
+    if (thread_cache != nullptr)
+        m61_release_cached(blocks, m61_cache_take_all(thread_cache, blocks));
+    heap = prev_heap;
+}
+
+m61_thread_cache_owner::~m61_thread_cache_owner() {
+    size_t* blocks[TCACHE_BINS * TCACHE_COUNT];
+    m61_heap* prev_heap = heap;
+    m61_tcache* cache = thread_cache;
+
+    if (cache == nullptr)
+        return;
+    heap = &default_heap;
+    m61_release_cached(blocks, m61_cache_take_all(cache, blocks));
+    heap = prev_heap;
+    thread_cache = nullptr;
+    munmap(cache, sizeof(m61_tcache));
+}
+#else
+static inline size_t* m61_tcache_pop(size_t) {
+    return nullptr;
+}
+static inline bool m61_tcache_push(void*, const char*, int, size_t*) {
+    return false;
+}
+static inline bool m61_tcache_flush_all() {
+    return false;
+}
+void m61_tcache_flush() {
+}
+#endif
+
+#if M61_THREADS
+// a block freed by a thread that doesn't own its arena is pushed onto the
+// arena's remote-free queue with a single CAS; the freeing thread never waits
+// for the arena's lock. Its own threads release queued blocks the next time
+// they lock it to allocate; if the lock is free when a block is queued, the
+// owner may be idle, so the freeing thread drains the queue itself. The
+// queue is a stack linked through the line-number slot, which is dead once
+// a block is freed: it holds the word offset of the next block from the top
+// of the heap plus one, or 0 at the end of the queue.
+
+/// m61_remote_push(ptr, header)
+///    Try to free `ptr`, a block of another thread's arena, onto that
+///    arena's remote-free queue. Returns false if the arena belongs to
+///    this thread or the block fails `m61_quick_check_free`. `header`, if
+///    given, has already passed it. Drains the queue if the arena's lock
+///    can be taken without waiting.
+static bool m61_remote_push(void* ptr, size_t* header) {
+    size_t* head;
+    const char* file;
+
+    if (heap == thread_heap || !m61_is_heap_arena(heap)
+        || (header == nullptr && (header = m61_quick_check_free(ptr)) == nullptr))
+        return false;
+
+    // claim the block; a concurrent free of it loses and is reported under the lock
+    file = GET_FILENAME(header)->load();
+    if (file == remote_marker
+        || !GET_FILENAME(header)->compare_exchange(file, remote_marker))
+        return false;
+
+    m61_record_free(*REQ_SIZE_FROM_HEADER(header), GET_TAG(header));
+    head = __atomic_load_n(&heap->remote_frees, __ATOMIC_RELAXED);
+    do {
+        SET_LINE_NUMBER(header, head == nullptr ? 0 : head - heap->top_of_heap + 1);
+    } while (!__atomic_compare_exchange_n(&heap->remote_frees, &head, header,
+                                          true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (pthread_mutex_trylock(&heap->lock) == 0) {
+        m61_drain_remote_frees();
+        pthread_mutex_unlock(&heap->lock);
+    }
+    return true;
+}
+
+/// m61_drain_remote_frees()
+///    Release every block other threads have queued for `heap`. The caller
+///    holds the heap lock. Returns true if any block was queued.
+static bool m61_drain_remote_frees() {
+    size_t* header;
+    unsigned int next;
+
+    if (__atomic_load_n(&heap->remote_frees, __ATOMIC_RELAXED) == nullptr)
+        return false;
+    header = __atomic_exchange_n(&heap->remote_frees, nullptr, __ATOMIC_ACQUIRE);
+    while (header != nullptr) {
+        next = *GET_LINE_NUMBER(header);
+        m61_release_block(header, "?", 0);
+        header = next == 0 ? nullptr : heap->top_of_heap + (next - 1);
+    }
+    return true;
+}
+#else
+static inline bool m61_remote_push(void*, size_t*) {
+    return false;
+}
+static inline bool m61_drain_remote_frees() {
+    return false;
+}
+#endif
+
+/// m61_block_in_heap(header)
+///    Determines if `header` could head a block of the current heap: it is
+///    word-aligned and the block it describes lies inside the heap buffer.
+///    Sizes read from a wild pointer, and the relative links of a copied
+///    block, which lead wherever the copy does, are checked with it before
+///    they are followed.
+static bool m61_block_in_heap(size_t* header) {
+    return header > heap->top_of_heap && header < heap->end_of_heap
+        && (uintptr_t) header % WORD_SIZE == 0
+        && GET_SIZE(header) >= MIN_BLOCK
+        && GET_SIZE(header) <= (uintptr_t) heap->end_of_heap.get() - (uintptr_t) header;
+}
+
+/// m61_validate_free(ptr, file, line)
+///    Validate a particular free request. Checks for double frees,
+///    wild frees, wild writes, and buffer overflows. Every free is valid
+///    under `m61_checks_none`.
+bool m61_validate_free(void* ptr, const char* file, int line) {
+    const char* container_file;
+    uintptr_t ptr_val = (uintptr_t) ptr;
+    size_t* header = GET_HEADER_FROM_PAYLOAD(ptr);
+    size_t* footer;
+    size_t* container;
+    size_t diff;
+    unsigned int container_line;
+    unsigned int container_size;
+
+    if constexpr (!m61_checks::validate)
+        return true;
+
+    // not in heap
+    if (ptr_val < HEAP_BOUND(heap_min) || ptr_val > HEAP_BOUND(heap_max)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
+        return false;
+    }
+
+    // we never would have allocated a misaligned block
+    if (ptr_val % alignof(std::max_align_t) != 0) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+        return false;
+    }
+
+    // if the block *looks* like a free block...
+    if (!IS_ALLOC(header)) {
+
+        if (m61_is_free_block(header)) {                // check if it's a *real* free block
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+            return false;
+        }
+        
+        footer = INCREMENT_SIZE_T_PTR(header, GET_SIZE(header)); // this is where the footer should be
+        if (!m61_block_in_heap(header)                  // check if the footer points to the header,
+            || (uintptr_t) footer - (GET_SIZE(footer) - 1) / WORD_SIZE * WORD_SIZE != (uintptr_t) header) {
+
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+            if (m61_checks::search
+                && (container = m61_contains_ptr(ptr)) != nullptr) {   // check if ptr is inside an allocated block
+
+                diff = ptr_val - (uintptr_t)GET_PAYLOAD(container);
+                container_file = *GET_FILENAME(container);
+                container_line = *GET_LINE_NUMBER(container);
+                container_size = *REQ_SIZE_FROM_HEADER(container);
+                fprintf(stderr, "\t%s:%d: %p is %zu bytes inside a %d byte region allocated here\n", container_file, container_line, ptr, diff, container_size);
+
+            }
+            return false;
+
+        }
+
+        assert(false);   // a "free" block must fall into one of the two above categories
+
+    // if the block doesn't look like a free block...
+    } else {
+
+        if (!check_footer_magic_number(header, *REQ_SIZE_FROM_HEADER(header))) { // check for buffer overrun
+            fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
+            return false;
+        }
+
+        if (header != GET_HEADER_ADDR(header, heap->top_of_heap.get())) { // check that the block is where the block thinks it is
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+            return false;
+        }
+
+        if (!IS_ALLOC(FOOTER_FROM_HEADER(header))) {    // a stale header left inside the free block it
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+            return false;                               // was coalesced into (its footer is shared)
+        }
+
+        if (*GET_FILENAME(header) == scope_marker      // scope tokens are released by the scope functions
+            || *GET_FILENAME(header) == reserved_marker) { // and reserved blocks were never handed out
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+            return false;
+        }
+
+        if (*GET_FILENAME(header) == tcache_marker     // the block was freed into a thread's cache
+            || *GET_FILENAME(header) == remote_marker     // or its arena's remote-free queue
+            || *GET_FILENAME(header) == retired_marker) { // or was retired
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+            return false;
+        }
+
+        if (!m61_validate_block_ptrs(header)) {   // check in constant time that the block is actually in the allocated list 
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+            return false;
+        }
+
+    }
+
+    return true;
+}
+
+/// m61_is_free_block(header)
+///    Determines if a header represents a valid free block by 
+///    checking that the footer matches the header, the size is not 0,
+///    the footer is also marked free, and the header & footer sizes match
+bool m61_is_free_block(size_t* header) {
+    size_t* footer;
+    if (!m61_block_in_heap(header))                                        // a size running off the heap is garbage
+        return false;
+    footer = header + (GET_SIZE(header) / WORD_SIZE) - 1;                  // get the footer manually to avoid scary dereferences
+    if (GET_SIZE(footer) == GET_SIZE(header) && HEADER_FROM_FOOTER(footer) == header) { // if the footer points to the header...
+        if (!IS_ALLOC(footer))                                             // and both are free & match, it's a free block
+            return true;
+    }
+    return false;
+}
+
+/// m61_validate_block_ptrs(header)
+///    Validates that a block is a member of the list it thinks it's in
+///    by checking that the previous and next blocks point back to `header`
+bool m61_validate_block_ptrs(size_t* header) {
+    m61_link* next = LIST_NEXT(header);
+    m61_link* prev = LIST_PREV(header);
+    if (*next != nullptr && (!m61_block_in_heap(*next) || *LIST_PREV(*next) != header))
+        return false;
+    if (*prev != nullptr && (!m61_block_in_heap(*prev) || *LIST_NEXT(*prev) != header))
+        return false;
+    return true;
+}
+
+/// m61_contains_ptr(ptr)
+///    Determines if any allocated block contains `ptr`, by traversing the
+///    allocated list, returning the block if so, otherwise nullptr
+size_t* m61_contains_ptr(void* ptr) {
+    uintptr_t ptr_int = (uintptr_t) ptr;
+    size_t* block = heap->alloc_list_start;
+    size_t req_size;
+    void* payload;
+    while (block != nullptr) {
+        req_size = *REQ_SIZE_FROM_HEADER(block);
+        payload = GET_PAYLOAD(block);
+        if (ptr_int > (uintptr_t)payload && ptr_int < (uintptr_t)((char*)payload + req_size)
+            && *GET_FILENAME(block) != scope_marker && *GET_FILENAME(block) != tcache_marker) {
+            return block;
+        }
+        block = *LIST_NEXT(block);
+    }
+    return nullptr;
+}
+
+/// m61_coalesce(header)
+///    Determines whether the block indicated by `header` can be coalesced
+///    up, down, or both, and calls appropriate coalescing functions as necessary.
+size_t* m61_coalesce(size_t* header) {
+    bool prev_alloc = IS_PREV_ALLOC(header);
+    bool next_alloc = IS_NEXT_ALLOC(header);
+    size_t size = GET_SIZE(header);
+    size_t* prev = PREV_FROM_HEADER(header);
+    size_t* next = NEXT_FROM_HEADER(header);
+
+    if (prev_alloc && next_alloc) {             // can't coalesce
+        m61_set_header_and_footer(header, size, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
+        TOGGLE_NEXT_BITS(header, PREV_ALLOC_BIT);
+        TOGGLE_PREV_BITS(header, NEXT_ALLOC_BIT);
+    }
+
+    else if (prev_alloc && !next_alloc) {       // coalesce with next block
+        header = m61_coalesce_next(header, next);
+        TOGGLE_PREV_BITS(header, NEXT_ALLOC_BIT);
+    }
+
+    else if (!prev_alloc && next_alloc) {       // coalesce with prev block
+        header = m61_coalesce_prev(header, prev);
+        TOGGLE_NEXT_BITS(header, PREV_ALLOC_BIT);
+    }
+    
+    else {                                      // coalesce in both directions
+        header = m61_coalesce_prev(header, prev);
+        header = m61_coalesce_next(header, next);
+    }
+
+    m61_push_to_front(header, heap->free_list_start);
+
+    return header;
+}
+
+/// m61_coalesce_next(header, next)
 ///    Coalesce the given block `header` with the next free block `next`
 ///    and remove `next` from the free list
 size_t* m61_coalesce_next(size_t* header, size_t* next) {
     size_t size = GET_SIZE(header) + GET_SIZE(next);
-    size_t** prev_free = LIST_PREV(next);
-    size_t** next_free = LIST_NEXT(next);
+    m61_link* prev_free = LIST_PREV(next);
+    m61_link* next_free = LIST_NEXT(next);
 
     m61_set_header_and_footer(header, size, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
-    m61_unstitch_list(prev_free, next_free, &free_list_start);
+    m61_unstitch_list(prev_free, next_free, &heap->free_list_start);
     return header;
 }
 
@@ -391,22 +1595,33 @@ size_t* m61_coalesce_next(size_t* header, size_t* next) {
 ///    and remove `prev` from the free list
 size_t* m61_coalesce_prev(size_t* header, size_t* prev) {
     size_t size = GET_SIZE(header) + GET_SIZE(prev);
-    size_t** prev_free = LIST_PREV(prev);
-    size_t** next_free = LIST_NEXT(prev);
+    m61_link* prev_free = LIST_PREV(prev);
+    m61_link* next_free = LIST_NEXT(prev);
 
     m61_set_header_and_footer(prev, size, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
-    m61_unstitch_list(prev_free, next_free, &free_list_start);
+    m61_unstitch_list(prev_free, next_free, &heap->free_list_start);
     return prev;
 }
 
-/// m61_record_free(sz)
+/// m61_record_tag_free(tag, sz)
+///    Records a free of `sz` bytes in the statistics of `tag`
+static void m61_record_tag_free(unsigned tag, size_t sz) {
+    TAG_STAT_ADD(tag, nfree, 1);
+    TAG_STAT_SUB(tag, nactive, 1);
+    TAG_STAT_SUB(tag, active_size, sz);
+    TAG_STAT_ADD(tag, freed_size, sz);
+}
+
+/// m61_record_free(sz, tag)
 ///    Records a successful free of `sz` bytes in the
-///    statistics object
-void m61_record_free(size_t sz) {
-    statistics.nfree += 1;
-    statistics.nactive -= 1;
-    statistics.active_size -= sz;
-    statistics.freed_size += sz;
+///    statistics object, and in those of `tag` if it is nonzero
+void m61_record_free(size_t sz, unsigned tag) {
+    STAT_ADD(nfree, 1);
+    STAT_SUB(nactive, 1);
+    STAT_SUB(active_size, sz);
+    STAT_ADD(freed_size, sz);
+    if (tag != 0)
+        m61_record_tag_free(tag, sz);
 }
 
 /// m61_set_header_and_footer(old_header, size, bites)
@@ -424,13 +1639,15 @@ void m61_set_header_and_footer(size_t* header, size_t size, char bits) {
 /// m61_unstitch_list
 ///    Helper function to remove a block from the given list by connecting
 ///    its next and previous blocks to each other. 
-void m61_unstitch_list(size_t** prev, size_t** next, size_t** list) {
+void m61_unstitch_list(m61_link* prev, m61_link* next, m61_link* list) {
 
     // assert that we are removing the type of block that we think we are
-    if (*list == alloc_list_start)
-        assert((*prev == nullptr || IS_ALLOC(*prev)) && (*next == nullptr || IS_ALLOC(*next)));
-    else
-        assert((*prev == nullptr || !IS_ALLOC(*prev)) && (*next == nullptr || !IS_ALLOC(*next)));
+    if constexpr (m61_checks::assert_lists) {
+        if (*list == heap->alloc_list_start)
+            assert((*prev == nullptr || IS_ALLOC(*prev)) && (*next == nullptr || IS_ALLOC(*next)));
+        else
+            assert((*prev == nullptr || !IS_ALLOC(*prev)) && (*next == nullptr || !IS_ALLOC(*next)));
+    }
 
     if (*prev == nullptr && *next != nullptr) {      // block was start of list
         SET_LIST_PREV(*next, nullptr);
@@ -451,418 +1668,3020 @@ void m61_unstitch_list(size_t** prev, size_t** next, size_t** list) {
     }
 }
 
-/// m61_push_to_front
-///    Push block `header` to the front of list `list`
-void m61_push_to_front(size_t* header, size_t* list) {
-    size_t* prev_front = list;
+/// m61_push_to_front
+///    Push block `header` to the front of list `list`
+void m61_push_to_front(size_t* header, size_t* list) {
+    size_t* prev_front = list;
+
+    if constexpr (m61_checks::assert_lists) {
+        assert(header != list);            // we are not double-pushing a block
+
+        if (list == heap->free_list_start)
+            assert(!IS_ALLOC(header));     // only push free blocks to free list
+        else
+            assert(IS_ALLOC(header));      // only push alloc blocks to alloc list
+    }
+
+    if (prev_front == nullptr) {
+        SET_LIST_NEXT(header, nullptr);     // because list pointers are stored at the same offset
+    } else {                                // from the footer, we can manipulate list pointers of
+        SET_LIST_NEXT(header, prev_front);  // allocated & free blocks interchangeably
+        SET_LIST_PREV(prev_front, header);
+    }
+
+    SET_LIST_PREV(header, nullptr);
+    
+    if (list == heap->free_list_start) {
+        heap->free_list_start = header;
+    } else {
+        heap->alloc_list_start = header;
+    }
+}
+
+/// m61_link_between(prev, next, header)
+///    Link allocated block `header` into the allocated list between
+///    `prev` and `next`, either of which may be nullptr
+void m61_link_between(size_t* prev, size_t* next, size_t* header) {
+    if constexpr (m61_checks::assert_lists)
+        assert(IS_ALLOC(header));          // only link alloc blocks into alloc list
+
+    SET_LIST_PREV(header, prev);
+    SET_LIST_NEXT(header, next);
+    if (prev == nullptr)
+        heap->alloc_list_start = header;
+    else
+        SET_LIST_NEXT(prev, header);
+    if (next != nullptr)
+        SET_LIST_PREV(next, header);
+}
+
+/// m61_thread_scope_in(h)
+///    Return the marker of this thread's innermost open scope in heap `h`,
+///    or nullptr if it has none open there.
+static size_t* m61_thread_scope_in(m61_heap* h) {
+    size_t* marker = thread_scope;
+
+    while (marker != nullptr && (marker <= h->top_of_heap || marker >= h->end_of_heap))
+        marker = SCOPE_INFO(marker)->enclosing;
+    return marker;
+}
+
+/// m61_link_allocated(first, last)
+///    Link the newly allocated blocks `first` through `last`, already
+///    linked to each other, into the allocated list where this thread's
+///    blocks belong: in front of its innermost scope's marker, behind
+///    `heap->scope_tail` if only other threads have scopes open, and at
+///    the front otherwise.
+static void m61_link_allocated(size_t* first, size_t* last) {
+    size_t* prev = nullptr;
+    size_t* next = heap->alloc_list_start;
+    size_t* marker;
+
+    if constexpr (m61_checks::assert_lists)
+        assert(IS_ALLOC(first) && IS_ALLOC(last));      // only link alloc blocks into alloc list
+
+    if (thread_scope != nullptr && (marker = m61_thread_scope_in(heap)) != nullptr) {
+        prev = *LIST_PREV(marker);
+        next = marker;
+    } else if (heap->scope_tail != nullptr) {
+        prev = heap->scope_tail;
+        next = *LIST_NEXT(prev);
+    }
+    SET_LIST_PREV(first, prev);
+    SET_LIST_NEXT(last, next);
+    if (prev == nullptr)
+        heap->alloc_list_start = first;
+    else
+        SET_LIST_NEXT(prev, first);
+    if (next != nullptr)
+        SET_LIST_PREV(next, last);
+}
+
+/// set_footer_magic_number(header, sz)
+///    Places the magic number immediately following the region
+///    allocated to the user for a given block (header + 2 words + payload size).
+///    Policies without `magic` write nothing.
+///
+///    Footer magic number must be set byte-by-byte so the sanitizer
+///    is not triggered by setting a size_t from at an invalidly-aligned address.
+inline void set_footer_magic_number(size_t* header, size_t sz) {
+    char* footer_magic_number = (char*)(header + 1) + sz;
+    if constexpr (!m61_checks::magic)
+        return;
+    for (size_t i = 0; i < 8; i++) {
+        footer_magic_number[i] = magic_number[i];
+    }
+}
+
+/// check_footer_magic_number(header, sz)
+///    Checks the magic number immediately following the region
+///    allocated to the user for a given block (header + 2 words + payload size).
+///    Always passes under policies without `magic`.
+///
+///    Footer magic number must be read byte-by-byte so the sanitizer
+///    is not triggered by reading a size_t from an invalidly-aligned address.
+inline bool check_footer_magic_number(size_t* header, size_t sz) {
+    char* footer_magic_number = (char*)(header + 1) + sz;
+    if constexpr (!m61_checks::magic)
+        return true;
+    for (size_t i = 0; i < 8; i++) {
+        if (footer_magic_number[i] != magic_number[i])
+            return false;
+    }
+    return true;
+}
+
+
+/// m61_calloc(count, sz, file, line)
+///    Returns a pointer a fresh dynamic memory allocation big enough to
+///    hold an array of `count` elements of `sz` bytes each. Returned
+///    memory is initialized to zero. The allocation request was at
+///    location `file`:`line`. Returns `nullptr` if out of memory; may
+///    also return `nullptr` if `count == 0` or `size == 0`.
+void* m61_calloc(size_t count, size_t sz, const char* file, int line) {
+    void* ptr;
+
+    if (count == 0)
+        return nullptr;
+
+    // detect unsigned overflow
+    if (sz > SIZE_MAX / count) {
+        STAT_ADD(nfail, 1);
+        STAT_ADD(fail_size, sz);
+        return nullptr;
+    }
+
+    ptr = m61_malloc(count * sz, file, line);
+    if (ptr) {
+        memset(ptr, 0, count * sz);
+    }
+    return ptr;
+}
+
+/// m61_fit_block(header, size, asize, prev_alloc)
+///    Make the `size` bytes at `header`, which are on no list, an allocated
+///    block of `asize` bytes whose previous block is allocated if
+///    `prev_alloc`. A tail of at least MIN_BLOCK bytes is freed, merging
+///    with a free block after it; a smaller one stays in the block.
+static void m61_fit_block(size_t* header, size_t size, size_t asize, bool prev_alloc) {
+    size_t* next = INCREMENT_SIZE_T_PTR(header, size);
+    char prev_bit = prev_alloc ? PREV_ALLOC_BIT : 0;
+    char next_bit = IS_ALLOC(next) ? NEXT_ALLOC_BIT : 0;
+    size_t* tail;
+
+    if (!IS_PREV_ALLOC(next))
+        XOR_TAG(next, PREV_ALLOC_BIT);
+    if (size - asize < MIN_BLOCK) {
+        m61_set_header_and_footer(header, size, ALLOC_BIT | prev_bit | next_bit);
+        return;
+    }
+
+    // the tail is laid out as an allocated block and freed, so that
+    // m61_coalesce updates its neighbors' bits
+    m61_set_header_and_footer(header, asize, ALLOC_BIT | prev_bit | NEXT_ALLOC_BIT);
+    tail = INCREMENT_SIZE_T_PTR(header, asize);
+    m61_set_header_and_footer(tail, size - asize, ALLOC_BIT | PREV_ALLOC_BIT | next_bit);
+    m61_coalesce(tail);
+}
+
+/// m61_resize_block(header, asize, move)
+///    Resize allocated block `header` to `asize` bytes without leaving its
+///    place, absorbing the whole free block after it, and if `move` the
+///    whole free block before it, as needed. When the block grows into
+///    its predecessor its payload is moved down with `memmove`. The block
+///    keeps its place in the allocated list. Returns the block's header,
+///    or nullptr (changing nothing) if its neighbors are too small.
+static size_t* m61_resize_block(size_t* header, size_t asize, bool move) {
+    size_t size = GET_SIZE(header);
+    size_t* prev = PREV_FROM_HEADER(header);
+    size_t* next = NEXT_FROM_HEADER(header);
+    size_t prev_avail = IS_PREV_ALLOC(header) ? 0 : GET_SIZE(prev);
+    size_t next_avail = IS_NEXT_ALLOC(header) ? 0 : GET_SIZE(next);
+    size_t* list_prev = *LIST_PREV(header);
+    size_t* list_next = *LIST_NEXT(header);
+    bool prev_alloc = IS_PREV_ALLOC(header);
+    size_t* start = header;
+
+    if (asize > size + next_avail + (move ? prev_avail : 0))
+        return nullptr;
+
+    m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->alloc_list_start);
+    if (asize > size && next_avail != 0) {      // growing: the next block comes first, as it needs no copy
+        m61_unstitch_list(LIST_PREV(next), LIST_NEXT(next), &heap->free_list_start);
+        size += next_avail;
+    }
+    if (asize > size) {
+        m61_unstitch_list(LIST_PREV(prev), LIST_NEXT(prev), &heap->free_list_start);
+        memmove(GET_PAYLOAD(prev), GET_PAYLOAD(header), *REQ_SIZE_FROM_HEADER(header));
+        start = prev;
+        size += prev_avail;
+        prev_alloc = true;                      // free blocks follow allocated ones
+        if (!IS_NEXT_ALLOC(PREV_FROM_HEADER(start)))
+            XOR_TAG(PREV_FROM_HEADER(start), NEXT_ALLOC_BIT);
+    }
+    m61_fit_block(start, size, asize, prev_alloc);
+    m61_link_between(list_prev, list_next, start);
+    return start;
+}
+
+/// m61_realloc(ptr, sz, file, line)
+///    Changes the size of the dynamic allocation pointed to by `ptr`
+///    to hold at least `sz` bytes. The block is resized in place when it
+///    and its free neighbors are big enough. Otherwise this function
+///    makes a new allocation, copies as much data as possible from the old
+///    allocation to the new, and returns a pointer to the new allocation.
+///    If `ptr` is `nullptr`, behaves like `m61_malloc(sz, file, line)`.
+///    `sz` must not be 0. If a required allocation fails, returns
+///    `nullptr` without freeing the original block.
+///
+///    A block grown again from the call site that last resized it is
+///    given a reserve of half its new size, so a block that keeps growing
+///    moves or rewrites its tags O(log n) times rather than O(n). Growth
+///    within the reserve only updates the block's metadata. The reserve
+///    is not counted in the statistics, and is returned to the heap when
+///    the block shrinks or the heap runs out of memory.
+void* m61_realloc(void* ptr, size_t new_size, const char* file, int line) {
+    size_t* old_header;
+    size_t* new_header = nullptr;
+    size_t old_req_size;
+    size_t asize;
+    size_t reserve_asize;
+    unsigned tag;
+    void* new_ptr;
+
+    if (ptr == nullptr)
+        return m61_malloc(new_size, file, line);
+
+    if (new_size == 0)
+        return nullptr;
+
+    // detect unsigned integer overflow
+    if (new_size > SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE)) {
+        STAT_ADD(nfail, 1);
+        STAT_ADD(fail_size, new_size);
+        return nullptr;
+    }
+
+    if (m61_is_guarded(ptr)) {
+        // sampled objects move on every reallocation, to a new sample or not
+        if ((old_req_size = m61_guarded_size(ptr)) == 0) {
+            m61_guarded_free(ptr, 0, file, line);   // reports the invalid pointer
+            return nullptr;
+        }
+        if ((new_ptr = m61_malloc(new_size, file, line)) != nullptr) {
+            memcpy(new_ptr, ptr, std::min(old_req_size, new_size));
+            m61_guarded_free(ptr, 0, file, line);
+        }
+        return new_ptr;
+    }
+
+    asize = m61_get_adjusted_size(new_size);
+
+    M61_ROUTE_HEAP(ptr);
+    M61_LOCK_HEAP();
+    if (!m61_validate_free(ptr, file, line))
+        return nullptr;     // on failure, returns nullptr; original ptr should remain valid
+
+    old_header = GET_HEADER_FROM_PAYLOAD(ptr);
+    old_req_size = *REQ_SIZE_FROM_HEADER(old_header);
+    tag = GET_TAG(old_header);
+    reserve_asize = asize;
+    if (new_size > old_req_size && *GET_FILENAME(old_header) == file
+        && *GET_LINE_NUMBER(old_header) == (unsigned) line
+        && new_size / 2 <= SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE) - new_size)
+        reserve_asize = m61_get_adjusted_size(new_size + new_size / 2);
+
+    if (new_size >= old_req_size && asize <= GET_SIZE(old_header)) {
+        new_header = old_header;                // fits in the block's reserve or slack
+        m61_record_free(old_req_size, tag);
+    } else if ((reserve_asize != asize && (new_header = m61_resize_block(old_header, reserve_asize, false)) != nullptr)
+               || (new_header = m61_resize_block(old_header, asize, true)) != nullptr) {
+        m61_record_free(old_req_size, tag);
+    } else {
+        // move to a new block of the same heap, which takes the old
+        // block's place in the allocated list (scopes rely on it)
+        if ((reserve_asize != asize && (new_header = m61_find_fit(reserve_asize)) != nullptr)
+            || (new_header = m61_find_fit(asize)) != nullptr) {
+            m61_place(new_header, GET_SIZE(new_header) >= reserve_asize ? reserve_asize : asize);
+        } else if (m61_reclaim_memory() && (new_header = m61_find_fit(asize)) != nullptr) {
+            m61_place(new_header, asize);
+        } else {
+            STAT_ADD(nfail, 1);
+            STAT_ADD(fail_size, new_size);
+            return nullptr;
+        }
+        memcpy(GET_PAYLOAD(new_header), ptr, std::min(old_req_size, new_size));
+        m61_unstitch_list(LIST_PREV(new_header), LIST_NEXT(new_header), &heap->alloc_list_start);
+        m61_link_between(old_header, *LIST_NEXT(old_header), new_header);
+        m61_release_block(old_header, file, line);   // validated above; never cached
+    }
+
+    m61_set_alloc_metadata(new_header, new_size, file, line, tag);
+    m61_record_malloc(new_header, new_size);
+    return GET_PAYLOAD(new_header);
+}
+
+/// m61_trim_reserves()
+///    Return the reserve of every growing block of `heap` to the free
+///    list. The caller holds the heap lock. Returns true if any block had
+///    one.
+static bool m61_trim_reserves() {
+    bool trimmed = false;
+    size_t* next;
+    const char* file;
+    unsigned int line;
+    unsigned int sz;
+    unsigned tag;
+
+    for (size_t* block = heap->alloc_list_start; block != nullptr; block = next) {
+        next = *LIST_NEXT(block);   // resizing keeps the block's place in the list
+        file = *GET_FILENAME(block);
+        if (file == scope_marker || file == tcache_marker || file == remote_marker
+            || !HAS_RESERVE(block))
+            continue;
+        sz = *REQ_SIZE_FROM_HEADER(block);      // the metadata moves with the footer
+        line = *GET_LINE_NUMBER(block);
+        tag = GET_TAG(block);
+        m61_resize_block(block, m61_get_adjusted_size(sz), false);
+        m61_set_alloc_metadata(block, sz, file, line, tag);
+        trimmed = true;
+    }
+    return trimmed;
+}
+
+/// m61_reclaim_memory()
+///    Return memory held back from `heap`'s free list, by thread caches,
+///    remote-free queues and the reserves of growing blocks, then compact
+///    the heap, once an allocation found no fit. The caller holds the heap
+///    lock. Returns true if any memory was returned or moved.
+static bool m61_reclaim_memory() {
+    bool flushed = m61_tcache_flush_all() | m61_drain_remote_frees();
+    bool trimmed = m61_trim_reserves();
+    return m61_compact_heap(SIZE_MAX) != 0 || trimmed || flushed;
+}
+
+/// m61_try_expand(ptr, sz, file, line)
+///    Resize the allocation at `ptr` to `sz` bytes without moving it,
+///    absorbing the free block after it if needed. Returns true if the
+///    allocation now holds `sz` bytes; otherwise leaves it unchanged.
+bool m61_try_expand(void* ptr, size_t sz, const char* file, int line) {
+    size_t* header;
+    size_t old_req_size;
+    unsigned tag;
+
+    if (ptr == nullptr || sz == 0 || sz > SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE)
+        || m61_is_guarded(ptr))      // sampled objects stay at the end of their page
+        return false;
+
+    M61_ROUTE_HEAP(ptr);
+    M61_LOCK_HEAP();
+    if (!m61_validate_free(ptr, file, line))
+        return false;
+    header = GET_HEADER_FROM_PAYLOAD(ptr);
+    old_req_size = *REQ_SIZE_FROM_HEADER(header);
+    tag = GET_TAG(header);
+    if (m61_resize_block(header, m61_get_adjusted_size(sz), false) == nullptr)
+        return false;
+    m61_record_free(old_req_size, tag);
+    m61_set_alloc_metadata(header, sz, file, line, tag);
+    m61_record_malloc(header, sz);
+    return true;
+}
+
+/// m61_claim_slack(header)
+///    Extend allocated block `header`'s requested size to its whole
+///    payload, moving the magic number to the new end, and return the
+///    payload's size. The extra bytes are counted as allocated. A block
+///    whose magic number was already overwritten is left alone, so the
+///    wild write is still reported when it is freed.
+static size_t m61_claim_slack(size_t* header) {
+    size_t capacity = GET_SIZE(header) - ALLOC_META_SIZE;
+    size_t requested = *REQ_SIZE_FROM_HEADER(header);
+
+    if (requested == capacity || !check_footer_magic_number(header, requested))
+        return requested;
+    SET_REQ_SIZE(header, capacity);
+    set_footer_magic_number(header, capacity);
+    STAT_ADD(active_size, capacity - requested);
+    STAT_ADD(total_size, capacity - requested);
+    return capacity;
+}
+
+/// m61_active_header(ptr)
+///    Return the header of the active allocation at `ptr` in the current
+///    heap, or nullptr. Makes the checks of `m61_validate_free` without
+///    reporting anything, for lookups that are not frees.
+static size_t* m61_active_header(void* ptr) {
+    uintptr_t ptr_val = (uintptr_t) ptr;
+    size_t* header = GET_HEADER_FROM_PAYLOAD(ptr);
+    const char* file;
+
+    if (ptr_val < HEAP_BOUND(heap_min) || ptr_val > HEAP_BOUND(heap_max)
+        || ptr_val % alignof(std::max_align_t) != 0
+        || !m61_block_in_heap(header)
+        || !IS_ALLOC(header)
+        || header != GET_HEADER_ADDR(header, heap->top_of_heap.get())
+        || !IS_ALLOC(FOOTER_FROM_HEADER(header))
+        || !m61_validate_block_ptrs(header))
+        return nullptr;
+    file = *GET_FILENAME(header);
+    if (file == scope_marker || file == reserved_marker || file == tcache_marker
+        || file == remote_marker || file == retired_marker)
+        return nullptr;
+    return header;
+}
+
+/// m61_usable_size(ptr)
+///    Return the number of bytes the caller may use at `ptr`, an active
+///    allocation: its requested size, which covers the slack claimed by
+///    `m61_malloc_at_least`. Returns 0, without a report, if `ptr` is not
+///    an active allocation. The block is not changed.
+size_t m61_usable_size(void* ptr) {
+    size_t* header;
+
+    if (ptr == nullptr)
+        return 0;
+    if (m61_is_guarded(ptr))
+        return m61_guarded_size(ptr);
+    M61_ROUTE_HEAP(ptr);
+    M61_LOCK_HEAP();
+    if ((header = m61_active_header(ptr)) == nullptr)
+        return 0;
+    return *REQ_SIZE_FROM_HEADER(header);
+}
+
+/// m61_malloc_at_least(sz, actual, file, line)
+///    Like `m61_malloc`, but the whole block is handed to the caller and
+///    its size stored in `*actual`. The slack is claimed under the lock of
+///    the heap holding the block.
+void* m61_malloc_at_least(size_t sz, size_t* actual, const char* file, int line) {
+    void* ptr = m61_malloc(sz, file, line);
+
+    *actual = 0;
+    if (ptr == nullptr)
+        return nullptr;
+    if (m61_is_guarded(ptr)) {
+        *actual = m61_guarded_size(ptr);
+        return ptr;
+    }
+    M61_ROUTE_HEAP(ptr);
+    M61_LOCK_HEAP();
+    *actual = m61_claim_slack(GET_HEADER_FROM_PAYLOAD(ptr));
+    return ptr;
+}
+
+/// m61_find_aligned_fit(asize, align)
+///    Like `m61_find_fit`, but the block's payload is aligned to `align`.
+///    Leading slack large enough to form a block is split back into a free
+///    block; the returned block takes the rest. Returns nullptr if no free
+///    block has room for `asize` bytes at an aligned address.
+static size_t* m61_find_aligned_fit(size_t asize, size_t align) {
+    uintptr_t payload;
+    uintptr_t aligned;
+    size_t lead;
+    size_t size;
+    size_t* block;
+
+    for (size_t* header = heap->free_list_start; header != nullptr; header = *LIST_NEXT(header)) {
+        payload = (uintptr_t) GET_PAYLOAD(header);
+        aligned = (payload + align - 1) & ~(align - 1);
+        if (aligned != payload)                 // slack must fit a free block
+            aligned = (payload + MIN_BLOCK + align - 1) & ~(align - 1);
+        lead = aligned - payload;
+        size = GET_SIZE(header);
+        if (aligned < payload || lead > size || size - lead < asize)
+            continue;
+        if (lead == 0)
+            return header;
+
+        // both neighbors of a free block are allocated
+        m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->free_list_start);
+        block = INCREMENT_SIZE_T_PTR(header, lead);
+        m61_set_header_and_footer(header, lead, PREV_ALLOC_BIT);
+        m61_set_header_and_footer(block, size - lead, NEXT_ALLOC_BIT);
+        m61_push_to_front(header, heap->free_list_start);
+        m61_push_to_front(block, heap->free_list_start);
+        return block;
+    }
+    return nullptr;
+}
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Returns a pointer to `sz` bytes of freshly-allocated dynamic memory
+///    aligned to `align`, which must be a power of two. Alignments up to
+///    `ALIGNMENT` are served by `m61_malloc`; larger ones bypass the
+///    thread caches.
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file, int line) {
+    size_t asize;
+    size_t* header;
+
+    if (align == 0 || (align & (align - 1)) != 0)
+        return nullptr;
+    if (align <= ALIGNMENT)
+        return m61_malloc(sz, file, line);
+    if (sz == 0)
+        return nullptr;
+
+    if (sz <= SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE)) {
+        asize = m61_get_adjusted_size(sz);
+        m61_use_heap_arena();
+        M61_LOCK_THREAD_HEAP();
+        if ((header = m61_find_aligned_fit(asize, align)) != nullptr
+            || (m61_reclaim_memory() && (header = m61_find_aligned_fit(asize, align)) != nullptr)) {
+            m61_place(header, asize);
+            assert(IS_ALLOC(header) && (uintptr_t) GET_PAYLOAD(header) % align == 0);
+            m61_set_alloc_metadata(header, sz, file, line);
+            m61_record_malloc(header, sz);
+            return GET_PAYLOAD(header);
+        }
+    }
+
+    STAT_ADD(nfail, 1);
+    STAT_ADD(fail_size, sz);
+    return nullptr;
+}
+
+/// m61_posix_memalign(ptr, align, sz, file, line)
+///    Store in `*ptr` a pointer to `sz` bytes aligned to `align`. Returns
+///    0 on success, EINVAL if `align` is not a power of two multiple of
+///    `sizeof(void*)`, or ENOMEM if out of memory.
+int m61_posix_memalign(void** ptr, size_t align, size_t sz, const char* file, int line) {
+    void* payload;
+
+    if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0 || align == 0)
+        return EINVAL;
+    payload = m61_aligned_alloc(align, sz, file, line);
+    if (payload == nullptr && sz != 0)
+        return ENOMEM;
+    *ptr = payload;
+    return 0;
+}
+
+/// m61_memalign(align, sz, file, line)
+///    Like `m61_aligned_alloc`, but rounds `align` up to a power of two.
+void* m61_memalign(size_t align, size_t sz, const char* file, int line) {
+    size_t pow2 = 1;
+
+    while (pow2 < align && pow2 != 0)
+        pow2 <<= 1;
+    return m61_aligned_alloc(pow2, sz, file, line);
+}
+
+/// m61_carve_batch(header, asize, n, sz, file, line, out)
+///    Allocate up to `n` consecutive blocks of `asize` bytes from the
+///    front of free block `header`, storing their payloads in `out`, and
+///    return how many. The blocks are linked to each other first and
+///    then spliced onto the allocated list at once; the rest of the free
+///    block, if big enough, stays free, otherwise the last block takes it.
+static size_t m61_carve_batch(size_t* header, size_t asize, size_t n, unsigned sz,
+                              const char* file, int line, void** out) {
+    size_t size = GET_SIZE(header);
+    size_t count = std::min(n, size / asize);
+    size_t rest = size - count * asize;
+    char prev_bit = GET_BITS(header) & PREV_ALLOC_BIT;
+    size_t* block = header;
+    size_t* last = nullptr;
+    size_t* free_block;
+
+    m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->free_list_start);
+    for (size_t i = 0; i != count; ++i) {
+        size_t bsize = i + 1 == count && rest < MIN_BLOCK ? asize + rest : asize;
+        bool last_block = i + 1 == count;
+        m61_set_header_and_footer(block, bsize,
+                                  ALLOC_BIT | (i == 0 ? prev_bit : PREV_ALLOC_BIT)
+                                  | (last_block && rest >= MIN_BLOCK ? 0 : NEXT_ALLOC_BIT));
+        m61_set_alloc_metadata(block, sz, file, line);
+        SET_LIST_PREV(block, last);
+        if (last != nullptr)
+            SET_LIST_NEXT(last, block);
+        out[i] = GET_PAYLOAD(block);
+        last = block;
+        block = INCREMENT_SIZE_T_PTR(block, bsize);
+    }
+    TOGGLE_PREV_BITS(header, NEXT_ALLOC_BIT);   // let the prev block know
+    if (rest >= MIN_BLOCK) {
+        free_block = block;
+        m61_set_header_and_footer(free_block, rest, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
+        m61_push_to_front(free_block, heap->free_list_start);
+    } else {
+        TOGGLE_NEXT_BITS(last, PREV_ALLOC_BIT);  // let the next block know
+    }
+
+    m61_link_allocated(header, last);
+    return count;
+}
+
+/// m61_malloc_batch(sz, n, out, file, line)
+///    Allocate `n` blocks of `sz` bytes each, storing pointers to them in
+///    `out`, under one lock. Blocks are carved side by side from as few
+///    free blocks as possible, and the statistics are updated once.
+///    Returns the number of blocks allocated; on failure the rest of
+///    `out` is set to nullptr.
+size_t m61_malloc_batch(size_t sz, size_t n, void** out, const char* file, int line) {
+    size_t asize;
+    size_t* header;
+    size_t count = 0;
+    uintptr_t min = UINTPTR_MAX;
+    uintptr_t max = 0;
+
+    if (sz == 0 || n == 0)
+        return 0;
+
+    if (sz <= SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE)) {
+        asize = m61_get_adjusted_size(sz);
+        m61_use_heap_arena();
+        M61_LOCK_THREAD_HEAP();
+
+        // prefer one free block that holds the whole batch
+        header = m61_find_fit(n <= SIZE_MAX / asize ? asize * n : SIZE_MAX);
+        while (count != n
+               && (header != nullptr
+                   || (header = m61_find_fit(asize)) != nullptr
+                   || (m61_reclaim_memory() && (header = m61_find_fit(asize)) != nullptr))) {
+            size_t carved = m61_carve_batch(header, asize, n - count, sz, file, line, out + count);
+            min = std::min(min, (uintptr_t) out[count]);
+            max = std::max(max, (uintptr_t) out[count + carved - 1] + sz);
+            count += carved;
+            header = nullptr;
+        }
+        if (count != 0) {
+            STAT_ADD(ntotal, count);
+            STAT_ADD(nactive, count);
+            STAT_ADD(active_size, count * sz);
+            STAT_ADD(total_size, count * sz);
+            m61_record_heap_bounds(min, max);
+        }
+    }
+
+    if (count != n) {
+        STAT_ADD(nfail, n - count);
+        STAT_ADD(fail_size, (n - count) * sz);
+        for (size_t i = count; i != n; ++i)
+            out[i] = nullptr;
+    }
+    return count;
+}
+
+/// m61_free_batch(ptrs, n, file, line)
+///    Free the `n` pointers in `ptrs`, sorting them by address first. Each
+///    heap's blocks are validated and freed under one lock acquisition,
+///    runs of adjacent blocks are coalesced as one, and the statistics are
+///    updated once per heap.
+void m61_free_batch(void** ptrs, size_t n, const char* file, int line) {
+    size_t start = 0;
+    size_t end;
+    size_t nvalid;
+    size_t nfreed;
+    size_t nbytes;
+    size_t* run;
+    size_t* header;
+    size_t* inner;
+    size_t* next;
+    size_t run_size;
+
+    std::sort(ptrs, ptrs + n, std::less<void*>());
+    while (start != n && ptrs[start] == nullptr)
+        ++start;
+
+    while (start != n) {
+        if (m61_is_guarded(ptrs[start])) {
+            m61_guarded_free(ptrs[start], 0, file, line);
+            ++start;
+            continue;
+        }
+        M61_ROUTE_HEAP(ptrs[start]);
+        M61_LOCK_HEAP();
+        end = start + 1;
+        while (end != n && (size_t*) ptrs[end] > heap->top_of_heap && (size_t*) ptrs[end] < heap->end_of_heap)
+            ++end;
+
+        // validate the whole group first; survivors are compacted to its front
+        nvalid = 0;
+        for (size_t i = start; i != end; ++i) {
+            if (i != start && ptrs[i] == ptrs[i - 1])
+                fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptrs[i]);
+            else if (m61_validate_free(ptrs[i], file, line))
+                ptrs[start + nvalid++] = ptrs[i];
+        }
+
+        nfreed = 0;
+        nbytes = 0;
+        for (size_t i = start; i != start + nvalid; ) {
+            run = GET_HEADER_FROM_PAYLOAD(ptrs[i]);
+            run_size = 0;
+            inner = nullptr;
+            do {
+                header = GET_HEADER_FROM_PAYLOAD(ptrs[i]);
+                next = NEXT_FROM_HEADER(header);
+                if (!check_footer_magic_number(header, *REQ_SIZE_FROM_HEADER(header)))
+                    fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptrs[i]);
+                nbytes += *REQ_SIZE_FROM_HEADER(header);
+                if (GET_TAG(header) != 0)
+                    m61_record_tag_free(GET_TAG(header), *REQ_SIZE_FROM_HEADER(header));
+                run_size += GET_SIZE(header);
+                m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->alloc_list_start);
+                // blocks inside the run look free, so freeing one again is a double free
+                if (inner != nullptr)
+                    m61_set_header_and_footer(inner, GET_SIZE(inner), 0);
+                inner = header != run ? header : nullptr;
+                ++nfreed;
+                ++i;
+            } while (i != start + nvalid && GET_HEADER_FROM_PAYLOAD(ptrs[i]) == next);
+
+            // one allocated block spanning the run, coalesced with its neighbors at once
+            m61_set_header_and_footer(run, run_size, ALLOC_BIT | (GET_BITS(run) & PREV_ALLOC_BIT)
+                                                     | (GET_BITS(header) & NEXT_ALLOC_BIT));
+            m61_coalesce(run);
+        }
+        if (nfreed != 0) {
+            STAT_ADD(nfree, nfreed);
+            STAT_SUB(nactive, nfreed);
+            STAT_SUB(active_size, nbytes);
+            STAT_ADD(freed_size, nbytes);
+        }
+        start = end;
+    }
+}
+
+// blocks set aside by `m61_reserve` are split off the heap and marked
+// allocated, so neighbors never coalesce into them, but they sit on no
+// list the heap walks: each size class of `heap->reserved` links its
+// blocks through their list pointers, in address order. Serving one links
+// it into the allocated list as if it had just been placed.
+
+/// m61_reserved_pop(asize)
+///    Take a block of `asize` bytes from `heap`'s reserve and move it to
+///    the allocated list. Returns nullptr if none is reserved. The caller
+///    holds the heap lock.
+static size_t* m61_reserved_pop(size_t asize) {
+    size_t* header;
+
+    for (m61_reserved_class& rc : heap->reserved) {
+        if (rc.asize != asize || rc.count == 0)
+            continue;
+        header = rc.blocks;
+        rc.blocks = *LIST_NEXT(header);
+        --rc.count;
+        __atomic_store_n(&heap->nreserved, heap->nreserved - 1, __ATOMIC_RELAXED);
+        m61_link_allocated(header, header);
+        STAT_ADD(nreserved_used, 1);
+        return header;
+    }
+    return nullptr;
+}
+
+/// m61_reserve(sz, count)
+///    Split `count` blocks for `sz`-byte allocations off the heap, fault
+///    their pages in, and add them to the reserve of their size class.
+size_t m61_reserve(size_t sz, size_t count) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t asize;
+    size_t* header;
+    size_t* first = nullptr;
+    size_t* last = nullptr;
+    size_t n = 0;
+    m61_reserved_class* rc = nullptr;
+
+    if (sz == 0 || count == 0 || sz > SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE))
+        return 0;
+    asize = m61_get_adjusted_size(sz);
+    m61_use_heap_arena();
+    M61_LOCK_THREAD_HEAP();
+
+    for (m61_reserved_class& c : heap->reserved) {
+        if (c.asize == asize) {
+            rc = &c;
+            break;
+        }
+        if (rc == nullptr && c.count == 0)
+            rc = &c;
+    }
+    if (rc == nullptr)              // every class is taken
+        return 0;
+
+    while (n != count
+           && ((header = m61_find_fit(asize)) != nullptr
+               || (m61_reclaim_memory() && (header = m61_find_fit(asize)) != nullptr))) {
+        m61_place(header, asize);   // the remainder goes to the front of the
+                                    // free list, so blocks come out side by side
+        m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->alloc_list_start);
+        for (char* p = (char*) GET_PAYLOAD(header); p < (char*) header + GET_SIZE(header); p += page_size)
+            *(volatile char*) p = 0;    // the header's page is already written
+        m61_set_alloc_metadata(header, 0, reserved_marker, 0);
+
+        SET_LIST_NEXT(header, nullptr);
+        SET_LIST_PREV(header, last);
+        if (last != nullptr)
+            SET_LIST_NEXT(last, header);
+        else
+            first = header;
+        last = header;
+        ++n;
+    }
+
+    if (n != 0) {
+        SET_LIST_NEXT(last, rc->blocks);
+        rc->asize = asize;
+        rc->blocks = first;
+        rc->count += n;
+        __atomic_store_n(&heap->nreserved, heap->nreserved + n, __ATOMIC_RELAXED);
+        STAT_ADD(nreserved, n);
+    }
+    return n;
+}
+
+/// m61_release_reserved(sz)
+///    Free every block still reserved for `sz`-byte allocations.
+size_t m61_release_reserved(size_t sz) {
+    size_t asize;
+    size_t* next;
+    size_t n = 0;
+
+    if (sz == 0 || sz > SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE))
+        return 0;
+    asize = m61_get_adjusted_size(sz);
+    m61_use_heap_arena();
+    M61_LOCK_THREAD_HEAP();
+
+    for (m61_reserved_class& rc : heap->reserved) {
+        if (rc.asize != asize)
+            continue;
+        for (size_t* block = rc.blocks; block != nullptr; block = next) {
+            next = *LIST_NEXT(block);
+            m61_coalesce(block);
+        }
+        n = rc.count;
+        rc = {0, 0, nullptr};
+        __atomic_store_n(&heap->nreserved, heap->nreserved - n, __ATOMIC_RELAXED);
+        STAT_SUB(nreserved, n);
+        break;
+    }
+    return n;
+}
+
+/// m61_print_heap()
+///    Print all blocks in the heap, including prologue and epilogue
+void m61_print_heap() {
+    size_t* block = heap->top_of_heap;
+    size_t* header;
+    size_t* footer;
+    size_t size;
+    bool alloc;
+    bool prev_alloc;
+    bool next_alloc;
+    int count = 0;
+
+    block = NEXT_FROM_HEADER(block); // skip the prologue
+    DEBUG_PRINT("================================================%c\n", 0);
+    while (true) {
+        header = block;
+        footer = FOOTER_FROM_HEADER(header);
+        size = GET_SIZE(header);
+        alloc = IS_ALLOC(header);
+        prev_alloc = IS_PREV_ALLOC(header);
+        next_alloc = IS_NEXT_ALLOC(header);
+        if (size == 0 && IS_ALLOC(header))
+            break;
+        DEBUG_PRINT("block %d: %s\nheader: %p footer: %p\nsize: %zu\nprev: %s\nnext: %s\n----------\n", count, (alloc ? "ALLOC" : "FREE"), header, footer, size, (prev_alloc ? "ALLOC" : "FREE"), (next_alloc ? "ALLOC" : "FREE"));
+        ++count;
+        block = NEXT_FROM_HEADER(header);
+    }
+    DEBUG_PRINT("================================================%c\n", 0);
+}
+
+/// m61_print_list()
+///    Print all blocks in the free list
+void m61_print_list(size_t* start) {
+    size_t* node = start;
+    size_t* header;
+    size_t* footer;
+    size_t* list_prev;
+    size_t* list_next;
+    size_t size;
+    bool alloc;
+    int count = 0;
+    bool is_free_list = start == heap->free_list_start;
+    const char* title = is_free_list ? "FREE" : "ALLOC";
+
+    DEBUG_PRINT("\033[0;%dm====================%s LIST=======================%c\n", is_free_list ? 32 : 31, title, 0);
+    while (node != nullptr) {
+        header = node;
+        footer = FOOTER_FROM_HEADER(header);
+        size = GET_SIZE(header);
+        alloc = IS_ALLOC(header);
+        list_prev = *LIST_PREV(header);
+        list_next = *LIST_NEXT(header);
+        DEBUG_PRINT("block %d: %s\nheader: %p footer: %p\nsize(h): %zu\nlist_prev: %p\nlist_next: %p\n", count, (alloc ? "ALLOC" : "FREE"), header, footer, size, list_prev, list_next);
+        DEBUG_HEXDUMP(FOOTER_FROM_HEADER(header) - 11, 12 * WORD_SIZE);
+        DEBUG_PRINT("----------%c\n", 0);
+        ++count;
+        node = *LIST_NEXT(node);
+        if (count > 50)
+            break;
+    }
+    DEBUG_PRINT("=======================%s LIST====================\033[0m%c\n", title, 0);
+}
+
+/// m61_print_block()
+///    Prints one block
+void m61_print_block(size_t* header, const char* message) {
+    if (header == nullptr) {
+        DEBUG_PRINT("%s: %p\n", message, header);
+        return;
+    }
+    bool alloc = IS_ALLOC(header);
+    DEBUG_PRINT("%s\n", message);
+    DEBUG_PRINT("\033[0;32m------------%c\n", 0);
+    DEBUG_PRINT("block %p: %s\nsize: %zu\nfooter: %p (%zu)\n", header, (alloc ? "ALLOC" : "FREE"), GET_SIZE(header), FOOTER_FROM_HEADER(header), GET_SIZE(FOOTER_FROM_HEADER(header)));
+    if (!alloc) {
+        DEBUG_PRINT("list_prev: %p\nlist_next: %p\n", LIST_PREV(header)->get(), LIST_NEXT(header)->get());
+    } else {
+        DEBUG_PRINT("alloc_list_prev: %p\nalloc_list_next: %p\n", LIST_PREV(header)->get(), LIST_NEXT(header)->get());
+    }
+    DEBUG_PRINT("------------\033[0m%c\n", 0);
+}
+
+/// m61_validate_list(list)
+///    Validates that all members of a list are of the right type (alloc/free)
+void m61_validate_list(size_t* list, const char* message) {
+    size_t* node = list;
+    while (node != nullptr) {
+        if (list == heap->free_list_start && IS_ALLOC(node)) {
+            DEBUG_PRINT("invalid free list: %s\n", message);
+            m61_print_block(node, "due to block:");
+            abort();
+        }
+        else if (list == heap->alloc_list_start && !IS_ALLOC(node)) {
+            DEBUG_PRINT("invalid alloc list: %s\n", message);
+            m61_print_block(node, "due to block:");
+            abort();
+        }
+        if (*LIST_NEXT(node) == node || *LIST_PREV(node) == node) {
+            DEBUG_PRINT("%s\n", message);
+            m61_print_block(node, "block points to itself");
+            abort();
+        }
+        node = *LIST_NEXT(node);
+    }
+}
+
+/// m61_get_statistics()
+///    Return the current memory statistics.
+m61_statistics m61_get_statistics() {
+    m61_heap* prev_heap = heap;
+    m61_heap* first;
+    m61_heap* last;
+    m61_statistics stats = {0, 0, 0, 0, 0, 0, 0, 0, UINTPTR_MAX, 0, 0, 0, 0};
+
+    m61_heap_range(&first, &last);
+    for (heap = first; heap != last; ++heap) {
+        stats.nactive += STAT_LOAD(nactive);
+        stats.active_size += STAT_LOAD(active_size);
+        stats.nfree += STAT_LOAD(nfree);
+        stats.freed_size += STAT_LOAD(freed_size);
+        stats.ntotal += STAT_LOAD(ntotal);
+        stats.total_size += STAT_LOAD(total_size);
+        stats.nfail += STAT_LOAD(nfail);
+        stats.fail_size += STAT_LOAD(fail_size);
+        stats.heap_min = std::min(stats.heap_min, HEAP_BOUND(heap_min));
+        stats.heap_max = std::max(stats.heap_max, HEAP_BOUND(heap_max));
+        stats.nreserved += STAT_LOAD(nreserved);
+        stats.nreserved_used += STAT_LOAD(nreserved_used);
+        stats.nsampled += STAT_LOAD(nsampled);
+    }
+    heap = prev_heap;
+    if (m61_is_heap_arena(heap))    // arenas' counters are kept per thread
+        m61_sum_stat_shards(&stats);
+    return stats;
+}
+
+/// m61_get_thread_statistics(stats, n)
+///    Fill `stats` with the statistics of up to `n` live threads, and
+///    return the number of live threads that have allocated or freed.
+size_t m61_get_thread_statistics(m61_thread_statistics* stats, size_t n) {
+#if M61_THREADS
+    size_t count = 0;
+
+    pthread_mutex_lock(&stat_shards_lock);
+    for (m61_stat_shard* shard = stat_shards; shard != nullptr; shard = shard->next, ++count) {
+        if (count < n) {
+            stats[count].thread = shard->thread;
+            stats[count].stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+            for (auto field : stat_counters)
+                stats[count].stats.*field = __atomic_load_n(&(shard->stats.*field), __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&stat_shards_lock);
+    return count;
+#else
+    if (n != 0) {
+        stats[0].thread = pthread_self();
+        stats[0].stats = m61_get_statistics();
+        stats[0].stats.heap_min = stats[0].stats.heap_max = 0;
+    }
+    return 1;
+#endif
+}
+
+/// m61_malloc_tagged(sz, tag, file, line)
+///    Allocate `sz` bytes counted under `tag`. The bytes are charged to
+///    the tag before the heap is searched, so that concurrent allocations
+///    cannot take the tag over its budget together.
+void* m61_malloc_tagged(size_t sz, unsigned tag, const char* file, int line) {
+    size_t budget;
+    size_t* header;
+    void* ptr;
+
+    if (tag == 0)
+        return m61_malloc(sz, file, line);
+    if (tag >= M61_MAX_TAGS || sz == 0)
+        return nullptr;
+
+    budget = __atomic_load_n(&tag_budgets[tag], __ATOMIC_RELAXED);
+    if ((TAG_STAT_ADD(tag, active_size, sz) + sz > budget && budget != 0)
+        || (ptr = m61_malloc_in_heap(sz, file, line)) == nullptr) {
+        TAG_STAT_SUB(tag, active_size, sz);
+        TAG_STAT_ADD(tag, nfail, 1);
+        TAG_STAT_ADD(tag, fail_size, sz);
+        return nullptr;
+    }
+
+    M61_ROUTE_HEAP(ptr);
+    M61_LOCK_HEAP();
+    header = GET_HEADER_FROM_PAYLOAD(ptr);
+    SET_HEADER_ADDR(header, heap->top_of_heap.get(), header, tag);
+    TAG_STAT_ADD(tag, ntotal, 1);
+    TAG_STAT_ADD(tag, nactive, 1);
+    TAG_STAT_ADD(tag, total_size, sz);
+    return ptr;
+}
+
+/// m61_set_tag_budget(tag, bytes)
+///    Limit the active bytes of `tag` to `bytes`, or lift the limit if 0.
+void m61_set_tag_budget(unsigned tag, size_t bytes) {
+    if (tag != 0 && tag < M61_MAX_TAGS)
+        __atomic_store_n(&tag_budgets[tag], bytes, __ATOMIC_RELAXED);
+}
+
+/// m61_free_tag(tag, file, line)
+///    Walk the allocated list of every heap the leak report covers and
+///    release each block of `tag`. Blocks in thread caches or remote-free
+///    queues have been freed already and carry markers instead.
+size_t m61_free_tag(unsigned tag, const char* file, int line) {
+    m61_heap* prev_heap = heap;
+    m61_heap* first;
+    m61_heap* last;
+    const char* block_file;
+    size_t* next;
+    size_t nfreed = 0;
+
+    if (tag == 0 || tag >= M61_MAX_TAGS)
+        return 0;
+    m61_heap_range(&first, &last);
+    for (heap = first; heap != last; ++heap) {
+        M61_LOCK_HEAP();
+        for (size_t* block = heap->alloc_list_start; block != nullptr; block = next) {
+            next = *LIST_NEXT(block);
+            block_file = *GET_FILENAME(block);
+            if (GET_TAG(block) != tag || block_file == scope_marker || block_file == tcache_marker
+                || block_file == remote_marker)
+                continue;
+            m61_release_block(block, file, line);
+            ++nfreed;
+        }
+    }
+    heap = prev_heap;
+    return nfreed;
+}
+
+/// m61_get_tag_statistics(tag)
+///    Return the statistics of `tag`.
+m61_statistics m61_get_tag_statistics(unsigned tag) {
+    m61_statistics stats = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    m61_statistics* counters;
+
+    if (tag == 0 || tag >= M61_MAX_TAGS)
+        return stats;
+    counters = &tag_statistics[tag];
+    stats.nactive = __atomic_load_n(&counters->nactive, __ATOMIC_RELAXED);
+    stats.active_size = __atomic_load_n(&counters->active_size, __ATOMIC_RELAXED);
+    stats.nfree = __atomic_load_n(&counters->nfree, __ATOMIC_RELAXED);
+    stats.freed_size = __atomic_load_n(&counters->freed_size, __ATOMIC_RELAXED);
+    stats.ntotal = __atomic_load_n(&counters->ntotal, __ATOMIC_RELAXED);
+    stats.total_size = __atomic_load_n(&counters->total_size, __ATOMIC_RELAXED);
+    stats.nfail = __atomic_load_n(&counters->nfail, __ATOMIC_RELAXED);
+    stats.fail_size = __atomic_load_n(&counters->fail_size, __ATOMIC_RELAXED);
+    return stats;
+}
+
+/// m61_get_memory_buffer()
+///    Get a pointer to the memory buffer
+///    For testing purposes only
+m61_memory_buffer* m61_get_memory_buffer() {
+    return &default_buffer;
+}
+
+/// m61_get_free_list()
+///    Get a pointer to the free list
+///    For testing purposes only
+size_t* m61_get_free_list() {
+    M61_LOCK_HEAP();
+    m61_tcache_flush_all();
+    m61_drain_remote_frees();
+    return heap->free_list_start;
+}
+
+/// m61_get_alloc_list()
+///    Get a pointer to the free list
+///    For testing purposes only
+size_t* m61_get_alloc_list() {
+    M61_LOCK_HEAP();
+    m61_tcache_flush_all();
+    m61_drain_remote_frees();
+    return heap->alloc_list_start;
+}
+
+/// m61_print_statistics()
+///    Prints the current memory statistics.
+void m61_print_statistics() {
+    m61_statistics stats = m61_get_statistics();
+    printf("alloc count: active %10llu   total %10llu   fail %10llu\n",
+           stats.nactive, stats.ntotal, stats.nfail);
+    printf("alloc size:  active %10llu   total %10llu   fail %10llu\n",
+           stats.active_size, stats.total_size, stats.fail_size);
+    if (stats.nreserved != 0)
+        printf("reserved:    blocks %10llu   used  %10llu\n", stats.nreserved, stats.nreserved_used);
+}
+
+
+// every slot pool, for m61_print_leak_report and m61_node_pool
+static m61_slot_pool* slot_pools = nullptr;
+static pthread_mutex_t slot_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char node_pool_site[] = "<node pool>";
+
+/// m61_print_leak_report()
+///    Prints a report of all currently-active allocated blocks of dynamic
+///    memory, followed by the slot pools that have slots in use.
+void m61_print_leak_report() {
+    m61_heap* prev_heap = heap;
+    m61_heap* first;
+    m61_heap* last;
+    const char* file;
+    unsigned int line;
+    unsigned int size;
+    void* payload;
+
+    m61_heap_range(&first, &last);
+    for (heap = first; heap != last; ++heap) {
+        M61_LOCK_HEAP();
+        m61_tcache_flush_all();
+        m61_drain_remote_frees();
+        for (size_t* block = heap->alloc_list_start; block != nullptr; block = *LIST_NEXT(block)) {
+            file = *GET_FILENAME(block);
+            line = *GET_LINE_NUMBER(block);
+            size = *REQ_SIZE_FROM_HEADER(block);
+            payload = GET_PAYLOAD(block);
+            if (file == scope_marker || file == tcache_marker)
+                continue;
+            if (IS_MOVABLE(block))      // report the object, not its handle pointer
+                fprintf(stdout, "LEAK CHECK: %s:%d: allocated relocatable object %p with size %d\n",
+                        file, line, (char*) payload + ALIGNMENT, size - (int) ALIGNMENT);
+            else
+                fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %d\n", file, line, payload, size);
+        }
+    }
+    heap = prev_heap;
+    if (m61_is_heap_arena(heap))    // sampled objects belong to the default heap
+        m61_print_guarded_leaks();
+
+    // the blocks above include pool slabs; say how much of each pool is in use
+    pthread_mutex_lock(&slot_pools_lock);
+    for (m61_slot_pool* pool = slot_pools; pool != nullptr; pool = pool->next_pool) {
+        if (pool->nlive != 0)
+            fprintf(stdout, "LEAK CHECK: %s:%d: pool of %zu-byte slots with %zu of %zu slots in use\n",
+                    pool->file, pool->line, pool->slot_size, pool->nlive, pool->nslabs * pool->slots_per_slab);
+    }
+    pthread_mutex_unlock(&slot_pools_lock);
+}
+
+
+// every arena chunk starts with a link to the previous chunk, padded
+// so that the objects after it stay aligned
+#define ARENA_CHUNK_HEADER ALIGN_UP(sizeof(char*))
+#define ARENA_FIRST_CHUNK_HEADER (ARENA_CHUNK_HEADER + ALIGN_UP(sizeof(m61_arena)))
+
+/// m61_arena_create(chunk_size, file, line)
+///    Create an arena whose chunks are at least `chunk_size` bytes,
+///    allocated from the main heap at source location `file`:`line`.
+///    The arena structure is placed at the start of the first chunk.
+///    Returns nullptr if the first chunk cannot be allocated.
+m61_arena* m61_arena_create(size_t chunk_size, const char* file, int line) {
+    char* chunk;
+    m61_arena* arena;
+
+    if (chunk_size < ARENA_FIRST_CHUNK_HEADER + ALIGNMENT)
+        chunk_size = ARENA_FIRST_CHUNK_HEADER + ALIGNMENT;
+
+    if ((chunk = (char*) m61_malloc(chunk_size, file, line)) == nullptr)
+        return nullptr;
+
+    *(char**)chunk = nullptr;           // the first chunk ends the chunk list
+    arena = (m61_arena*)(chunk + ARENA_CHUNK_HEADER);
+    arena->chunk = chunk;
+    arena->pos = chunk + ARENA_FIRST_CHUNK_HEADER;
+    arena->end = chunk + chunk_size;
+    arena->chunk_size = chunk_size;
+    arena->file = file;
+    arena->line = line;
+    return arena;
+}
+
+/// m61_arena_alloc(arena, sz)
+///    Return a pointer to `sz` bytes from `arena`, aligned to ALIGNMENT.
+///    If the current chunk is exhausted, a new chunk of at least
+///    `arena->chunk_size` bytes is allocated from the main heap. Returns
+///    nullptr if `sz == 0` or the main heap is out of memory.
+void* m61_arena_alloc(m61_arena* arena, size_t sz) {
+    size_t asize;
+    size_t chunk_size;
+    char* chunk;
+    void* payload;
+
+    if (sz == 0)
+        return nullptr;
+
+    // detect unsigned integer overflow
+    if (sz > SIZE_MAX - (ALIGNMENT + ARENA_CHUNK_HEADER)) {
+        STAT_ADD(nfail, 1);
+        STAT_ADD(fail_size, sz);
+        return nullptr;
+    }
+
+    asize = ALIGN_UP(sz);
+
+    if (asize > (size_t)(arena->end - arena->pos)) {   // start a new chunk
+        chunk_size = asize + ARENA_CHUNK_HEADER;
+        if (chunk_size < arena->chunk_size)
+            chunk_size = arena->chunk_size;
+        if ((chunk = (char*) m61_malloc(chunk_size, arena->file, arena->line)) == nullptr)
+            return nullptr;
+        *(char**)chunk = arena->chunk;
+        arena->chunk = chunk;
+        arena->pos = chunk + ARENA_CHUNK_HEADER;
+        arena->end = chunk + chunk_size;
+    }
+
+    payload = arena->pos;
+    arena->pos += asize;
+    assert((uintptr_t)payload % ALIGNMENT == 0);
+    return payload;
+}
+
+/// m61_arena_reset(arena)
+///    Release every object allocated from `arena` at once. All chunks
+///    but the first (which holds the arena) are returned to the main heap.
+void m61_arena_reset(m61_arena* arena) {
+    char* chunk = arena->chunk;
+    char* prev;
+
+    while ((prev = *(char**)chunk) != nullptr) {
+        m61_free(chunk, arena->file, arena->line);
+        chunk = prev;
+    }
+
+    assert(chunk + ARENA_CHUNK_HEADER == (char*)arena);   // only the first chunk is left
+    arena->chunk = chunk;
+    arena->pos = chunk + ARENA_FIRST_CHUNK_HEADER;
+    arena->end = chunk + arena->chunk_size;
+}
+
+/// m61_arena_destroy(arena)
+///    Return every chunk of `arena` to the main heap. The arena itself
+///    is freed along with its first chunk.
+void m61_arena_destroy(m61_arena* arena) {
+    char* chunk = arena->chunk;
+    char* prev;
+    const char* file = arena->file;
+    int line = arena->line;
+
+    while (chunk != nullptr) {
+        prev = *(char**)chunk;
+        m61_free(chunk, file, line);
+        chunk = prev;
+    }
+}
+
+
+/// m61_slot_pool_init(size, align, slots_per_slab, file, line)
+///    Allocate and initialize an unregistered slot pool.
+static m61_slot_pool* m61_slot_pool_init(size_t size, size_t align, size_t slots_per_slab,
+                                         const char* file, int line) {
+    m61_slot_pool* pool;
+
+    if (align == 0 || (align & (align - 1)) != 0 || size > SIZE_MAX / 2)
+        return nullptr;
+    if ((pool = (m61_slot_pool*) m61_malloc(sizeof(m61_slot_pool), file, line)) == nullptr)
+        return nullptr;
+
+    if (size < sizeof(void*))
+        size = sizeof(void*);   // an unused slot holds the free-list link
+    if (align < alignof(void*))
+        align = alignof(void*);
+    pool->slot_size = (size + align - 1) & ~(align - 1);
+    pool->align = align;
+    pool->slab_header = (sizeof(char*) + align - 1) & ~(align - 1);
+    if (slots_per_slab == 0)
+        slots_per_slab = std::max<size_t>(8, 4096 / pool->slot_size);
+    pool->slots_per_slab = slots_per_slab;
+    pool->free_slots = nullptr;
+    pool->slab = nullptr;
+    pool->nslabs = 0;
+    pool->nlive = 0;
+    pool->file = file;
+    pool->line = line;
+    pool->next_pool = nullptr;
+    pthread_mutex_init(&pool->lock, nullptr);
+    return pool;
+}
+
+/// m61_slot_pool_create(size, align, slots_per_slab, file, line)
+///    Create a pool of slots of `size` bytes aligned to `align`, with
+///    `slots_per_slab` slots per slab, allocated from the main heap at
+///    source location `file`:`line`, and register it.
+m61_slot_pool* m61_slot_pool_create(size_t size, size_t align, size_t slots_per_slab,
+                                    const char* file, int line) {
+    m61_slot_pool* pool = m61_slot_pool_init(size, align, slots_per_slab, file, line);
+
+    if (pool != nullptr) {
+        pthread_mutex_lock(&slot_pools_lock);
+        pool->next_pool = slot_pools;
+        slot_pools = pool;
+        pthread_mutex_unlock(&slot_pools_lock);
+    }
+    return pool;
+}
+
+/// m61_slot_pool_alloc(pool)
+///    Pop a slot off `pool`'s free list. If it is empty, allocate a slab
+///    from the main heap and thread all of its slots onto the list.
+void* m61_slot_pool_alloc(m61_slot_pool* pool) {
+    char* slab;
+    char* slot;
+    void* ptr;
+
+    if (M61_THREADS)
+        pthread_mutex_lock(&pool->lock);
+    if (pool->free_slots == nullptr) {
+        slab = (char*) m61_aligned_alloc(pool->align, pool->slab_header + pool->slots_per_slab * pool->slot_size,
+                                         pool->file, pool->line);
+        if (slab == nullptr) {
+            if (M61_THREADS)
+                pthread_mutex_unlock(&pool->lock);
+            return nullptr;
+        }
+        *(char**) slab = pool->slab;
+        pool->slab = slab;
+        ++pool->nslabs;
+        // link the slots back to front so they are handed out in address order
+        for (size_t i = pool->slots_per_slab; i != 0; --i) {
+            slot = slab + pool->slab_header + (i - 1) * pool->slot_size;
+            *(void**) slot = pool->free_slots;
+            pool->free_slots = slot;
+        }
+    }
+    ptr = pool->free_slots;
+    pool->free_slots = *(void**) ptr;
+    ++pool->nlive;
+    if (M61_THREADS)
+        pthread_mutex_unlock(&pool->lock);
+    return ptr;
+}
+
+/// m61_slot_pool_free(pool, ptr)
+///    Push slot `ptr` back onto `pool`'s free list.
+void m61_slot_pool_free(m61_slot_pool* pool, void* ptr) {
+    if (ptr == nullptr)
+        return;
+    if (M61_THREADS)
+        pthread_mutex_lock(&pool->lock);
+    *(void**) ptr = pool->free_slots;
+    pool->free_slots = ptr;
+    --pool->nlive;
+    if (M61_THREADS)
+        pthread_mutex_unlock(&pool->lock);
+}
+
+/// m61_slot_pool_destroy(pool)
+///    Unregister `pool` and return its slabs and the pool itself to the
+///    main heap.
+void m61_slot_pool_destroy(m61_slot_pool* pool) {
+    char* slab = pool->slab;
+    char* prev;
+    const char* file = pool->file;
+    int line = pool->line;
+
+    pthread_mutex_lock(&slot_pools_lock);
+    for (m61_slot_pool** pp = &slot_pools; *pp != nullptr; pp = &(*pp)->next_pool) {
+        if (*pp == pool) {
+            *pp = pool->next_pool;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&slot_pools_lock);
+
+    while (slab != nullptr) {
+        prev = *(char**) slab;
+        m61_free(slab, file, line);
+        slab = prev;
+    }
+    pthread_mutex_destroy(&pool->lock);
+    m61_free(pool, file, line);
+}
+
+/// m61_node_pool(size, align)
+///    Return the shared pool for `size`-byte slots aligned to `align`,
+///    creating and registering it if this is the first request.
+m61_slot_pool* m61_node_pool(size_t size, size_t align) {
+    m61_slot_pool* pool;
+    size_t slot_size;
+
+    align = std::max(align, alignof(void*));
+    slot_size = (std::max(size, sizeof(void*)) + align - 1) & ~(align - 1);
+
+    pthread_mutex_lock(&slot_pools_lock);
+    for (pool = slot_pools; pool != nullptr; pool = pool->next_pool) {
+        if (pool->file == node_pool_site && pool->slot_size == slot_size && pool->align == align)
+            break;
+    }
+    if (pool == nullptr && (pool = m61_slot_pool_init(size, align, 0, node_pool_site, 0)) != nullptr) {
+        pool->next_pool = slot_pools;
+        slot_pools = pool;
+    }
+    pthread_mutex_unlock(&slot_pools_lock);
+    return pool;
+}
+
+
+// a shared or persistent heap's mapping starts with this header, followed
+// by the heap itself; `magic` is set last, once the heap is ready for use.
+// The file names of the heap's blocks point into `files`, which holds each
+// name once, starting with "?" for names that no longer fit.
+#ifndef M61_SHARED_FILES
+#define M61_SHARED_FILES 4096
+#endif
+struct m61_shared_header {
+    uint64_t magic;
+    size_t size;             // size of the whole mapping
+    int clean;               // persistent heaps: set when the heap was closed
+    char boot_id[40];        // the boot the lock was initialized in
+    size_t files_used;       // bytes of `files` in use
+    char files[M61_SHARED_FILES];
+    m61_heap root;
+};
+
+#define SHARED_MAGIC       0x6d36315f73686d21 // "m61_shm!"
+#define SHARED_HEADER_SIZE ALIGN_UP(sizeof(m61_shared_header))
+#define SHARED_FROM_ROOT(h) ((m61_shared_header*)((char*)(h) - offsetof(m61_shared_header, root)))
+
+/// m61_intern_file(h, file)
+///    Return the copy of file name `file` kept in shared heap `h`, adding
+///    it if it is new, or "?" if there is no room left for it. The caller
+///    holds the heap's lock.
+static const char* m61_intern_file(m61_heap* h, const char* file) {
+    m61_shared_header* shared = SHARED_FROM_ROOT(h);
+    char* end = shared->files + shared->files_used;
+    size_t len;
+
+    if (file >= shared->files && file < end)
+        return file;
+    for (char* name = shared->files; name != end; name += strlen(name) + 1) {
+        if (strcmp(name, file) == 0)
+            return name;
+    }
+    len = strlen(file) + 1;
+    if (len > M61_SHARED_FILES - shared->files_used)
+        return shared->files;
+    memcpy(end, file, len);
+    shared->files_used += len;
+    return end;
+}
+
+/// m61_init_shared_lock(lock)
+///    Initialize the lock of a shared or persistent heap: process-shared,
+///    recursive like the default heap's lock, and robust, so that a process
+///    dying with it held does not leave it locked.
+static void m61_init_shared_lock(pthread_mutex_t* lock) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/// m61_read_boot_id(id)
+///    Store the identifier of the running boot of the system, or "" if it
+///    is unknown, in the 40 bytes at `id`.
+static void m61_read_boot_id(char* id) {
+    int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+    ssize_t n = fd < 0 ? 0 : read(fd, id, 39);
+
+    id[n > 0 ? n : 0] = '\0';
+    if (fd >= 0)
+        close(fd);
+}
+
+/// m61_lock_shared_heap(h)
+///    Lock shared or persistent heap `h`. If the lock's owner died holding
+///    it, the heap may be half updated: repair it with `m61_heap_recover`
+///    before marking the lock consistent again.
+static void m61_lock_shared_heap(m61_heap* h) {
+    if (pthread_mutex_lock(&h->lock) == EOWNERDEAD) {
+        m61_heap_recover(h, true);
+        pthread_mutex_consistent(&h->lock);
+    }
+}
+
+/// m61_attach_timed_out(start)
+///    Return true once M61_ATTACH_TIMEOUT milliseconds have passed since
+///    `start`.
+static bool m61_attach_timed_out(std::chrono::steady_clock::time_point start) {
+    return std::chrono::steady_clock::now() - start > std::chrono::milliseconds(M61_ATTACH_TIMEOUT);
+}
+
+/// m61_map_heap(fd, size, created, wait)
+///    Map the heap stored in the object `fd`. If `created`, size the object
+///    to `size` bytes, map it and lay out an empty heap. Otherwise map it
+///    whole; if `wait`, first wait up to M61_ATTACH_TIMEOUT milliseconds
+///    for the creator to finish initializing the heap. The heap holds no
+///    absolute addresses, so any address will do. Returns nullptr on
+///    failure.
+static m61_shared_header* m61_map_heap(int fd, size_t size, bool created, bool wait) {
+    auto start = std::chrono::steady_clock::now();
+    m61_shared_header* shared;
+    struct stat st;
+    void* base;
+
+    if (created) {
+
+        if (ftruncate(fd, size) != 0
+            || (base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+            return nullptr;
+        shared = (m61_shared_header*) base;
+        shared->size = size;
+        shared->clean = 0;
+        strcpy(shared->files, "?");
+        shared->files_used = 2;
+        m61_read_boot_id(shared->boot_id);
+
+        m61_init_shared_lock(&shared->root.lock);
+        m61_heap_init(&shared->root, (char*)base + SHARED_HEADER_SIZE, size - SHARED_HEADER_SIZE);
+        __atomic_store_n(&shared->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+        return shared;
+
+    }
+
+    // wait for the creator to size the object, then to initialize the heap
+    while (fstat(fd, &st) == 0 && (size_t) st.st_size < SHARED_HEADER_SIZE) {
+        if (!wait || m61_attach_timed_out(start))
+            return nullptr;
+        sched_yield();
+    }
+    if ((base = mmap(nullptr, SHARED_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return nullptr;
+    shared = (m61_shared_header*) base;
+    while (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC) {
+        if (!wait || m61_attach_timed_out(start)) {
+            munmap(shared, SHARED_HEADER_SIZE);
+            return nullptr;
+        }
+        sched_yield();
+    }
+    size = shared->size;
+    munmap(shared, SHARED_HEADER_SIZE);
+
+    base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return base == MAP_FAILED ? nullptr : (m61_shared_header*) base;
+}
+
+/// m61_heap_mapping_size(size)
+///    Round a requested heap size up to whole pages. Returns 0 if `size`
+///    is too small to hold the header and a minimal heap.
+static size_t m61_heap_mapping_size(size_t size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    size = (size + page_size - 1) / page_size * page_size;
+    if (size < SHARED_HEADER_SIZE + MIN_BLOCK + 4 * WORD_SIZE)
+        return 0;
+    return size;
+}
+
+/// m61_shared_heap_open(name, size)
+///    Create the shared heap `name` with room for `size` bytes, or attach
+///    to it if it already exists. Every process maps the heap wherever the
+///    kernel likes. Returns nullptr on failure.
+m61_heap* m61_shared_heap_open(const char* name, size_t size) {
+    m61_shared_header* shared;
+    bool created = true;
+    int fd;
+
+    if ((size = m61_heap_mapping_size(size)) == 0)
+        return nullptr;
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+        created = false;
+        if (errno != EEXIST || (fd = shm_open(name, O_RDWR, 0)) < 0)
+            return nullptr;
+    }
+
+    shared = m61_map_heap(fd, size, created, true);
+    close(fd);
+    if (shared == nullptr) {
+        if (created)
+            shm_unlink(name);
+        return nullptr;
+    }
+    return &shared->root;
+}
+
+/// m61_shared_heap_close(h)
+///    Unmap shared heap `h` from this process.
+void m61_shared_heap_close(m61_heap* h) {
+    m61_shared_header* shared = SHARED_FROM_ROOT(h);
+    munmap(shared, shared->size);
+}
+
+/// m61_shared_heap_unlink(name)
+///    Remove the name of a shared heap.
+void m61_shared_heap_unlink(const char* name) {
+    shm_unlink(name);
+}
+
+/// m61_heap_malloc(h, sz, file, line)
+///    Allocate `sz` bytes from heap `h`. The heap's lock is held while the
+///    allocation functions are pointed at `h`.
+void* m61_heap_malloc(m61_heap* h, size_t sz, const char* file, int line) {
+    m61_heap* prev_heap = heap;
+    void* ptr;
+
+    m61_lock_shared_heap(h);
+    heap = h;
+    ptr = m61_malloc(sz, file, line);
+    heap = prev_heap;
+    pthread_mutex_unlock(&h->lock);
+    return ptr;
+}
+
+/// m61_heap_free(h, ptr, file, line)
+///    Free `ptr`, a block of heap `h`, under the heap's lock.
+void m61_heap_free(m61_heap* h, void* ptr, const char* file, int line) {
+    m61_heap* prev_heap = heap;
+
+    m61_lock_shared_heap(h);
+    heap = h;
+    m61_free(ptr, file, line);
+    heap = prev_heap;
+    pthread_mutex_unlock(&h->lock);
+}
+
+/// m61_heap_aligned_alloc(h, align, sz, file, line)
+///    Allocate `sz` bytes aligned to `align` from heap `h` under its lock.
+void* m61_heap_aligned_alloc(m61_heap* h, size_t align, size_t sz, const char* file, int line) {
+    m61_heap* prev_heap = heap;
+    void* ptr;
+
+    m61_lock_shared_heap(h);
+    heap = h;
+    ptr = m61_aligned_alloc(align, sz, file, line);
+    heap = prev_heap;
+    pthread_mutex_unlock(&h->lock);
+    return ptr;
+}
+
+/// m61_heap_get_statistics(h)
+///    Return the current memory statistics of heap `h`.
+m61_statistics m61_heap_get_statistics(m61_heap* h) {
+    m61_heap* prev_heap = heap;
+    m61_statistics stats;
+
+    m61_lock_shared_heap(h);
+    heap = h;
+    stats = m61_get_statistics();
+    heap = prev_heap;
+    pthread_mutex_unlock(&h->lock);
+    return stats;
+}
+
+/// m61_heap_offset(h, ptr)
+///    Return the offset of `ptr` from the start of shared heap `h`.
+size_t m61_heap_offset(m61_heap* h, void* ptr) {
+    return (char*)ptr - (char*)SHARED_FROM_ROOT(h);
+}
+
+/// m61_heap_pointer(h, offset)
+///    Return the address at `offset` in shared heap `h`.
+void* m61_heap_pointer(m61_heap* h, size_t offset) {
+    return (char*)SHARED_FROM_ROOT(h) + offset;
+}
+
+/// m61_persistent_heap_open(path, size)
+///    Open the heap stored in file `path`, creating it with room for `size`
+///    bytes if it does not exist. An existing heap is checked, under its
+///    lock, by `m61_heap_recover`, which rebuilds its lists if the previous
+///    user did not close it cleanly. Returns nullptr on failure.
+m61_heap* m61_persistent_heap_open(const char* path, size_t size) {
+    m61_shared_header* shared;
+    char boot_id[sizeof(shared->boot_id)];
+    bool created = true;
+    int fd;
+
+    if ((size = m61_heap_mapping_size(size)) == 0)
+        return nullptr;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+        created = false;
+        if (errno != EEXIST || (fd = open(path, O_RDWR)) < 0)
+            return nullptr;
+    }
+
+    shared = m61_map_heap(fd, size, created, false);
+    close(fd);
+    if (shared == nullptr) {
+        if (created)
+            unlink(path);
+        return nullptr;
+    }
+
+    if (!created) {
+        // the lock was initialized with the heap, and other processes may
+        // have the heap open or hold the lock; one that died holding it is
+        // dealt with by m61_lock_shared_heap. But a lock taken before the
+        // machine restarted names a thread no kernel knows about, and would
+        // never be released, so a heap last opened in another boot gets a
+        // new lock.
+        m61_read_boot_id(boot_id);
+        if (strcmp(boot_id, shared->boot_id) != 0) {
+            m61_init_shared_lock(&shared->root.lock);
+            strcpy(shared->boot_id, boot_id);
+        }
+
+        m61_lock_shared_heap(&shared->root);
+        if (m61_heap_recover(&shared->root, !shared->clean) < 0) {
+            pthread_mutex_unlock(&shared->root.lock);
+            munmap(shared, shared->size);
+            return nullptr;
+        }
+
+        // a file name outside `files` (a scope marker of the process that
+        // made the block, or garbage) becomes "?", so scope markers become
+        // ordinary blocks
+        shared->root.open_scopes = 0;
+        shared->root.scope_tail = nullptr;
+        shared->root.remote_frees = nullptr;
+        for (size_t* block = shared->root.alloc_list_start; block != nullptr; block = *LIST_NEXT(block)) {
+            const char* file = *GET_FILENAME(block);
+            if (file < shared->files || file >= shared->files + shared->files_used)
+                SET_FILENAME(block, shared->files);
+        }
+        pthread_mutex_unlock(&shared->root.lock);
+    }
+
+    shared->clean = 0;
+    return &shared->root;
+}
+
+/// m61_persistent_heap_close(h)
+///    Mark persistent heap `h` as cleanly closed, write it back to its file
+///    and unmap it.
+void m61_persistent_heap_close(m61_heap* h) {
+    m61_shared_header* shared = SHARED_FROM_ROOT(h);
+
+    shared->clean = 1;
+    msync(shared, shared->size, MS_SYNC);
+    munmap(shared, shared->size);
+}
+
+/// m61_heap_lists_consistent(h, nfree, nalloc)
+///    Check that the free and allocated lists of `h` hold exactly `nfree`
+///    and `nalloc` blocks, each inside the heap, of the right type, and
+///    linked back to its predecessor.
+static bool m61_heap_lists_consistent(m61_heap* h, size_t nfree, size_t nalloc) {
+    size_t* lists[2] = {h->free_list_start, h->alloc_list_start};
+    size_t expected[2] = {nfree, nalloc};
+    size_t* node;
+    size_t* prev;
+    size_t count;
+
+    for (int i = 0; i != 2; ++i) {
+        prev = nullptr;
+        count = 0;
+        for (node = lists[i]; node != nullptr; node = *LIST_NEXT(node)) {
+            if (node <= h->top_of_heap || node >= h->end_of_heap
+                || (uintptr_t)GET_PAYLOAD(node) % ALIGNMENT != 0
+                || IS_ALLOC(node) != (i == 1)
+                || *LIST_PREV(node) != prev
+                || ++count > expected[i])
+                return false;
+            prev = node;
+        }
+        if (count != expected[i])
+            return false;
+    }
+    return true;
+}
+
+/// m61_heap_recover(h, rebuild)
+///    Walk the boundary tags of `h` from `top_of_heap` to `end_of_heap`,
+///    repairing footers and neighbor bits and merging adjacent free blocks.
+///    If `rebuild` is set or the lists disagree with the walk, rebuild the
+///    free and allocated lists (in address order) and the active-allocation
+///    statistics from the walk. Returns 1 if the lists were rebuilt, 0 if
+///    they were consistent, and -1 if the boundary tags are unrecoverable.
+int m61_heap_recover(m61_heap* h, bool rebuild) {
+    size_t* block;
+    size_t* next;
+    size_t* prev_free = nullptr;     // the free block just before `block`, if any
+    size_t* free_tail = nullptr;
+    size_t* alloc_tail = nullptr;
+    size_t nfree = 0;
+    size_t nalloc = 0;
+    size_t size;
+    bool prev_alloc = true;          // the prologue is allocated
+    unsigned char bits;
+    unsigned long long active_size = 0;
+    uintptr_t heap_min = UINTPTR_MAX;
+    uintptr_t heap_max = 0;
+    void* payload;
+
+    // pass 1: walk the boundary tags, trusting the size in each header
+    for (block = NEXT_FROM_HEADER(h->top_of_heap); block != h->end_of_heap; block = next) {
+        size = GET_SIZE(block);
+        next = INCREMENT_SIZE_T_PTR(block, size);
+        if (size < MIN_BLOCK || size % ALIGNMENT != 0 || next > h->end_of_heap)
+            return -1;
+
+        if (!IS_ALLOC(block) && !prev_alloc) {      // interrupted coalesce
+            m61_set_header_and_footer(prev_free, GET_SIZE(prev_free) + size, PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
+            rebuild = true;
+            continue;
+        }
+
+        bits = (IS_ALLOC(block) ? ALLOC_BIT : 0) | (prev_alloc ? PREV_ALLOC_BIT : 0)
+            | (IS_ALLOC(next) ? NEXT_ALLOC_BIT : 0);
+        if (GET_BITS(block) != bits || *FOOTER_FROM_HEADER(block) != *block)
+            m61_set_header_and_footer(block, size, bits);
+
+        if (IS_ALLOC(block)) {
+            ++nalloc;
+            payload = GET_PAYLOAD(block);
+            active_size += *REQ_SIZE_FROM_HEADER(block);
+            heap_min = (uintptr_t)payload < heap_min ? (uintptr_t)payload : heap_min;
+            heap_max = (uintptr_t)payload + *REQ_SIZE_FROM_HEADER(block) > heap_max
+                ? (uintptr_t)payload + *REQ_SIZE_FROM_HEADER(block) : heap_max;
+        } else {
+            ++nfree;
+            prev_free = block;
+        }
+        prev_alloc = IS_ALLOC(block);
+    }
+    *h->end_of_heap = ALLOC_BIT | NEXT_ALLOC_BIT | (prev_alloc ? PREV_ALLOC_BIT : 0);
+    // the prologue's next bit is only kept in its header
+    *h->top_of_heap = GET_SIZE(h->top_of_heap) | ALLOC_BIT | PREV_ALLOC_BIT
+        | (IS_ALLOC(NEXT_FROM_HEADER(h->top_of_heap)) ? NEXT_ALLOC_BIT : 0);
+
+    // reserved blocks are allocated but on neither list
+    if (!rebuild && m61_heap_lists_consistent(h, nfree, nalloc - h->nreserved))
+        return 0;
+
+    // a rebuild finds them on the allocated list, like any recovered block
+    h->statistics.nreserved -= h->nreserved;
+    h->nreserved = 0;
+    for (m61_reserved_class& rc : h->reserved)
+        rc = {0, 0, nullptr};
+
+    // pass 2: relink both lists in address order
+    h->free_list_start = nullptr;
+    h->alloc_list_start = nullptr;
+    for (block = NEXT_FROM_HEADER(h->top_of_heap); block != h->end_of_heap; block = NEXT_FROM_HEADER(block)) {
+        size_t** tail = IS_ALLOC(block) ? &alloc_tail : &free_tail;
+        SET_LIST_PREV(block, *tail);
+        SET_LIST_NEXT(block, nullptr);
+        if (*tail != nullptr)
+            SET_LIST_NEXT(*tail, block);
+        else if (IS_ALLOC(block))
+            h->alloc_list_start = block;
+        else
+            h->free_list_start = block;
+        *tail = block;
+    }
+
+    h->statistics.nactive = nalloc;
+    h->statistics.active_size = active_size;
+    h->statistics.heap_min = heap_min == UINTPTR_MAX ? heap_min : heap_min - (uintptr_t) h->top_of_heap.get();
+    h->statistics.heap_max = heap_max == 0 ? heap_max : heap_max - (uintptr_t) h->top_of_heap.get();
+    return 1;
+}
+
+/// m61_scope_begin(file, line)
+///    Open an allocation scope by placing a marker block in the allocated
+///    list. This thread's blocks go in front of it until it is closed, so
+///    the list itself records what belongs to the scope. The marker is
+///    not counted in the statistics; its file name slot identifies it as a
+///    marker, so only `line` is recorded. Returns nullptr if out of
+///    memory.
+m61_scope m61_scope_begin(const char*, int line) {
+    size_t asize = m61_get_adjusted_size(sizeof(m61_scope_info));
+    size_t* header;
+    m61_scope_info* info;
+
+    m61_use_heap_arena();
+    M61_LOCK_HEAP();
+    if ((header = m61_find_fit(asize)) == nullptr)
+        return nullptr;
+    m61_place(header, asize);
+    m61_set_alloc_metadata(header, sizeof(m61_scope_info), scope_marker, line);
+    info = SCOPE_INFO(header);
+    info->enclosing = thread_scope;
+    info->outermost = m61_thread_scope_in(heap) == nullptr;
+    info->outer_prev = nullptr;
+    info->outer_next = nullptr;
+    if (info->outermost) {          // placed behind the last outermost marker
+        info->outer_prev = heap->scope_tail;
+        if (heap->scope_tail != nullptr)
+            SCOPE_INFO(heap->scope_tail)->outer_next = header;
+        heap->scope_tail = header;
+    }
+    thread_scope = header;
+    __atomic_fetch_add(&heap->open_scopes, 1, __ATOMIC_RELAXED);
+    return GET_PAYLOAD(header);
+}
+
+/// m61_scope_close(marker)
+///    Take the scope of `marker`, whose block is being released, off this
+///    thread's open scopes. An outermost marker leaves the heap's list of
+///    them; the thread's next scope inside it in the heap, if any, takes
+///    its place there.
+static void m61_scope_close(size_t* marker) {
+    m61_scope_info* info = SCOPE_INFO(marker);
+    size_t** link = &thread_scope;
+    size_t* inner = nullptr;
+    size_t* prev = info->outer_prev;
+    size_t* next = info->outer_next;
+
+    while (*link != nullptr && *link != marker) {
+        if (*link > heap->top_of_heap && *link < heap->end_of_heap)
+            inner = *link;
+        link = &SCOPE_INFO(*link)->enclosing;
+    }
+    if (*link == marker)
+        *link = info->enclosing;
+
+    if (info->outermost) {
+        if (inner != nullptr) {
+            SCOPE_INFO(inner)->outermost = 1;
+            SCOPE_INFO(inner)->outer_prev = prev;
+            SCOPE_INFO(inner)->outer_next = next;
+        }
+        if (prev != nullptr)
+            SCOPE_INFO(prev)->outer_next = inner != nullptr ? inner : next;
+        if (next != nullptr)
+            SCOPE_INFO(next)->outer_prev = inner != nullptr ? inner : prev;
+        else
+            heap->scope_tail = inner != nullptr ? inner : prev;
+    }
+    __atomic_fetch_sub(&heap->open_scopes, 1, __ATOMIC_RELAXED);
+}
+
+/// m61_scope_run_start(marker)
+///    Return the first block of the run of the allocated list that holds
+///    the scopes of `marker`'s thread in the heap: the block behind the
+///    outermost marker preceding the thread's own, or the front of the
+///    list.
+static size_t* m61_scope_run_start(size_t* marker) {
+    size_t* outermost = marker;
+    size_t* outer_prev;
+
+    for (size_t* m = marker; m != nullptr; m = SCOPE_INFO(m)->enclosing) {
+        if (m > heap->top_of_heap && m < heap->end_of_heap)
+            outermost = m;
+    }
+    outer_prev = SCOPE_INFO(outermost)->outer_prev;
+    return outer_prev != nullptr ? LIST_NEXT(outer_prev)->get() : heap->alloc_list_start.get();
+}
+
+/// m61_validate_scope(scope, file, line)
+///    Check that `scope` is the marker of a scope this thread has open.
+static bool m61_validate_scope(m61_scope scope, const char* file, int line) {
+    size_t* header = GET_HEADER_FROM_PAYLOAD(scope);
+    size_t* m = thread_scope;
+
+    if (header <= heap->top_of_heap || header >= heap->end_of_heap
+        || (uintptr_t)scope % ALIGNMENT != 0
+        || !IS_ALLOC(header)
+        || header != GET_HEADER_ADDR(header, heap->top_of_heap.get())
+        || *GET_FILENAME(header) != scope_marker
+        || !m61_validate_block_ptrs(header)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid scope %p, not open\n", file, line, scope);
+        return false;
+    }
+    while (m != nullptr && m != header)
+        m = SCOPE_INFO(m)->enclosing;
+    if (m == nullptr) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid scope %p, opened by another thread\n", file, line, scope);
+        return false;
+    }
+    return true;
+}
+
+/// m61_scope_rollback(scope, file, line)
+///    Free every block this thread allocated in the heap since `scope` was
+///    opened, including those of nested scopes, and close `scope`. Only
+///    this thread's run of the allocated list is visited, each block once.
+void m61_scope_rollback(m61_scope scope, const char* file, int line) {
+    size_t* marker;
+    size_t* next;
+
+    M61_ROUTE_HEAP(scope);
+    M61_LOCK_HEAP();
+    if (scope == nullptr || !m61_validate_scope(scope, file, line))
+        return;
+
+    // blocks held in thread caches are not part of any scope; they are
+    // left in the list and released by their caches
+    marker = GET_HEADER_FROM_PAYLOAD(scope);
+    m61_tcache_flush_all();
+    m61_drain_remote_frees();
+    for (size_t* block = m61_scope_run_start(marker); block != marker; block = next) {
+        next = *LIST_NEXT(block);
+        if (*GET_FILENAME(block) != tcache_marker)
+            m61_release_block(block, file, line);
+    }
+    m61_release_block(marker, file, line);
+}
+
+/// m61_scope_commit(scope, file, line)
+///    Close `scope`, keeping its allocations. They become part of the
+///    enclosing scope, if any. Closing an outermost scope moves the
+///    blocks it kept behind `heap->scope_tail`, out of every run.
+void m61_scope_commit(m61_scope scope, const char* file, int line) {
+    size_t* marker;
+    size_t* first;
+    size_t* last;
+    size_t* tail;
+
+    M61_ROUTE_HEAP(scope);
+    M61_LOCK_HEAP();
+    if (scope == nullptr || !m61_validate_scope(scope, file, line))
+        return;
+
+    marker = GET_HEADER_FROM_PAYLOAD(scope);
+    first = m61_scope_run_start(marker);
+    if (SCOPE_INFO(marker)->outermost && marker != heap->scope_tail && first != marker) {
+        // the thread's scopes still open inside it stay in the run
+        for (size_t* m = thread_scope; m != marker; m = SCOPE_INFO(m)->enclosing) {
+            if (m > heap->top_of_heap && m < heap->end_of_heap)
+                first = *LIST_NEXT(m);
+        }
+        if (first != marker) {
+            last = *LIST_PREV(marker);
+            m61_unstitch_list(LIST_PREV(first), LIST_NEXT(last), &heap->alloc_list_start);
+            tail = heap->scope_tail;
+            SET_LIST_PREV(first, tail);
+            SET_LIST_NEXT(last, *LIST_NEXT(tail));
+            if (*LIST_NEXT(tail) != nullptr)
+                SET_LIST_PREV(*LIST_NEXT(tail), last);
+            SET_LIST_NEXT(tail, first);
+        }
+    }
+    m61_release_block(marker, file, line);
+}
+
+// blocks retired by `m61_retire` wait on the retiring thread's limbo lists
+// until no thread can still be reading them. Time is divided into epochs:
+// a thread inside `m61_epoch_enter`/`m61_epoch_exit` publishes the global
+// epoch it entered in, and the global epoch only advances once every such
+// thread has entered in the current one. A block retired in epoch `e` is
+// therefore unreachable once the global epoch reaches `e + 2`. Each thread
+// keeps one list per epoch modulo 3. Retired blocks leave the allocated
+// list, which frees their LIST_NEXT slot to chain the limbo lists, so
+// retiring a block allocates nothing; they are counted as active until
+// they are freed.
+#define RETIRE_BATCH 64     // retirements between reclamation attempts
+
+struct m61_epoch_record {
+    unsigned long state;            // entered epoch << 1 | 1 while inside
+    unsigned depth;                 // nesting of m61_epoch_enter
+    bool linked;
+    m61_epoch_record* next;
+    size_t* limbo[3];               // retired blocks, chained by LIST_NEXT
+    unsigned long limbo_epoch[3];   // epoch each list was retired in
+    size_t limbo_count[3];
+    size_t reclaim_at;              // retired blocks that trigger m61_epoch_reclaim
+};
+static unsigned long global_epoch = 0;
+static m61_epoch_record* epoch_records = nullptr;   // threads that have entered
+static pthread_mutex_t epoch_records_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t* orphan_limbo = nullptr;      // left by exited threads
+static unsigned long orphan_epoch = 0;
+#if M61_THREADS
+static thread_local m61_epoch_record epoch_record;
+
+/// m61_epoch_record_owner
+///    Hands this thread's retired blocks to the orphan list when the
+///    thread exits.
+struct m61_epoch_record_owner {
+    ~m61_epoch_record_owner();
+};
+static thread_local m61_epoch_record_owner epoch_record_owner;
+#else
+static m61_epoch_record epoch_record;
+#endif
+
+/// m61_epoch_enter()
+///    Enter a critical section: blocks retired from now on by any thread
+///    are not freed until this thread calls `m61_epoch_exit`. Sections
+///    nest.
+void m61_epoch_enter() {
+    if (epoch_record.depth++ != 0)
+        return;
+#if M61_THREADS
+    (void) &epoch_record_owner;     // registers the owner's destructor
+#endif
+    if (!epoch_record.linked) {
+        pthread_mutex_lock(&epoch_records_lock);
+        epoch_record.next = epoch_records;
+        epoch_records = &epoch_record;
+        epoch_record.linked = true;
+        pthread_mutex_unlock(&epoch_records_lock);
+    }
+    // a full barrier, so the section's reads follow the published epoch
+    __atomic_exchange_n(&epoch_record.state, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST) << 1 | 1,
+                        __ATOMIC_SEQ_CST);
+}
+
+/// m61_epoch_exit()
+///    Leave the critical section opened by the matching `m61_epoch_enter`.
+void m61_epoch_exit() {
+    assert(epoch_record.depth != 0);
+    if (--epoch_record.depth == 0)
+        __atomic_store_n(&epoch_record.state, 0, __ATOMIC_RELEASE);
+}
+
+/// m61_epoch_try_advance()
+///    Advance the global epoch if every thread inside a critical section
+///    entered in the current one. Returns the global epoch.
+static unsigned long m61_epoch_try_advance() {
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    unsigned long state;
+
+    pthread_mutex_lock(&epoch_records_lock);
+    for (m61_epoch_record* rec = epoch_records; rec != nullptr; rec = rec->next) {
+        state = __atomic_load_n(&rec->state, __ATOMIC_SEQ_CST);
+        if ((state & 1) != 0 && state >> 1 != epoch) {
+            pthread_mutex_unlock(&epoch_records_lock);
+            return epoch;
+        }
+    }
+    pthread_mutex_unlock(&epoch_records_lock);
+    __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+}
+
+/// m61_release_limbo(list)
+///    Free every retired block on limbo list `list`, each under the lock
+///    of the heap it belongs to.
+static void m61_release_limbo(size_t* list) {
+    size_t* next;
+
+    for (size_t* header = list; header != nullptr; header = next) {
+        next = *LIST_NEXT(header);
+        M61_ROUTE_HEAP(GET_PAYLOAD(header));
+        M61_LOCK_HEAP();
+        m61_release_block(header, "?", 0);
+    }
+}
+
+/// m61_collect_limbo(epoch)
+///    Free this thread's retired blocks, and the orphaned and sampled
+///    ones, that no thread can reach in global epoch `epoch`.
+static void m61_collect_limbo(unsigned long epoch) {
+    size_t* orphans = nullptr;
+
+    m61_release_guarded_limbo(epoch);
+    for (int i = 0; i != 3; ++i) {
+        if (epoch_record.limbo[i] != nullptr && epoch_record.limbo_epoch[i] + 2 <= epoch) {
+            m61_release_limbo(epoch_record.limbo[i]);
+            epoch_record.limbo[i] = nullptr;
+            epoch_record.limbo_count[i] = 0;
+        }
+    }
+
+    if (__atomic_load_n(&orphan_limbo, __ATOMIC_RELAXED) == nullptr)
+        return;
+    pthread_mutex_lock(&epoch_records_lock);
+    if (orphan_limbo != nullptr && orphan_epoch + 2 <= epoch) {
+        orphans = orphan_limbo;
+        orphan_limbo = nullptr;
+    }
+    pthread_mutex_unlock(&epoch_records_lock);
+    m61_release_limbo(orphans);
+}
+
+/// m61_epoch_reclaim()
+///    Try to advance the global epoch, and free the retired blocks that no
+///    thread can still reach. With no thread inside a critical section,
+///    frees every block this thread has retired.
+void m61_epoch_reclaim() {
+    m61_epoch_try_advance();
+    m61_collect_limbo(m61_epoch_try_advance());
+    epoch_record.reclaim_at = epoch_record.limbo_count[0] + epoch_record.limbo_count[1]
+        + epoch_record.limbo_count[2] + RETIRE_BATCH;
+}
+
+/// m61_retire(ptr, file, line)
+///    Retire `ptr` from a lock-free structure: it is validated like a free
+///    at `file`:`line`, then freed once every thread that was inside a
+///    critical section has left it.
+void m61_retire(void* ptr, const char* file, int line) {
+    size_t* header;
+    unsigned long epoch;
+    int slot;
+
+    if (ptr == nullptr)
+        return;
+    if (m61_is_guarded(ptr)) {
+        m61_guarded_retire(ptr, file, line);
+        return;
+    }
+    {
+        M61_ROUTE_HEAP(ptr);
+        M61_LOCK_HEAP();
+        if (!m61_validate_free(ptr, file, line))
+            return;
+        header = GET_HEADER_FROM_PAYLOAD(ptr);
+        m61_unstitch_list(LIST_PREV(header), LIST_NEXT(header), &heap->alloc_list_start);
+        SET_LIST_PREV(header, nullptr);
+        GET_FILENAME(header)->store(retired_marker);
+    }
+#if M61_THREADS
+    (void) &epoch_record_owner;
+#endif
+
+    // lists from epoch - 3 share this slot; collecting frees them first
+    epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    slot = epoch % 3;
+    if (epoch_record.limbo[slot] != nullptr && epoch_record.limbo_epoch[slot] != epoch)
+        m61_collect_limbo(epoch);
+    SET_LIST_NEXT(header, epoch_record.limbo[slot]);
+    epoch_record.limbo[slot] = header;
+    epoch_record.limbo_epoch[slot] = epoch;
+    ++epoch_record.limbo_count[slot];
+    if (epoch_record.limbo_count[0] + epoch_record.limbo_count[1] + epoch_record.limbo_count[2]
+        >= std::max(epoch_record.reclaim_at, (size_t) RETIRE_BATCH))
+        m61_epoch_reclaim();
+}
+
+#if M61_THREADS
+m61_epoch_record_owner::~m61_epoch_record_owner() {
+    size_t* tail;
+
+    if (epoch_record.linked) {
+        pthread_mutex_lock(&epoch_records_lock);
+        for (m61_epoch_record** link = &epoch_records; *link != nullptr; link = &(*link)->next) {
+            if (*link == &epoch_record) {
+                *link = epoch_record.next;
+                break;
+            }
+        }
+        epoch_record.linked = false;
+        pthread_mutex_unlock(&epoch_records_lock);
+    }
+    m61_epoch_reclaim();
+
+    // whatever is still reachable waits for the current epoch to pass
+    pthread_mutex_lock(&epoch_records_lock);
+    for (int i = 0; i != 3; ++i) {
+        if (epoch_record.limbo[i] == nullptr)
+            continue;
+        for (tail = epoch_record.limbo[i]; *LIST_NEXT(tail) != nullptr; tail = *LIST_NEXT(tail)) {
+        }
+        SET_LIST_NEXT(tail, orphan_limbo);
+        orphan_limbo = epoch_record.limbo[i];
+        orphan_epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+        epoch_record.limbo[i] = nullptr;
+    }
+    pthread_mutex_unlock(&epoch_records_lock);
+}
+#endif
+
+
+// relocatable objects. Handles are records in chunks mapped outside the
+// heaps, so a handle never moves and never fragments a heap. The block of
+// a relocatable object carries MOVABLE_BIT and starts with a pointer back
+// to its handle; the object follows, ALIGNMENT bytes into the payload.
+// The compactor, holding the heap lock, claims a handle by swapping its
+// lock count from 0 to HANDLE_MOVING, which `m61_hlock` waits out.
+#define HANDLE_CHUNK  1024
+#define HANDLE_MOVING UINT_MAX
+
+struct m61_handle_rec {
+    void* object;               // nullptr while the record is unused
+    m61_heap* heap;             // the heap holding the object
+    unsigned locks;
+    m61_handle_rec* next_free;
+};
+
+struct m61_handle_chunk {
+    m61_handle_chunk* next;
+    m61_handle_rec recs[HANDLE_CHUNK];
+};
+static m61_handle_chunk* handle_chunks = nullptr;
+static m61_handle_rec* free_handles = nullptr;
+static pthread_mutex_t handles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// m61_new_handle()
+///    Return an unused handle record, or nullptr if none can be mapped.
+static m61_handle m61_new_handle() {
+    m61_handle_chunk* chunk;
+    m61_handle h;
+    void* buf;
+
+    pthread_mutex_lock(&handles_lock);
+    if (free_handles == nullptr) {
+        buf = mmap(nullptr, sizeof(m61_handle_chunk), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (buf != MAP_FAILED) {
+            chunk = (m61_handle_chunk*) buf;
+            chunk->next = handle_chunks;
+            handle_chunks = chunk;
+            for (size_t i = HANDLE_CHUNK; i-- != 0; ) {
+                chunk->recs[i].next_free = free_handles;
+                free_handles = &chunk->recs[i];
+            }
+        }
+    }
+    if ((h = free_handles) != nullptr)
+        free_handles = h->next_free;
+    pthread_mutex_unlock(&handles_lock);
+    return h;
+}
+
+/// m61_delete_handle(h)
+///    Return handle record `h` to the unused records.
+static void m61_delete_handle(m61_handle h) {
+    pthread_mutex_lock(&handles_lock);
+    __atomic_store_n(&h->object, nullptr, __ATOMIC_RELAXED);
+    h->next_free = free_handles;
+    free_handles = h;
+    pthread_mutex_unlock(&handles_lock);
+}
+
+/// m61_is_handle(h)
+///    Return true if `h` points at a handle record.
+static bool m61_is_handle(m61_handle h) {
+    bool found = false;
+
+    pthread_mutex_lock(&handles_lock);
+    for (m61_handle_chunk* chunk = handle_chunks; chunk != nullptr && !found; chunk = chunk->next) {
+        found = h >= chunk->recs && h < chunk->recs + HANDLE_CHUNK
+            && ((uintptr_t) h - (uintptr_t) chunk->recs) % sizeof(m61_handle_rec) == 0;
+    }
+    pthread_mutex_unlock(&handles_lock);
+    return found;
+}
+
+/// m61_halloc(sz, file, line)
+///    Allocate a block for a relocatable object of `sz` bytes and a
+///    handle for it.
+m61_handle m61_halloc(size_t sz, const char* file, int line) {
+    m61_handle h;
+    char* payload;
+
+    if (sz > SIZE_MAX - ALIGNMENT || (h = m61_new_handle()) == nullptr)
+        return nullptr;
+    if ((payload = (char*) m61_malloc_in_heap(sz + ALIGNMENT, file, line)) == nullptr) {
+        m61_delete_handle(h);
+        return nullptr;
+    }
+
+    *(m61_handle*) payload = h;
+    h->locks = 0;
+    __atomic_store_n(&h->object, payload + ALIGNMENT, __ATOMIC_RELAXED);
+    M61_ROUTE_HEAP(payload);
+    M61_LOCK_HEAP();
+    h->heap = heap;
+    SET_MOVABLE(GET_HEADER_FROM_PAYLOAD(payload));
+    return h;
+}
+
+/// m61_hlock(h)
+///    Add a lock to `h`, waiting while the compactor moves its object.
+void* m61_hlock(m61_handle h) {
+    unsigned locks = __atomic_load_n(&h->locks, __ATOMIC_RELAXED);
+
+    do {
+        while (locks == HANDLE_MOVING) {
+            sched_yield();
+            locks = __atomic_load_n(&h->locks, __ATOMIC_RELAXED);
+        }
+    } while (!__atomic_compare_exchange_n(&h->locks, &locks, locks + 1, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    return __atomic_load_n(&h->object, __ATOMIC_RELAXED);
+}
+
+/// m61_hunlock(h, file, line)
+///    Remove a lock from `h`.
+void m61_hunlock(m61_handle h, const char* file, int line) {
+    unsigned locks = __atomic_load_n(&h->locks, __ATOMIC_RELAXED);
+
+    do {
+        if (locks == 0 || locks == HANDLE_MOVING) {
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid unlock of handle %p, not locked\n", file, line, h);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&h->locks, &locks, locks - 1, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/// m61_hfree(h, file, line)
+///    Free the object of `h` under its heap's lock, so it cannot move
+///    meanwhile, then the handle.
+void m61_hfree(m61_handle h, const char* file, int line) {
+    m61_heap* prev_heap = heap;
+    size_t* header;
+    bool locked;
+
+    if (h == nullptr)
+        return;
+    if (!m61_is_handle(h) || __atomic_load_n(&h->object, __ATOMIC_RELAXED) == nullptr) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of handle %p, not allocated\n", file, line, h);
+        return;
+    }
+
+    heap = h->heap;
+    {
+        M61_LOCK_HEAP();
+        locked = __atomic_load_n(&h->locks, __ATOMIC_RELAXED) != 0;
+        if (!locked) {
+            header = GET_HEADER_FROM_PAYLOAD((char*) h->object - ALIGNMENT);
+            SET_HEADER_ADDR(header, heap->top_of_heap.get(), header, GET_TAG(header));  // no longer movable
+            m61_free(GET_PAYLOAD(header), file, line);
+        }
+    }
+    heap = prev_heap;
+
+    if (locked)
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of handle %p, locked\n", file, line, h);
+    else
+        m61_delete_handle(h);
+}
+
+/// m61_claim_handle(header)
+///    Return the handle of movable block `header` with its lock count set
+///    to HANDLE_MOVING, or nullptr if the handle is locked or does not
+///    point back at the block.
+static m61_handle m61_claim_handle(size_t* header) {
+    char* payload = (char*) GET_PAYLOAD(header);
+    m61_handle h = *(m61_handle*) payload;
+    unsigned unlocked = 0;
+
+    if (!m61_is_handle(h) || __atomic_load_n(&h->object, __ATOMIC_RELAXED) != payload + ALIGNMENT
+        || !__atomic_compare_exchange_n(&h->locks, &unlocked, HANDLE_MOVING, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return nullptr;
+    return h;
+}
+
+/// m61_slide_block(free_block, header, h)
+///    Move allocated block `header`, whose handle `h` has been claimed,
+///    down to the start of the free block just before it, and free the
+///    space it leaves behind, merging it with the block after. Returns
+///    that free block. The caller holds the heap lock.
+static size_t* m61_slide_block(size_t* free_block, size_t* header, m61_handle h) {
+    size_t size = GET_SIZE(header);
+    size_t free_size = GET_SIZE(free_block);
+    bool next_alloc = IS_NEXT_ALLOC(header);
+    size_t* prev_alloc_block = *LIST_PREV(header);
+    size_t* next_alloc_block = *LIST_NEXT(header);
+    const char* file = *GET_FILENAME(header);
+    unsigned tag = GET_TAG(header);
+    size_t* rest;
+
+    m61_unstitch_list(LIST_PREV(free_block), LIST_NEXT(free_block), &heap->free_list_start);
+    memmove(free_block, header, size);      // the metadata moves with the footer,
+    header = free_block;                    // but its relative pointers must be reset
+
+    // the block before was allocated, as free blocks never neighbor
+    m61_set_header_and_footer(header, size, ALLOC_BIT | PREV_ALLOC_BIT | NEXT_ALLOC_BIT);
+    TOGGLE_PREV_BITS(header, NEXT_ALLOC_BIT);
+    SET_FILENAME(header, file);
+    SET_HEADER_ADDR(header, heap->top_of_heap.get(), header, tag);
+    SET_MOVABLE(header);
+    SET_LIST_PREV(header, prev_alloc_block);
+    SET_LIST_NEXT(header, next_alloc_block);
+    if (prev_alloc_block != nullptr)
+        SET_LIST_NEXT(prev_alloc_block, header);
+    else
+        heap->alloc_list_start = header;
+    if (next_alloc_block != nullptr)
+        SET_LIST_PREV(next_alloc_block, header);
+
+    // free the space left behind as if it were an allocated block
+    rest = INCREMENT_SIZE_T_PTR(header, size);
+    m61_set_header_and_footer(rest, free_size, ALLOC_BIT | PREV_ALLOC_BIT | (next_alloc ? NEXT_ALLOC_BIT : 0));
+    rest = m61_coalesce(rest);
+
+    m61_record_heap_bounds((uintptr_t) GET_PAYLOAD(header),
+                           (uintptr_t) GET_PAYLOAD(header) + *REQ_SIZE_FROM_HEADER(header));
+    __atomic_store_n(&h->object, (char*) GET_PAYLOAD(header) + ALIGNMENT, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->locks, 0, __ATOMIC_RELEASE);
+    return rest;
+}
+
+/// m61_compact_heap(budget)
+///    Walk `heap` in address order, sliding each unlocked movable block
+///    that follows a free block down into it, until `budget` bytes have
+///    been moved. A slid block leaves a free block behind that merges with
+///    the next free space, so runs of movable blocks slide together.
+///    Returns the number of bytes moved. The caller holds the heap lock.
+static size_t m61_compact_heap(size_t budget) {
+    size_t moved = 0;
+    size_t* block = NEXT_FROM_HEADER(heap->top_of_heap);
+    size_t* next;
+    m61_handle h;
+
+    while (block != heap->end_of_heap && moved < budget) {
+        next = NEXT_FROM_HEADER(block);
+        if (!IS_ALLOC(block) && next != heap->end_of_heap && IS_ALLOC(next) && IS_MOVABLE(next)
+            && (h = m61_claim_handle(next)) != nullptr) {
+            moved += GET_SIZE(next);
+            block = m61_slide_block(block, next, h);
+        } else {
+            block = next;
+        }
+    }
+    return moved;
+}
+
+/// m61_compact(budget)
+///    Compact every heap the leak report covers, after returning the
+///    blocks held by caches, until `budget` bytes have been moved.
+size_t m61_compact(size_t budget) {
+    m61_heap* prev_heap = heap;
+    m61_heap* first;
+    m61_heap* last;
+    size_t moved = 0;
 
-    assert(header != list);                // we are not double-pushing a block
+    m61_heap_range(&first, &last);
+    for (heap = first; heap != last && moved < budget; ++heap) {
+        M61_LOCK_HEAP();
+        m61_tcache_flush_all();
+        m61_drain_remote_frees();
+        moved += m61_compact_heap(budget - moved);
+    }
+    heap = prev_heap;
+    return moved;
+}
 
-    if (list == free_list_start)
-        assert(!IS_ALLOC(header));         // only push free blocks to free list
-    else
-        assert(IS_ALLOC(header));          // only push alloc blocks to alloc list
+/// m61_get_fragmentation()
+///    Sum up the free lists of every heap the leak report covers.
+m61_fragmentation m61_get_fragmentation() {
+    m61_heap* prev_heap = heap;
+    m61_heap* first;
+    m61_heap* last;
+    m61_fragmentation frag = {0, 0, 0, 0};
 
-    if (prev_front == nullptr) {
-        SET_LIST_NEXT(header, nullptr);     // because list pointers are stored at the same offset
-    } else {                                // from the footer, we can manipulate list pointers of
-        SET_LIST_NEXT(header, prev_front);  // allocated & free blocks interchangeably
-        SET_LIST_PREV(prev_front, header);
+    m61_heap_range(&first, &last);
+    for (heap = first; heap != last; ++heap) {
+        M61_LOCK_HEAP();
+        for (size_t* block = heap->free_list_start; block != nullptr; block = *LIST_NEXT(block)) {
+            frag.free_size += GET_SIZE(block);
+            frag.largest_free = std::max(frag.largest_free, (size_t) GET_SIZE(block));
+            ++frag.nfree_blocks;
+        }
     }
+    heap = prev_heap;
+    if (frag.free_size != 0)
+        frag.ratio = 1 - (double) frag.largest_free / frag.free_size;
+    return frag;
+}
 
-    SET_LIST_PREV(header, nullptr);
-    
-    if (list == free_list_start) {
-        free_list_start = header;
-    } else {
-        alloc_list_start = header;
-    }
+
+// sampled allocations. About one in `sample_rate` allocations of up to a
+// page goes to a guarded slot instead of the heap. The slots are pages of
+// one mapping, each between two guard pages:
+//     guard | slot 0 | guard | slot 1 | guard | ... | slot N-1 | guard
+// A slot is accessible only while it holds an object, which ends at the
+// end of the page, so an overflow faults at the first access past the
+// page and any access after the free faults too. The rest of the page is
+// filled with GUARDED_FILL and checked on free, which catches the writes
+// that stay inside the page. The records of the slots, with the sites
+// that allocated and freed each object, live outside the mapping; the
+// SIGSEGV handler reports faults in the mapping from them. Slots are
+// taken in round-robin order, so a freed slot stays inaccessible for as
+// long as possible.
+#ifndef M61_GUARDED_SLOTS
+#define M61_GUARDED_SLOTS 64
+#endif
+#define GUARDED_FILL 0xa5
+
+#define GUARDED_UNUSED    0     // never held an object
+#define GUARDED_ALLOCATED 1
+#define GUARDED_FREED     2
+#define GUARDED_RETIRED   3     // waiting for the epoch to free it
+
+struct m61_guarded_slot {
+    char* ptr;                  // the object, or the last one
+    size_t size;
+    const char* file;           // where the object was allocated
+    int line;
+    const char* free_file;      // and where it was freed or retired
+    int free_line;
+    unsigned state;
+    unsigned long retire_epoch;
+    m61_guarded_slot* next_retired;
+};
+
+static char* guarded_pool = nullptr;        // the mapping, from the first guard page
+static char* guarded_pool_end = nullptr;
+static size_t guarded_page = 0;
+static m61_guarded_slot guarded_slots[M61_GUARDED_SLOTS];
+static size_t guarded_cursor = 0;           // the next slot to try
+static m61_guarded_slot* guarded_limbo = nullptr;
+static pthread_mutex_t guarded_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t guarded_once = PTHREAD_ONCE_INIT;
+static struct sigaction prev_segv_action;
+static unsigned sample_rate = 0;
+static thread_local unsigned sample_countdown = 0;
+static thread_local unsigned sample_seed = 0;
+static unsigned sample_seeds = 0;           // spreads the threads' first seeds
+
+/// m61_is_guarded(ptr)
+///    Return true if `ptr` points into the guarded slots.
+static inline bool m61_is_guarded(void* ptr) {
+    return (char*) ptr >= __atomic_load_n(&guarded_pool, __ATOMIC_RELAXED)
+        && (char*) ptr < __atomic_load_n(&guarded_pool_end, __ATOMIC_RELAXED);
 }
 
-/// set_footer_magic_number(header, sz)
-///    Places the magic number immediately following the region
-///    allocated to the user for a given block (header + 2 words + payload size).
-///
-///    Footer magic number must be set byte-by-byte so the sanitizer
-///    is not triggered by setting a size_t from at an invalidly-aligned address.
-inline void set_footer_magic_number(size_t* header, size_t sz) {
-    char* footer_magic_number = (char*)(header + 1) + sz;
-    for (size_t i = 0; i < 8; i++) {
-        footer_magic_number[i] = magic_number[i];
-    }
+/// m61_guarded_page(slot)
+///    Return the page of `slot`.
+static inline char* m61_guarded_page(m61_guarded_slot* slot) {
+    return guarded_pool + (2 * (slot - guarded_slots) + 1) * guarded_page;
 }
 
-/// check_footer_magic_number(header, sz)
-///    Checks the magic number immediately following the region
-///    allocated to the user for a given block (header + 2 words + payload size).
-///
-///    Footer magic number must be read byte-by-byte so the sanitizer
-///    is not triggered by reading a size_t from an invalidly-aligned address.
-inline bool check_footer_magic_number(size_t* header, size_t sz) {
-    char* footer_magic_number = (char*)(header + 1) + sz;
-    for (size_t i = 0; i < 8; i++) {
-        if (footer_magic_number[i] != magic_number[i])
-            return false;
-    }
-    return true;
+/// m61_guarded_slot_for(addr)
+///    Return the slot whose page holds `addr`, a guarded address, or
+///    nullptr if `addr` is in a guard page.
+static m61_guarded_slot* m61_guarded_slot_for(void* addr) {
+    size_t index = ((char*) addr - guarded_pool) / guarded_page;
+
+    return index % 2 == 1 ? &guarded_slots[index / 2] : nullptr;
 }
 
+/// m61_sample_draw(rate)
+///    Return a random number of allocations, from 1 to `2 * rate - 1`, for
+///    this thread to count down before its next sample.
+static inline unsigned m61_sample_draw(unsigned rate) {
+    unsigned x = sample_seed;
 
-/// m61_calloc(count, sz, file, line)
-///    Returns a pointer a fresh dynamic memory allocation big enough to
-///    hold an array of `count` elements of `sz` bytes each. Returned
-///    memory is initialized to zero. The allocation request was at
-///    location `file`:`line`. Returns `nullptr` if out of memory; may
-///    also return `nullptr` if `count == 0` or `size == 0`.
-void* m61_calloc(size_t count, size_t sz, const char* file, int line) {
-    void* ptr;
+    x ^= x << 13;       // xorshift
+    x ^= x >> 17;
+    x ^= x << 5;
+    sample_seed = x;
+    return 1 + x % (2 * (unsigned long long) rate - 1);
+}
 
-    if (count == 0)
-        return nullptr;
+/// m61_sample_allocation(sz)
+///    Return true if an allocation of `sz` bytes should be sampled. Each
+///    thread counts down a random number of allocations that averages
+///    `sample_rate`, drawn the first time it gets here, so threads that
+///    allocate only a few times are sampled no more than others.
+static inline bool m61_sample_allocation(size_t sz) {
+    unsigned rate = __atomic_load_n(&sample_rate, __ATOMIC_ACQUIRE);
 
-    // detect unsigned overflow
-    if (sz > SIZE_MAX / count) {
-        statistics.nfail += 1;
-        statistics.fail_size += sz;
-        return nullptr;
+    if (__builtin_expect(rate == 0, true) || sz > guarded_page)
+        return false;
+    if (sample_seed == 0) {
+        sample_seed = ((unsigned) (uintptr_t) &sample_seed
+                       ^ __atomic_add_fetch(&sample_seeds, 0x9e3779b9U, __ATOMIC_RELAXED)) | 1;
+        sample_countdown = m61_sample_draw(rate);
     }
-
-    ptr = m61_malloc(count * sz, file, line);
-    if (ptr) {
-        memset(ptr, 0, count * sz);
+    if (sample_countdown > 1) {
+        --sample_countdown;
+        return false;
     }
-    return ptr;
+    sample_countdown = m61_sample_draw(rate);
+    return true;
 }
 
-/// m61_realloc(ptr, sz, file, line)
-///    Changes the size of the dynamic allocation pointed to by `ptr`
-///    to hold at least `sz` bytes. If the existing allocation cannot be
-///    enlarged, this function makes a new allocation, copies as much data
-///    as possible from the old allocation to the new, and returns a pointer
-///    to the new allocation. If `ptr` is `nullptr`, behaves like
-///    `m61_malloc(sz, file, line). `sz` must not be 0. If a required
-///    allocation fails, returns `nullptr` without freeing the original
-///    block.
-void* m61_realloc(void* ptr, size_t new_size, const char* file, int line) {
-    void* new_payload = nullptr;
-    size_t* old_header;
-    size_t* new_free_header;
-    size_t* new_header;
-    size_t* prev;
-    size_t* next;
-    size_t prev_avail;
-    size_t next_avail;
-    size_t old_size;
-    size_t old_req_size;
-    size_t asize;
-    size_t new_free_size;
-    unsigned int new_bits;
-    unsigned int next_new_bits;
-    bool is_next_alloc;
+/// m61_fault_message
+///    A report built in a buffer on the stack and written with one
+///    write(2). The SIGSEGV handler cannot use stdio, which may hold its
+///    own locks or be halfway through a buffer when the fault arrives.
+struct m61_fault_message {
+    char buf[1024];
+    size_t len = 0;
 
-    if (ptr == nullptr)
-        return m61_malloc(new_size, file, line);
+    m61_fault_message& str(const char* s) {
+        for (s = s ? s : "(null)"; *s != '\0' && len != sizeof(buf); ++s)
+            buf[len++] = *s;
+        return *this;
+    }
+    m61_fault_message& num(long long n) {
+        char digits[24];
+        size_t i = sizeof(digits);
+        unsigned long long u = n < 0 ? 0ULL - n : n;
 
-    if (new_size == 0)
-        return nullptr;
+        digits[--i] = '\0';
+        do {
+            digits[--i] = '0' + u % 10;
+        } while ((u /= 10) != 0);
+        if (n < 0)
+            digits[--i] = '-';
+        return str(&digits[i]);
+    }
+    m61_fault_message& ptr(const void* p) {
+        char digits[24];
+        size_t i = sizeof(digits);
+        uintptr_t u = (uintptr_t) p;
 
-    // detect unsigned integer overflow
-    if (new_size > SIZE_MAX - ALIGNMENT) {
-        goto fail;
+        if (p == nullptr)
+            return str("(nil)");
+        digits[--i] = '\0';
+        do {
+            digits[--i] = "0123456789abcdef"[u % 16];
+        } while ((u /= 16) != 0);
+        digits[--i] = 'x';
+        digits[--i] = '0';
+        return str(&digits[i]);
     }
+    void write() {
+        ssize_t n;
+        for (size_t off = 0; off != len; off += n)
+            if ((n = ::write(STDERR_FILENO, buf + off, len - off)) <= 0)
+                return;
+    }
+};
 
-    asize = m61_get_adjusted_size(new_size);
-    
-    if (m61_validate_free(ptr, file, line)) {
+/// m61_report_guarded_fault(addr)
+///    Report an access to guarded address `addr` that faulted. Runs in the
+///    signal handler, so the report is written with `m61_fault_message`.
+static void m61_report_guarded_fault(char* addr) {
+    m61_guarded_slot* slot = m61_guarded_slot_for(addr);
+    m61_guarded_slot* after;
+    m61_fault_message msg;
+    size_t index;
 
-        old_header = GET_HEADER_FROM_PAYLOAD(ptr);
-        old_req_size = *REQ_SIZE_FROM_HEADER(old_header);
-        old_size = GET_SIZE(old_header);
-        prev = PREV_FROM_HEADER(old_header);
-        next = NEXT_FROM_HEADER(old_header);
-        prev_avail = (IS_PREV_ALLOC(old_header) ? 0 : GET_SIZE(prev));
-        next_avail = (IS_NEXT_ALLOC(old_header) ? 0 : GET_SIZE(next));
-
-        if (new_size > old_req_size) {  // expanding the allocation
-
-            // sufficient space by coalescing with previous block
-            if ((prev_avail + old_size >= asize) && (prev_avail - (asize - old_size) >= MIN_BLOCK)) {
-
-                m61_unstitch_list(LIST_PREV(old_header), LIST_NEXT(old_header), &alloc_list_start); // remove alloc block from alloc list
-                new_free_size = prev_avail - (asize - old_size);
-                next_new_bits = GET_BITS(prev); // save the bits of the previous block for re-creating it
-                new_bits = ALLOC_BIT;
-                if (IS_ALLOC(next))
-                    new_bits |= NEXT_ALLOC_BIT;
-                new_free_header = m61_coalesce_prev(old_header, prev);  // shrink free block
-                m61_set_header_and_footer(new_free_header, new_free_size, next_new_bits);
-                new_header = NEXT_FROM_HEADER(new_free_header);        
-                m61_set_header_and_footer(new_header, asize, new_bits); // create new alloc block
-                new_payload = GET_PAYLOAD(new_header);
-                memcpy(new_payload, ptr, old_req_size);                 // copy the data
-                m61_push_to_front(new_free_header, free_list_start);    // push shrunken free block to front of free list
-
-            // sufficient space by coalescing with next block
-            } else if ((next_avail + old_size >= asize) && (next_avail - (asize - old_size) >= MIN_BLOCK)) {
-
-                m61_unstitch_list(LIST_PREV(old_header), LIST_NEXT(old_header), &alloc_list_start); // remove alloc block from alloc list
-                new_free_size = next_avail - (asize - old_size);
-                new_bits = ALLOC_BIT;
-                next_new_bits = GET_BITS(next); // save the bits of the next block for re-creating it
-                if (IS_ALLOC(prev))
-                    new_bits |= PREV_ALLOC_BIT;
-                new_header = m61_coalesce_next(old_header, next);       // shrink free block
-                m61_set_header_and_footer(new_header, asize, new_bits); // create new alloc block
-                m61_set_header_and_footer(NEXT_FROM_HEADER(new_header), new_free_size, next_new_bits);
-                new_payload = GET_PAYLOAD(new_header);
-                m61_push_to_front(NEXT_FROM_HEADER(new_header), free_list_start); // push shrunken free block to front of free list
-                // memcpy is unnecessary
-
-            // sufficient space by using the entire previous block and some of next block
-            } else if ((prev_avail + next_avail + old_size >= asize) && (next_avail - (asize - old_size - prev_avail) >= MIN_BLOCK)) {
-
-                m61_unstitch_list(LIST_PREV(old_header), LIST_NEXT(old_header), &alloc_list_start); // remove alloc block from alloc list
-                new_free_size = next_avail - (asize - old_size - prev_avail);
-                new_bits = ALLOC_BIT | PREV_ALLOC_BIT;
-                next_new_bits = GET_BITS(next);                         // save the bits of next block to re-create
-                new_header = m61_coalesce_prev(old_header, prev);       // coalesce the block in both directions
-                new_header = m61_coalesce_next(new_header, next);
-                m61_set_header_and_footer(new_header, asize, new_bits); // create new allocated block
-                m61_set_header_and_footer(NEXT_FROM_HEADER(new_header), new_free_size, next_new_bits); // new free block
-                new_payload = GET_PAYLOAD(new_header);
-                memcpy(new_payload, ptr, old_req_size);                 // copy the data
-                TOGGLE_PREV_BITS(new_header, NEXT_ALLOC_BIT);           // tell the previous block that the next block is now allocated
-                m61_push_to_front(NEXT_FROM_HEADER(new_header), free_list_start);
-
-            // no space for the new block here, just free and make a new allocation
-            } else {
+    msg.str("MEMORY BUG: invalid access at ").ptr(addr);
+    if (slot != nullptr && (slot->state == GUARDED_FREED || slot->state == GUARDED_RETIRED)) {
+        msg.str(", ").num(addr - slot->ptr).str(" bytes into a freed ").num(slot->size).str(" byte region\n\t")
+            .str(slot->file).str(":").num(slot->line).str(": region ").ptr(slot->ptr).str(" allocated here\n\t")
+            .str(slot->free_file).str(":").num(slot->free_line).str(": and freed here\n")
+            .write();
+        return;
+    }
+    if (slot == nullptr) {
+        // a guard page: blame the object that ends before it or starts after it
+        index = (addr - guarded_pool) / guarded_page / 2;
+        slot = index != 0 && guarded_slots[index - 1].state == GUARDED_ALLOCATED
+            ? &guarded_slots[index - 1] : nullptr;
+        after = index != M61_GUARDED_SLOTS && guarded_slots[index].state == GUARDED_ALLOCATED
+            ? &guarded_slots[index] : nullptr;
+        if (after != nullptr && (slot == nullptr || after->ptr - addr < addr - (slot->ptr + slot->size))) {
+            msg.str(", ").num(after->ptr - addr).str(" bytes before a ").num(after->size).str(" byte region\n\t")
+                .str(after->file).str(":").num(after->line).str(": region ").ptr(after->ptr).str(" allocated here\n")
+                .write();
+            return;
+        }
+        if (slot != nullptr) {
+            msg.str(", ").num(addr - (slot->ptr + slot->size)).str(" bytes past the end of a ").num(slot->size)
+                .str(" byte region\n\t")
+                .str(slot->file).str(":").num(slot->line).str(": region ").ptr(slot->ptr).str(" allocated here\n")
+                .write();
+            return;
+        }
+    }
+    msg.str(", outside any sampled region\n").write();
+}
 
-                new_payload = m61_malloc(new_size, file, line);
-                memcpy(new_payload, ptr, old_req_size);
-                m61_free(ptr, file, line);
-                return new_payload;
-                
-            }
+/// m61_guarded_fault(sig, info, context)
+///    The SIGSEGV handler: reports faults in the guarded slots, then puts
+///    the previous handler back, which gets the fault when the access is
+///    retried. Other faults are passed on to the previous handler.
+static void m61_guarded_fault(int sig, siginfo_t* info, void* context) {
+    char* addr = (char*) info->si_addr;
+
+    if (addr >= guarded_pool && addr < guarded_pool_end)
+        m61_report_guarded_fault(addr);
+    else if ((prev_segv_action.sa_flags & SA_SIGINFO) != 0) {
+        prev_segv_action.sa_sigaction(sig, info, context);
+        return;
+    } else if (prev_segv_action.sa_handler != SIG_DFL && prev_segv_action.sa_handler != SIG_IGN) {
+        prev_segv_action.sa_handler(sig);
+        return;
+    }
+    sigaction(SIGSEGV, &prev_segv_action, nullptr);
+}
 
-            m61_record_free(old_req_size);
-
-        } else if (new_size < old_size) { // contracting the allocation
-
-            // if we shrink the block enough to create a new block, create the new free block
-            if (old_size - asize >= MIN_BLOCK) {
-
-                is_next_alloc = IS_ALLOC(next);
-                new_free_size = old_size - asize;
-                new_bits = ALLOC_BIT;
-                if (IS_ALLOC(prev))
-                    new_bits |= PREV_ALLOC_BIT;
-                m61_set_header_and_footer(old_header, asize, new_bits);
-                next = NEXT_FROM_HEADER(old_header);
-                next_new_bits = PREV_ALLOC_BIT;
-                if (is_next_alloc)
-                    next_new_bits |= NEXT_ALLOC_BIT;
-                m61_set_header_and_footer(next, new_free_size, next_new_bits);
-                if (!is_next_alloc) {
-                    m61_coalesce(next);
-                }
-                m61_set_header_and_footer(old_header, asize, new_bits);
-
-                // this block is already in the allocated list, 
-                // so we do the bookkeeping and return early
-                m61_set_alloc_metadata(GET_HEADER_FROM_PAYLOAD(ptr), new_size, file, line);
-                m61_record_free(new_free_size);
-                return ptr;
+/// m61_guarded_init()
+///    Map the guarded slots, all inaccessible, and install the SIGSEGV
+///    handler.
+static void m61_guarded_init() {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (2 * M61_GUARDED_SLOTS + 1) * page;
+    struct sigaction action;
+    void* buf = mmap(nullptr, size, PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
 
-            }
+    if (buf == MAP_FAILED)
+        return;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = m61_guarded_fault;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &prev_segv_action);
 
-            // otherwise, do nothing
-            return ptr;
+    guarded_page = page;
+    __atomic_store_n(&guarded_pool_end, (char*) buf + size, __ATOMIC_RELAXED);
+    __atomic_store_n(&guarded_pool, (char*) buf, __ATOMIC_RELEASE);
+}
 
-        // new_size was identical to existing size
-        } else {
-            return ptr;
-        }
-    } else {
-        return nullptr; // on failure, returns nullptr; original ptr should remain valid
+/// m61_set_sample_rate(rate)
+///    Sample about one in `rate` allocations, mapping the guarded slots
+///    the first time sampling is turned on.
+void m61_set_sample_rate(unsigned rate) {
+    if (rate != 0) {
+        pthread_once(&guarded_once, m61_guarded_init);
+        if (__atomic_load_n(&guarded_pool, __ATOMIC_ACQUIRE) == nullptr)
+            rate = 0;       // the slots could not be mapped
     }
+    __atomic_store_n(&sample_rate, rate, __ATOMIC_RELEASE);
+}
 
-    // the pointer has been assigned previously in the function
-    assert(new_payload != nullptr);
-
-    m61_set_alloc_metadata(GET_HEADER_FROM_PAYLOAD(new_payload), new_size, file, line);
-    m61_push_to_front(GET_HEADER_FROM_PAYLOAD(new_payload), alloc_list_start);
-    m61_record_malloc(GET_HEADER_FROM_PAYLOAD(new_payload), new_size);
+/// m61_guarded_alloc(sz, file, line)
+///    Place an object of `sz` bytes, at most a page, in a guarded slot.
+///    Returns nullptr if every slot is taken, or if `heap` must hold the
+///    allocation: a scope is open or the heap is not the default heap.
+static void* m61_guarded_alloc(size_t sz, const char* file, int line) {
+    m61_guarded_slot* slot = nullptr;
+    m61_guarded_slot* s;
+    char* page;
 
-    // the new block we created is of the correct size
-    assert(*REQ_SIZE_FROM_PAYLOAD(new_payload) == new_size);
+    if (!m61_is_heap_arena(heap) || __atomic_load_n(&heap->open_scopes, __ATOMIC_RELAXED) != 0)
+        return nullptr;
 
-    return new_payload;
+    pthread_mutex_lock(&guarded_lock);
+    for (size_t n = 0; n != M61_GUARDED_SLOTS && slot == nullptr; ++n) {
+        s = &guarded_slots[guarded_cursor];
+        guarded_cursor = (guarded_cursor + 1) % M61_GUARDED_SLOTS;
+        if (s->state == GUARDED_UNUSED || s->state == GUARDED_FREED)
+            slot = s;
+    }
+    if (slot != nullptr) {
+        page = m61_guarded_page(slot);
+        if (mprotect(page, guarded_page, PROT_READ | PROT_WRITE) == 0) {
+            memset(page, GUARDED_FILL, guarded_page);
+            slot->ptr = page + guarded_page - ALIGN_UP(sz);
+            slot->size = sz;
+            slot->file = file;
+            slot->line = line;
+            slot->state = GUARDED_ALLOCATED;
+        } else {
+            slot = nullptr;
+        }
+    }
+    pthread_mutex_unlock(&guarded_lock);
+    if (slot == nullptr)
+        return nullptr;
 
-fail:
-    statistics.nfail += 1;
-    statistics.fail_size += new_size;
-    return nullptr;
+    STAT_ADD(ntotal, 1);
+    STAT_ADD(nactive, 1);
+    STAT_ADD(active_size, sz);
+    STAT_ADD(total_size, sz);
+    STAT_ADD(nsampled, 1);
+    return slot->ptr;
 }
 
-/// m61_print_heap()
-///    Print all blocks in the heap, including prologue and epilogue
-void m61_print_heap() {
-    size_t* block = top_of_heap;
-    size_t* header;
-    size_t* footer;
-    size_t size;
-    bool alloc;
-    bool prev_alloc;
-    bool next_alloc;
-    int count = 0;
+/// m61_guarded_release(slot, file, line)
+///    Make `slot`'s page inaccessible and record the free at
+///    `file`:`line`. The caller holds guarded_lock.
+static void m61_guarded_release(m61_guarded_slot* slot, const char* file, int line) {
+    mprotect(m61_guarded_page(slot), guarded_page, PROT_NONE);
+    slot->state = GUARDED_FREED;
+    slot->free_file = file;
+    slot->free_line = line;
+    m61_record_free(slot->size);
+}
 
-    block = NEXT_FROM_HEADER(block); // skip the prologue
-    DEBUG_PRINT("================================================%c\n", 0);
-    while (true) {
-        header = block;
-        footer = FOOTER_FROM_HEADER(header);
-        size = GET_SIZE(header);
-        alloc = IS_ALLOC(header);
-        prev_alloc = IS_PREV_ALLOC(header);
-        next_alloc = IS_NEXT_ALLOC(header);
-        if (size == 0 && IS_ALLOC(header))
-            break;
-        DEBUG_PRINT("block %d: %s\nheader: %p footer: %p\nsize: %zu\nprev: %s\nnext: %s\n----------\n", count, (alloc ? "ALLOC" : "FREE"), header, footer, size, (prev_alloc ? "ALLOC" : "FREE"), (next_alloc ? "ALLOC" : "FREE"));
-        ++count;
-        block = NEXT_FROM_HEADER(header);
-    }
-    DEBUG_PRINT("================================================%c\n", 0);
+static bool m61_is_guarded_fill(char c) {
+    return (unsigned char) c == GUARDED_FILL;
 }
 
-/// m61_print_list()
-///    Print all blocks in the free list
-void m61_print_list(size_t* start) {
-    size_t* node = start;
-    size_t* header;
-    size_t* footer;
-    size_t* list_prev;
-    size_t* list_next;
-    size_t size;
-    bool alloc;
-    int count = 0;
-    bool is_free_list = start == free_list_start;
-    const char* title = is_free_list ? "FREE" : "ALLOC";
+/// m61_guarded_check(ptr, file, line)
+///    Validate freeing guarded pointer `ptr` like `m61_validate_free`, and
+///    check the fill around the object. Returns its slot if the checks
+///    pass, otherwise nullptr. The caller holds guarded_lock.
+static m61_guarded_slot* m61_guarded_check(void* ptr, const char* file, int line) {
+    m61_guarded_slot* slot = m61_guarded_slot_for(ptr);
+    char* page;
 
-    DEBUG_PRINT("\033[0;%dm====================%s LIST=======================%c\n", is_free_list ? 32 : 31, title, 0);
-    while (node != nullptr) {
-        header = node;
-        footer = FOOTER_FROM_HEADER(header);
-        size = GET_SIZE(header);
-        alloc = IS_ALLOC(header);
-        list_prev = *LIST_PREV(header);
-        list_next = *LIST_NEXT(header);
-        DEBUG_PRINT("block %d: %s\nheader: %p footer: %p\nsize(h): %zu\nlist_prev: %p\nlist_next: %p\n", count, (alloc ? "ALLOC" : "FREE"), header, footer, size, list_prev, list_next);
-        DEBUG_HEXDUMP(FOOTER_FROM_HEADER(header) - 11, 12 * WORD_SIZE);
-        DEBUG_PRINT("----------%c\n", 0);
-        ++count;
-        node = *LIST_NEXT(node);
-        if (count > 50)
-            break;
+    if (slot == nullptr || slot->ptr != ptr || slot->state == GUARDED_UNUSED) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+        return nullptr;
     }
-    DEBUG_PRINT("=======================%s LIST====================\033[0m%c\n", title, 0);
+    if (slot->state != GUARDED_ALLOCATED) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, double free\n", file, line, ptr);
+        return nullptr;
+    }
+    page = m61_guarded_page(slot);
+    if (!std::all_of(page, slot->ptr, m61_is_guarded_fill)
+        || !std::all_of(slot->ptr + slot->size, page + guarded_page, m61_is_guarded_fill)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
+        return nullptr;
+    }
+    return slot;
 }
 
-/// m61_print_block()
-///    Prints one block
-void m61_print_block(size_t* header, const char* message) {
-    if (header == nullptr) {
-        DEBUG_PRINT("%s: %p\n", message, header);
+/// m61_guarded_free(ptr, sz, file, line)
+///    Free guarded pointer `ptr`. If `sz` is nonzero, it is the size the
+///    caller allocated, as for `m61_free_sized`.
+static void m61_guarded_free(void* ptr, size_t sz, const char* file, int line) {
+    m61_guarded_slot* slot;
+
+    if (!m61_is_heap_arena(heap)) {
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
         return;
     }
-    bool alloc = IS_ALLOC(header);
-    DEBUG_PRINT("%s\n", message);
-    DEBUG_PRINT("\033[0;32m------------%c\n", 0);
-    DEBUG_PRINT("block %p: %s\nsize: %zu\nfooter: %p (%zu)\n", header, (alloc ? "ALLOC" : "FREE"), GET_SIZE(header), FOOTER_FROM_HEADER(header), GET_SIZE(FOOTER_FROM_HEADER(header)));
-    if (!alloc) {
-        DEBUG_PRINT("list_prev: %p\nlist_next: %p\n", *LIST_PREV(header), *LIST_NEXT(header));
-    } else {
-        DEBUG_PRINT("alloc_list_prev: %p\nalloc_list_next: %p\n", *LIST_PREV(header), *LIST_NEXT(header));
+    pthread_mutex_lock(&guarded_lock);
+    if ((slot = m61_guarded_check(ptr, file, line)) != nullptr) {
+        if (sz > slot->size)
+            fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, size %zu larger than the %zu bytes allocated\n",
+                    file, line, ptr, sz, slot->size);
+        else
+            m61_guarded_release(slot, file, line);
     }
-    DEBUG_PRINT("------------\033[0m%c\n", 0);
+    pthread_mutex_unlock(&guarded_lock);
 }
 
-/// m61_validate_list(list)
-///    Validates that all members of a list are of the right type (alloc/free)
-void m61_validate_list(size_t* list, const char* message) {
-    size_t* node = list;
-    while (node != nullptr) {
-        if (list == free_list_start && IS_ALLOC(node)) {
-            DEBUG_PRINT("invalid free list: %s\n", message);
-            m61_print_block(node, "due to block:");
-            abort();
-        }
-        else if (list == alloc_list_start && !IS_ALLOC(node)) {
-            DEBUG_PRINT("invalid alloc list: %s\n", message);
-            m61_print_block(node, "due to block:");
-            abort();
-        }
-        if (*LIST_NEXT(node) == node || *LIST_PREV(node) == node) {
-            DEBUG_PRINT("%s\n", message);
-            m61_print_block(node, "block points to itself");
-            abort();
-        }
-        node = *LIST_NEXT(node);
-    }
-}
+/// m61_guarded_size(ptr)
+///    Return the size of the object at guarded pointer `ptr`, or 0 if it
+///    is not an active object.
+static size_t m61_guarded_size(void* ptr) {
+    m61_guarded_slot* slot = m61_guarded_slot_for(ptr);
 
-/// m61_get_statistics()
-///    Return the current memory statistics.
-m61_statistics m61_get_statistics() {
-    return statistics;
+    if (slot == nullptr || slot->ptr != ptr
+        || __atomic_load_n(&slot->state, __ATOMIC_RELAXED) != GUARDED_ALLOCATED)
+        return 0;
+    return slot->size;
 }
 
-/// m61_get_memory_buffer()
-///    Get a pointer to the memory buffer
-///    For testing purposes only
-m61_memory_buffer* m61_get_memory_buffer() {
-    return &default_buffer;
-}
+/// m61_guarded_retire(ptr, file, line)
+///    Retire guarded pointer `ptr` like `m61_retire`: it stays accessible
+///    until no critical section entered before now is left.
+static void m61_guarded_retire(void* ptr, const char* file, int line) {
+    m61_guarded_slot* slot;
 
-/// m61_get_free_list()
-///    Get a pointer to the free list
-///    For testing purposes only
-size_t* m61_get_free_list() {
-    return free_list_start;
+    pthread_mutex_lock(&guarded_lock);
+    if ((slot = m61_guarded_check(ptr, file, line)) != nullptr) {
+        slot->state = GUARDED_RETIRED;
+        slot->free_file = file;
+        slot->free_line = line;
+        slot->retire_epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+        slot->next_retired = guarded_limbo;
+        __atomic_store_n(&guarded_limbo, slot, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&guarded_lock);
 }
 
-/// m61_get_alloc_list()
-///    Get a pointer to the free list
-///    For testing purposes only
-size_t* m61_get_alloc_list() {
-    return alloc_list_start;
-}
+/// m61_release_guarded_limbo(epoch)
+///    Free the retired guarded objects that no thread can reach in global
+///    epoch `epoch`.
+static void m61_release_guarded_limbo(unsigned long epoch) {
+    m61_guarded_slot* slot;
 
-/// m61_print_statistics()
-///    Prints the current memory statistics.
-void m61_print_statistics() {
-    m61_statistics stats = m61_get_statistics();
-    printf("alloc count: active %10llu   total %10llu   fail %10llu\n",
-           stats.nactive, stats.ntotal, stats.nfail);
-    printf("alloc size:  active %10llu   total %10llu   fail %10llu\n",
-           stats.active_size, stats.total_size, stats.fail_size);
+    if (__atomic_load_n(&guarded_limbo, __ATOMIC_RELAXED) == nullptr)
+        return;
+    pthread_mutex_lock(&guarded_lock);
+    for (m61_guarded_slot** link = &guarded_limbo; *link != nullptr; ) {
+        slot = *link;
+        if (slot->retire_epoch + 2 <= epoch) {
+            *link = slot->next_retired;
+            m61_guarded_release(slot, slot->free_file, slot->free_line);
+        } else {
+            link = &slot->next_retired;
+        }
+    }
+    pthread_mutex_unlock(&guarded_lock);
 }
 
-
-/// m61_print_leak_report()
-///    Prints a report of all currently-active allocated blocks of dynamic
-///    memory.
-void m61_print_leak_report() {
-    size_t** block = &alloc_list_start;
-    const char* file;
-    unsigned int line;
-    unsigned int size;
-    void* payload;
-    while (*block != nullptr) {
-        file = *GET_FILENAME(*block);
-        line = *GET_LINE_NUMBER(*block);
-        size = *REQ_SIZE_FROM_HEADER(*block);
-        payload = GET_PAYLOAD(*block);
-        fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %d\n", file, line, payload, size);
-        block = LIST_NEXT(*block);
+/// m61_print_guarded_leaks()
+///    Print a leak report line for every active guarded object.
+static void m61_print_guarded_leaks() {
+    pthread_mutex_lock(&guarded_lock);
+    for (m61_guarded_slot& slot : guarded_slots) {
+        if (slot.state == GUARDED_ALLOCATED)
+            fprintf(stdout, "LEAK CHECK: %s:%d: allocated object %p with size %zu\n",
+                    slot.file, slot.line, slot.ptr, slot.size);
     }
+    pthread_mutex_unlock(&guarded_lock);
 }
@@ -1,15 +1,57 @@
 #ifndef M61_HH
 #define M61_HH 1
 #include <cassert>
+#include <cstddef>
 #include <cstdlib>
 #include <cinttypes>
 #include <cstdio>
+#include <memory_resource>
 #include <new>
 #include <random>
+#include <utility>
+#include <version>
+#include <pthread.h>
 #include <sys/mman.h>
 #include "hexdump.hh"
 
 #define DEBUG false
+#ifndef M61_THREADS
+#define M61_THREADS 0      // set by building with PTHREAD=1
+#endif
+#ifndef M61_PERCPU
+#define M61_PERCPU 0       // set by building with PERCPU=1
+#endif
+#if M61_PERCPU && !M61_THREADS
+#error "per-CPU caches need a threaded build"
+#endif
+#ifndef M61_CHECKS
+#define M61_CHECKS 2       // set by building with CHECKS=none (0) or CHECKS=cheap (1)
+#endif
+
+// checking policies: which metadata allocations carry and which
+// validations frees run. `m61_checks` is the policy this build uses.
+struct m61_checks_none {
+    static constexpr bool magic = false;         // write and check the magic number after each payload
+    static constexpr bool validate = false;      // validate frees before releasing blocks
+    static constexpr bool search = false;        // find the block containing a wild free
+    static constexpr bool assert_lists = false;  // assert list invariants on every link and unlink
+};
+struct m61_checks_cheap : m61_checks_none {
+    static constexpr bool magic = true;
+    static constexpr bool validate = true;
+};
+struct m61_checks_full : m61_checks_cheap {
+    static constexpr bool search = true;
+    static constexpr bool assert_lists = true;
+};
+#if M61_CHECKS == 0
+using m61_checks = m61_checks_none;
+#elif M61_CHECKS == 1
+using m61_checks = m61_checks_cheap;
+#else
+using m61_checks = m61_checks_full;
+#endif
+
 #define M61_ASSERT(x, y) if (!(x)) { printf("Assertion failed: %s\n", y); abort(); }
 #define DEBUG_HEXDUMP(ptr, size) { if (DEBUG) { hexdump(ptr, size); } }
 #define DEBUG_PRINT(fmt, ...) \
@@ -20,17 +62,32 @@
 #define ALLOC_META_SIZE (WORD_SIZE * 8)
 #define MIN_BLOCK       (ALLOC_META_SIZE + MIN_PAYLOAD)  
 #define ALIGNMENT       alignof(std::max_align_t) // 16
+#define ALIGN_UP(sz)    (((sz) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+#ifndef M61_HEAP_SIZE
+#define M61_HEAP_SIZE   (8 << 20)   // 8 MiB, the default heap and each arena
+#endif
 
 #define ALLOC_BIT      0b010
 #define NEXT_ALLOC_BIT 0b001
 #define PREV_ALLOC_BIT 0b100
 
-#define IS_ALLOC(header)       (((*header) & ALLOC_BIT) > 0)
-#define IS_NEXT_ALLOC(header)  (((*header) & NEXT_ALLOC_BIT) > 0)
-#define IS_PREV_ALLOC(header)  (((*header) & PREV_ALLOC_BIT) > 0)
-#define GET_BITS(header)       ((*header) & (ALLOC_BIT | NEXT_ALLOC_BIT | PREV_ALLOC_BIT))
+// in threaded builds the neighbor bits of an allocated block's header can be
+// toggled by a thread holding the heap lock while the block's owner reads
+// the header without it, so header words are accessed atomically
+#if M61_THREADS
+#define LOAD_TAG(tag)          __atomic_load_n(static_cast<size_t*>(tag), __ATOMIC_RELAXED)
+#define XOR_TAG(tag, bits)     __atomic_fetch_xor(static_cast<size_t*>(tag), (bits), __ATOMIC_RELAXED)
+#else
+#define LOAD_TAG(tag)          (*(tag))
+#define XOR_TAG(tag, bits)     (*(tag) ^= (bits))
+#endif
+
+#define IS_ALLOC(header)       ((LOAD_TAG(header) & ALLOC_BIT) > 0)
+#define IS_NEXT_ALLOC(header)  ((LOAD_TAG(header) & NEXT_ALLOC_BIT) > 0)
+#define IS_PREV_ALLOC(header)  ((LOAD_TAG(header) & PREV_ALLOC_BIT) > 0)
+#define GET_BITS(header)       (LOAD_TAG(header) & (ALLOC_BIT | NEXT_ALLOC_BIT | PREV_ALLOC_BIT))
 
-#define GET_SIZE(header) ((*header) & (~(ALLOC_BIT | NEXT_ALLOC_BIT | PREV_ALLOC_BIT)))
+#define GET_SIZE(header) (LOAD_TAG(header) & (~(ALLOC_BIT | NEXT_ALLOC_BIT | PREV_ALLOC_BIT)))
 #define GET_HEADER_FROM_PAYLOAD(payload) ((size_t*)((char*)payload - WORD_SIZE))
 #define GET_PAYLOAD(header) ((void*)(header + 1))
 #define INCREMENT_SIZE_T_PTR(ptr, bytes) ((ptr) + ((bytes) / WORD_SIZE))
@@ -41,11 +98,70 @@
 #define FOOTER_FROM_HEADER(header) (GET_SIZE(header) == 0 ? nullptr : (NEXT_FROM_HEADER(header) - 1))
 #define HEADER_FROM_FOOTER(footer) (DECREMENT_SIZE_T_PTR(footer, (GET_SIZE(footer) - 1)))
 
-#define TOGGLE_NEXT_BITS(header, bits) (*NEXT_FROM_HEADER(header) ^= bits)
-#define TOGGLE_PREV_BITS(header, bits) (*PREV_FROM_HEADER(header) ^= bits)
+#define TOGGLE_NEXT_BITS(header, bits) (XOR_TAG(NEXT_FROM_HEADER(header), bits))
+#define TOGGLE_PREV_BITS(header, bits) (XOR_TAG(PREV_FROM_HEADER(header), bits))
+
+/// m61_rel<T>
+///    A pointer stored as its distance from its own address, 0 standing
+///    for nullptr, so that a heap's metadata means the same wherever the
+///    heap is mapped. It converts to and from `T*`; copying one copies the
+///    pointer, not the distance.
+template <typename T>
+struct m61_rel {
+    intptr_t offset = 0;
 
-#define LIST_PREV(header) ((size_t**)(FOOTER_FROM_HEADER(header) - 2))
-#define LIST_NEXT(header) ((size_t**)(FOOTER_FROM_HEADER(header) - 1))
+    constexpr m61_rel() = default;
+    constexpr m61_rel(std::nullptr_t) {
+    }
+    m61_rel(T* ptr) {
+        *this = ptr;
+    }
+    m61_rel(const m61_rel& other) {
+        *this = other.get();
+    }
+    m61_rel& operator=(T* ptr) {
+        offset = encode(ptr);
+        return *this;
+    }
+    m61_rel& operator=(const m61_rel& other) {
+        return *this = other.get();
+    }
+    operator T*() const {
+        return get();
+    }
+    T* get() const {
+        return decode(offset);
+    }
+
+    // relaxed atomic access, for slots other threads read without a lock
+    T* load() const {
+        return decode(__atomic_load_n(&offset, __ATOMIC_RELAXED));
+    }
+    void store(T* ptr) {
+        __atomic_store_n(&offset, encode(ptr), __ATOMIC_RELAXED);
+    }
+    bool compare_exchange(T*& expected, T* desired) {
+        intptr_t old = encode(expected);
+        bool ok = __atomic_compare_exchange_n(&offset, &old, encode(desired), false,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        expected = decode(old);
+        return ok;
+    }
+
+private:
+    intptr_t encode(T* ptr) const {
+        return ptr == nullptr ? 0 : (const char*)ptr - (const char*)this;
+    }
+    T* decode(intptr_t off) const {
+        return off == 0 ? nullptr : (T*)((const char*)this + off);
+    }
+};
+using m61_link = m61_rel<size_t>;
+
+// list pointers, file names and the header address are kept relative to
+// the slots holding them, so every process sharing a heap reads them alike
+#define LIST_PREV(header) ((m61_link*)(FOOTER_FROM_HEADER(header) - 2))
+#define LIST_NEXT(header) ((m61_link*)(FOOTER_FROM_HEADER(header) - 1))
 #define SET_LIST_PREV(header, ptr) (*LIST_PREV(header) = ptr)
 #define SET_LIST_NEXT(header, ptr) (*LIST_NEXT(header) = ptr)
 
@@ -54,10 +170,24 @@
 #define SET_REQ_SIZE(header, size) (*REQ_SIZE_FROM_HEADER(header) = size)
 #define GET_LINE_NUMBER(header) (REQ_SIZE_FROM_HEADER(header) + 1)
 #define SET_LINE_NUMBER(header, ln) (*GET_LINE_NUMBER(header) = ln)
-#define GET_FILENAME(header) ((const char**)(FOOTER_FROM_HEADER(header) - 4))
+#define GET_FILENAME(header) ((m61_rel<const char>*)(FOOTER_FROM_HEADER(header) - 4))
 #define SET_FILENAME(header, file) (*GET_FILENAME(header) = file)
-#define GET_HEADER_ADDR(header) ((size_t**)FOOTER_FROM_HEADER(header) - 3)
-#define SET_HEADER_ADDR(header, addr) (*GET_HEADER_ADDR(header) = addr)
+// the header address slot holds the header's offset from `base`, the top
+// of its heap, so that a copy of the block elsewhere in the heap does not
+// pass for it. The block's tag is in the 15 bits above the offset, and
+// above them a bit set on blocks `m61_halloc` allocated, which the
+// compactor may move. Setting the header address clears it.
+#define TAG_SHIFT 48
+#define TAG_MASK 0x7fff
+#define MOVABLE_BIT ((uintptr_t)1 << 63)
+#define HEADER_ADDR_SLOT(header) ((uintptr_t*)FOOTER_FROM_HEADER(header) - 3)
+#define GET_HEADER_ADDR(header, base) \
+    ((size_t*)((uintptr_t)(base) + (*HEADER_ADDR_SLOT(header) & (((uintptr_t)1 << TAG_SHIFT) - 1))))
+#define GET_TAG(header) ((unsigned)(*HEADER_ADDR_SLOT(header) >> TAG_SHIFT) & TAG_MASK)
+#define SET_HEADER_ADDR(header, base, addr, tag) \
+    (*HEADER_ADDR_SLOT(header) = ((uintptr_t)(addr) - (uintptr_t)(base)) | ((uintptr_t)(tag) << TAG_SHIFT))
+#define IS_MOVABLE(header) ((*HEADER_ADDR_SLOT(header) & MOVABLE_BIT) != 0)
+#define SET_MOVABLE(header) (*HEADER_ADDR_SLOT(header) |= MOVABLE_BIT)
 
 constexpr char magic_number[8] = {0x6b, 0x69, 0x6d, 0x62, 0x6f, 0x72, 0x61, 0x21};
 
@@ -65,6 +195,18 @@ constexpr char magic_number[8] = {0x6b, 0x69, 0x6d, 0x62, 0x6f, 0x72, 0x61, 0x21
 ///    Return a pointer to `sz` bytes of newly-allocated dynamic memory.
 void* m61_malloc(size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
+/// m61_size_class(sz)
+///    The size of the block `m61_get_adjusted_size(sz)` returns, computed
+///    at compile time.
+consteval size_t m61_size_class(size_t sz) {
+    return sz <= MIN_PAYLOAD ? MIN_BLOCK : ALIGN_UP(sz + ALLOC_META_SIZE);
+}
+
+/// m61_malloc_class(sz, asize, file, line)
+///    Like `m61_malloc`, for a nonzero `sz` whose size class `asize` is
+///    already known. Use `m61_malloc<N>` rather than calling it directly.
+void* m61_malloc_class(size_t sz, size_t asize, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
 /// m61_get_adjusted_size(sz)
 ///    Return the size of a block needed to allocate sz bytes
 size_t m61_get_adjusted_size(size_t sz);
@@ -80,19 +222,43 @@ size_t* m61_find_fit(size_t asize);
 ///    it exceeds the minimum block size
 void m61_place(size_t* header, size_t asize);
 
-/// m61_set_alloc_metadata(header, sz, file, line)
+/// m61_set_alloc_metadata(header, sz, file, line, tag)
 ///    Store the metadata for an allocated block in the block, including
-///    requested size `sz` and file and line number of the allocation.
-void m61_set_alloc_metadata(size_t* header, unsigned int sz, const char* file, int line);
+///    requested size `sz`, file and line number of the allocation and tag.
+void m61_set_alloc_metadata(size_t* header, unsigned int sz, const char* file, int line, unsigned tag = 0);
 
 /// m61_record_malloc(sz)
-///    Records a successful allocation of `sz` bytes
+///    Records a successful allocation of `sz` bytes, under the block's
+///    tag too if it has one
 void m61_record_malloc(size_t* header, size_t sz);
 
 /// m61_free(ptr, file, line)
 ///    Free the memory space pointed to by `ptr`.
 void m61_free(void* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
+/// m61_free_sized(ptr, sz, file, line)
+///    Like `m61_free`, where `sz` is the size `ptr` was allocated with (or
+///    any size up to it). The size replaces most of the checks of a free;
+///    a size larger than the allocation is reported.
+void m61_free_sized(void* ptr, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_malloc<N>(file, line), m61_free<N>(ptr, file, line)
+///    Allocate and free `N` bytes, a compile-time constant: the overflow
+///    check and size class are settled at compile time, and the free is
+///    an `m61_free_sized`.
+template <size_t N>
+inline void* m61_malloc(const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+    static_assert(N != 0 && N <= SIZE_MAX - (ALIGNMENT + ALLOC_META_SIZE), "invalid allocation size");
+    constexpr size_t asize = m61_size_class(N);
+    static_assert(asize % ALIGNMENT == 0 && asize >= MIN_BLOCK && asize - ALLOC_META_SIZE >= N,
+                  "size class must hold the allocation");
+    return m61_malloc_class(N, asize, file, line);
+}
+template <size_t N>
+inline void m61_free(void* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE()) {
+    m61_free_sized(ptr, N, file, line);
+}
+
 /// m61_validate_free(ptr, file, line)
 ///    Validate a particular free request. Checks for double frees,
 ///    wild frees, wild writes, and buffer overflows.
@@ -127,9 +293,9 @@ size_t* m61_coalesce_next(size_t* header, size_t* next);
 ///    Coalesce the given block `header` with the previous free block `prev`
 size_t* m61_coalesce_prev(size_t* header, size_t* prev);
 
-/// m61_record_free(ptr)
-///    Records a successful free of `sz` bytes
-void m61_record_free(size_t sz);
+/// m61_record_free(sz, tag)
+///    Records a successful free of `sz` bytes from a block with tag `tag`
+void m61_record_free(size_t sz, unsigned tag = 0);
 
 /// m61_set_header_and_footer(old_header, size, bites)
 ///    Given a header, set the header to new size `size` with `bits`
@@ -140,12 +306,17 @@ void m61_set_header_and_footer(size_t* header, size_t size, char bits);
 /// m61_unstitch_list
 ///    Helper function to remove a block from the free list by connecting
 ///    its next and previous blocks to each other
-void m61_unstitch_list(size_t** prev, size_t** next, size_t** list);
+void m61_unstitch_list(m61_link* prev, m61_link* next, m61_link* list);
 
 /// m61_push_to_front
 ///    Push block `header` to the front of list `list`
 void m61_push_to_front(size_t* header, size_t* list);
 
+/// m61_link_between(prev, next, header)
+///    Link allocated block `header` into the allocated list between
+///    `prev` and `next`
+void m61_link_between(size_t* prev, size_t* next, size_t* header);
+
 /// set_footer_magic_number(header, sz)
 ///    Places the magic number immediately following the region
 ///    allocated to the user for a given block (header + 2 words + payload size).
@@ -170,15 +341,184 @@ void* m61_calloc(size_t count, size_t sz, const char* file = __builtin_FILE(), i
 
 /// m61_realloc(ptr, sz, file, line)
 ///    Changes the size of the dynamic allocation pointed to by `ptr`
-///    to hold at least `sz` bytes. If the existing allocation cannot be
-///    enlarged, this function makes a new allocation, copies as much data
-///    as possible from the old allocation to the new, and returns a pointer
-///    to the new allocation. If `ptr` is `nullptr`, behaves like
-///    `m61_malloc(sz, file, line). `sz` must not be 0. If a required
-///    allocation fails, returns `nullptr` without freeing the original
-///    block.
+///    to hold at least `sz` bytes. The block grows in place into free
+///    neighbors when it can; otherwise this function makes a new
+///    allocation, copies as much data as possible from the old
+///    allocation to the new, and returns a pointer to the new allocation.
+///    If `ptr` is `nullptr`, behaves like `m61_malloc(sz, file, line).
+///    `sz` must not be 0. If a required allocation fails, returns
+///    `nullptr` without freeing the original block.
 void* m61_realloc(void* ptr, size_t new_size, const char* file = __builtin_FILE(), int line = __builtin_LINE());
 
+/// m61_try_expand(ptr, sz, file, line)
+///    Resize the allocation at `ptr` to `sz` bytes only if that can be
+///    done without moving it. Returns true on success; on failure the
+///    allocation is unchanged.
+bool m61_try_expand(void* ptr, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_malloc_batch(sz, n, out, file, line)
+///    Allocate `n` blocks of `sz` bytes each into `out` with one lock
+///    acquisition, carving them side by side from as few free blocks as
+///    possible. Returns how many were allocated; the rest of `out` is set
+///    to nullptr.
+size_t m61_malloc_batch(size_t sz, size_t n, void** out, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_free_batch(ptrs, n, file, line)
+///    Free the `n` pointers in `ptrs`, checking each like `m61_free`.
+///    Sorts `ptrs` by address so adjacent blocks coalesce together.
+void m61_free_batch(void** ptrs, size_t n, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_reserve(sz, count)
+///    Set aside `count` more blocks for allocations of `sz` bytes (or any
+///    size of the same size class) ahead of a latency-critical phase. The
+///    blocks are split off the heap and their pages faulted in now, so
+///    `m61_malloc` later hands them out without searching the free list or
+///    touching fresh memory. Blocks are reserved in the heap the calling
+///    thread allocates from, for up to M61_RESERVED_CLASSES size classes.
+///    Returns how many blocks were set aside, fewer than `count` if the
+///    heap runs out of room.
+size_t m61_reserve(size_t sz, size_t count);
+
+/// m61_release_reserved(sz)
+///    Return the blocks still reserved for `sz`-byte allocations to the
+///    heap, and return how many there were.
+size_t m61_release_reserved(size_t sz);
+
+/// m61_set_sample_rate(rate)
+///    Place about one in `rate` allocations of up to a page in a guarded
+///    slot: a page of its own, between pages that fault on any access, with
+///    the object ending at the end of its page. Overflows and underflows
+///    then fault at the offending access, as do accesses to the slot once
+///    the object is freed, and the fault is reported with the site that
+///    allocated the object. Sampling is off while `rate` is 0, the default;
+///    the M61_SAMPLE_RATE environment variable sets the starting rate.
+///    Allocations in scopes, in shared heaps, and of tagged or relocatable
+///    objects are never sampled.
+void m61_set_sample_rate(unsigned rate);
+
+/// m61_usable_size(ptr)
+///    Return the number of bytes the caller may use at `ptr`, an active
+///    allocation: the requested size, or the whole payload of a block from
+///    `m61_malloc_at_least`. Writing them is never a wild write. Returns 0,
+///    without a report, if `ptr` is not an active allocation.
+size_t m61_usable_size(void* ptr);
+
+/// m61_malloc_at_least(sz, actual, file, line)
+///    Like `m61_malloc`, but the whole payload, at least `sz` bytes, is
+///    the caller's: its size is stored in `*actual` (0 on failure), it is
+///    counted in the statistics, and writing it is not a wild write.
+void* m61_malloc_at_least(size_t sz, size_t* actual, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_aligned_alloc(align, sz, file, line)
+///    Like `m61_malloc`, but the returned pointer is a multiple of `align`,
+///    which must be a power of two. Leading space skipped to reach the
+///    alignment is returned to the heap, and the block is freed with
+///    `m61_free` as usual. Returns nullptr if `align` is invalid.
+void* m61_aligned_alloc(size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_posix_memalign(ptr, align, sz, file, line)
+///    Like `m61_aligned_alloc`, storing the pointer in `*ptr`. Returns 0,
+///    EINVAL if `align` is not a power of two multiple of `sizeof(void*)`,
+///    or ENOMEM.
+int m61_posix_memalign(void** ptr, size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_memalign(align, sz, file, line)
+///    Like `m61_aligned_alloc`, but any `align` is rounded up to a power
+///    of two.
+void* m61_memalign(size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_scope
+///    Token for an open allocation scope.
+typedef void* m61_scope;
+
+/// m61_scope_begin(file, line)
+///    Open an allocation scope at source location `file`:`line`. The scope
+///    belongs to the calling thread: it holds only that thread's blocks,
+///    and only that thread may close it. Returns nullptr if out of memory.
+m61_scope m61_scope_begin(const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_scope_rollback(scope, file, line)
+///    Free every block this thread allocated since `scope` was opened
+///    (including nested scopes that are still open) and close `scope`.
+///    Blocks other threads allocated meanwhile are left alone. Blocks that
+///    were allocated before the scope keep their place even if they are
+///    reallocated inside it.
+void m61_scope_rollback(m61_scope scope, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_scope_commit(scope, file, line)
+///    Close `scope`, keeping its allocations.
+void m61_scope_commit(m61_scope scope, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_epoch_enter()
+///    Enter a read-side critical section of a lock-free structure. Blocks
+///    retired by any thread are not freed until every thread that was
+///    inside a section has left it. Sections nest.
+void m61_epoch_enter();
+
+/// m61_epoch_exit()
+///    Leave the critical section opened by the matching `m61_epoch_enter`.
+void m61_epoch_exit();
+
+/// m61_retire(ptr, file, line)
+///    Free `ptr` once no thread can still be reading it. Checked like
+///    `m61_free`; a retired block stays counted as active until it is
+///    freed, and is not reported as a leak.
+void m61_retire(void* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_epoch_reclaim()
+///    Free the blocks this thread has retired that no thread can still
+///    reach. Retiring calls this every so often; once no thread is inside
+///    a critical section, it frees them all.
+void m61_epoch_reclaim();
+
+/// m61_handle
+///    A relocatable allocation. Its object may be moved by the compactor
+///    whenever it is not locked, so its address is only valid between
+///    `m61_hlock` and `m61_hunlock`.
+typedef struct m61_handle_rec* m61_handle;
+
+/// m61_halloc(sz, file, line)
+///    Allocate a relocatable object of `sz` bytes and return its handle,
+///    or nullptr if out of memory. The object starts unlocked. Its block
+///    also holds a pointer back to the handle, in front of the object.
+m61_handle m61_halloc(size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_hlock(h)
+///    Pin the object of handle `h` and return its address. Locks nest;
+///    the object cannot move until each is released with `m61_hunlock`.
+void* m61_hlock(m61_handle h);
+
+/// m61_hunlock(h)
+///    Release one lock on the object of `h`. Addresses returned by
+///    `m61_hlock` must not be used once the last lock is released.
+void m61_hunlock(m61_handle h, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_hfree(h, file, line)
+///    Free the object of handle `h` and the handle. `h` must not be locked.
+void m61_hfree(m61_handle h, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_compact(budget)
+///    Slide unlocked relocatable objects toward the start of each heap,
+///    merging the free blocks they leave behind, until about `budget`
+///    bytes have been moved. Returns the number of bytes moved; 0 once
+///    nothing is left to move. Allocations that find no fit compact
+///    their heap before giving up.
+size_t m61_compact(size_t budget = SIZE_MAX);
+
+/// m61_fragmentation
+///    How the free space of the heaps is split up.
+struct m61_fragmentation {
+    size_t free_size;           // # bytes in free blocks
+    size_t nfree_blocks;        // # free blocks
+    size_t largest_free;        // # bytes in the largest free block
+    double ratio;               // 1 - largest_free / free_size: 0 when all free
+                                // space is one block, near 1 when it is scattered
+};
+
+/// m61_get_fragmentation()
+///    Measure the fragmentation of the heaps the leak report covers.
+m61_fragmentation m61_get_fragmentation();
+
 /// m61_print_heap()
 ///    Print all blocks in the heap, including prologue and epilogue
 void m61_print_heap();
@@ -208,64 +548,562 @@ struct m61_statistics {
     unsigned long long fail_size;       // # bytes in failed alloc attempts
     uintptr_t heap_min;                 // smallest allocated addr
     uintptr_t heap_max;                 // largest allocated addr
+    unsigned long long nreserved;       // # blocks set aside by m61_reserve
+    unsigned long long nreserved_used;  // # allocations served from them
+    unsigned long long nsampled;        // # allocations placed in guarded slots
 };
 
 struct m61_memory_buffer {
     char* buffer;
     size_t pos = 0;
-    size_t size = 8 << 20; /* 8 MiB */
+    size_t size = M61_HEAP_SIZE;
 
     m61_memory_buffer();
     ~m61_memory_buffer();
 };
 
+#define M61_RESERVED_CLASSES 8
+
+/// m61_reserved_class
+///    Blocks of one size class set aside by `m61_reserve`, linked through
+///    their list pointers. A class with `asize == 0` is unused.
+struct m61_reserved_class {
+    size_t asize;
+    size_t count;
+    m61_link blocks;
+};
+
+/// m61_heap
+///    Root metadata of one heap: the heads of the free & allocated lists,
+///    the bounds of the heap and its statistics. The default heap's root
+///    is a static object; a shared heap keeps its root inside the shared
+///    mapping so that every attached process sees the same lists. Every
+///    pointer into the heap is an `m61_link`, and the statistics' heap_min
+///    and heap_max are offsets from `top_of_heap`, so a shared heap works
+///    at whatever address each process maps it.
+struct m61_heap {
+    m61_link free_list_start;
+    m61_link alloc_list_start;
+    m61_link top_of_heap;
+    m61_link end_of_heap;
+    m61_statistics statistics;
+    size_t open_scopes;              // thread caches stand aside while nonzero
+    m61_link scope_tail;             // marker of the last outermost open scope
+    size_t* remote_frees;            // blocks freed by threads of other arenas
+    size_t nreserved;                // blocks waiting in `reserved`
+    m61_reserved_class reserved[M61_RESERVED_CLASSES];
+    pthread_mutex_t lock;            // recursive; serializes allocation in shared
+                                     // heaps (where it is also robust) and, with
+                                     // PTHREAD=1, across threads
+};
+
+/// m61_heap_init(h, buffer, size)
+///    Lay out an empty heap (prologue, one free block, epilogue) in the
+///    `size` bytes at `buffer` and point the root `h` at it.
+void m61_heap_init(m61_heap* h, char* buffer, size_t size);
+
+#ifndef M61_ATTACH_TIMEOUT
+#define M61_ATTACH_TIMEOUT 1000     // ms to wait for a shared heap's creator
+#endif
+
+/// m61_shared_heap_open(name, size)
+///    Create the shared heap `name` (a POSIX shared memory object) with
+///    room for `size` bytes, or attach to it if it already exists. Each
+///    process maps the heap wherever it likes; pass blocks between them
+///    with `m61_heap_offset` and `m61_heap_pointer`. The file names of the
+///    heap's blocks are copied into the heap. If a process dies holding
+///    the heap's lock, the next to take it rebuilds the heap's lists with
+///    `m61_heap_recover`. Returns nullptr if the heap cannot be created or
+///    mapped, or if its creator did not finish setting it up within
+///    M61_ATTACH_TIMEOUT milliseconds.
+m61_heap* m61_shared_heap_open(const char* name, size_t size = 8 << 20);
+
+/// m61_shared_heap_close(h)
+///    Detach this process from shared heap `h`. The heap and its blocks
+///    persist until the name is unlinked and every process has detached.
+void m61_shared_heap_close(m61_heap* h);
+
+/// m61_shared_heap_unlink(name)
+///    Remove the name of a shared heap.
+void m61_shared_heap_unlink(const char* name);
+
+/// m61_persistent_heap_open(path, size)
+///    Open the heap stored in file `path`, creating it with room for `size`
+///    bytes if it does not exist. The heap's lists, statistics and file
+///    names live in the file, so a restarted process finds its previous
+///    allocations at the same offsets (see `m61_heap_offset`), wherever the
+///    heap is mapped now. Returns nullptr if the file is not a heap or its
+///    boundary tags are unrecoverable.
+m61_heap* m61_persistent_heap_open(const char* path, size_t size = 8 << 20);
+
+/// m61_persistent_heap_close(h)
+///    Mark persistent heap `h` as cleanly closed, write it back to its file
+///    and unmap it.
+void m61_persistent_heap_close(m61_heap* h);
+
+/// m61_heap_recover(h, rebuild)
+///    Walk the boundary tags of `h`, repairing them where possible, and
+///    rebuild the free and allocated lists if `rebuild` is set or they are
+///    inconsistent with the walk. Returns 1 if the lists were rebuilt, 0 if
+///    not, and -1 if the heap is unrecoverable.
+int m61_heap_recover(m61_heap* h, bool rebuild = false);
+
+/// m61_heap_malloc(h, sz, file, line)
+///    Like `m61_malloc`, but allocates from heap `h` under its lock.
+void* m61_heap_malloc(m61_heap* h, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_heap_free(h, ptr, file, line)
+///    Like `m61_free`, but frees a block of heap `h` under its lock.
+void m61_heap_free(m61_heap* h, void* ptr, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_heap_aligned_alloc(h, align, sz, file, line)
+///    Like `m61_aligned_alloc`, but allocates from heap `h` under its lock.
+void* m61_heap_aligned_alloc(m61_heap* h, size_t align, size_t sz, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_heap_get_statistics(h)
+///    Return the current memory statistics of heap `h`.
+m61_statistics m61_heap_get_statistics(m61_heap* h);
+
+/// m61_heap_offset(h, ptr)
+///    Return the offset of `ptr` from the start of shared heap `h`.
+///    Offsets can be passed between processes attached to the same heap.
+size_t m61_heap_offset(m61_heap* h, void* ptr);
+
+/// m61_heap_pointer(h, offset)
+///    Return the address of `offset` in shared heap `h`.
+void* m61_heap_pointer(m61_heap* h, size_t offset);
+
 /// m61_get_statistics()
-///    Return the current memory statistics.
+///    Return the current memory statistics. With PTHREAD=1 they total the
+///    heap arenas that threads are spread across.
 m61_statistics m61_get_statistics();
 
+/// m61_thread_statistics
+///    The statistics of one thread, from `m61_get_thread_statistics`.
+///    `nactive` and `active_size` count the thread's allocations less its
+///    frees, so a thread that frees blocks allocated by others can have
+///    them wrap around. `heap_min` and `heap_max` are not kept per thread.
+struct m61_thread_statistics {
+    pthread_t thread;
+    m61_statistics stats;
+};
+
+/// m61_get_thread_statistics(stats, n)
+///    Fill `stats` with the statistics of up to `n` live threads that have
+///    allocated or freed memory, and return how many such threads there
+///    are. Counts of exited threads are only in `m61_get_statistics`.
+///    Without PTHREAD=1, reports the calling thread alone.
+size_t m61_get_thread_statistics(m61_thread_statistics* stats, size_t n);
+
+/// M61_MAX_TAGS
+///    Tags run from 1 to M61_MAX_TAGS - 1; tag 0 marks untagged blocks.
+#define M61_MAX_TAGS 256
+
+/// m61_malloc_tagged(sz, tag, file, line)
+///    Like `m61_malloc`, but counts the block under `tag` (for example one
+///    per subsystem). Fails without searching the heap if the allocation
+///    would take the tag over its budget, or if `tag` is out of range.
+///    Reallocating a tagged block keeps its tag but is not held to the
+///    budget.
+void* m61_malloc_tagged(size_t sz, unsigned tag, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_set_tag_budget(tag, bytes)
+///    Limit the bytes in active allocations of `tag` to `bytes`; 0 removes
+///    the limit. Blocks already allocated are not affected.
+void m61_set_tag_budget(unsigned tag, size_t bytes);
+
+/// m61_free_tag(tag, file, line)
+///    Free every active block of `tag` in one pass over the allocated
+///    lists and return how many were freed. No other thread may use the
+///    blocks of `tag` meanwhile.
+size_t m61_free_tag(unsigned tag, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_get_tag_statistics(tag)
+///    Return the statistics of the blocks allocated under `tag`. `heap_min`
+///    and `heap_max` are not kept per tag, and a failure is either an
+///    allocation over the budget or one the heap could not satisfy.
+m61_statistics m61_get_tag_statistics(unsigned tag);
+
 /// m61_print_statistics()
 ///    Print the current memory statistics.
 void m61_print_statistics();
 
 /// m61_print_leak_report()
 ///    Print a report of all currently-active allocated blocks of dynamic
-///    memory.
+///    memory, then the slots in use in each slot pool under its creation
+///    site. With PTHREAD=1, call it once other threads have stopped
+///    allocating; blocks held in their caches are not reported.
 void m61_print_leak_report();
 
+/// m61_tcache_flush()
+///    Return every block in this thread's cache to the heap. Caches are
+///    flushed automatically when a thread exits. Does nothing unless the
+///    allocator was built with PTHREAD=1.
+void m61_tcache_flush();
+
 /// m61_get_memory_buffer()
 ///    Get a pointer to the memory buffer
 ///    For testing purposes only
 m61_memory_buffer* m61_get_memory_buffer();
 
 /// m61_get_free_list()
-///    Get a pointer to the free list
+///    Get a pointer to the free list, after returning this thread's
+///    cached blocks to it
 ///    For testing purposes only
 size_t* m61_get_free_list();
 
 /// m61_get_alloc_list()
-///    Get a pointer to the free list
+///    Get a pointer to the allocated list, after returning this thread's
+///    cached blocks to the free list
 ///    For testing purposes only
 size_t* m61_get_alloc_list();
 
+/// m61_allocation_result
+///    The result of `m61_allocator::allocate_at_least`: the standard type
+///    where the library has one.
+#if defined(__cpp_lib_allocate_at_least)
+template <typename P>
+using m61_allocation_result = std::allocation_result<P>;
+#else
+template <typename P>
+struct m61_allocation_result {
+    P ptr;
+    size_t count;
+};
+#endif
+
 /// This magic class lets standard C++ containers use your allocator
-/// instead of the system allocator.
+/// instead of the system allocator. A default-constructed allocator
+/// uses the default heap and records its blocks as "?", line 0; one
+/// constructed from a heap (nullptr for the default heap) allocates
+/// from that heap and records the site where it was constructed.
+/// Copies, including rebound ones, keep the heap and the site.
 template <typename T>
 class m61_allocator {
 public:
     using value_type = T;
     m61_allocator() noexcept = default;
+    explicit m61_allocator(m61_heap* heap, const char* file = __builtin_FILE(), int line = __builtin_LINE()) noexcept
+        : heap_(heap), file_(file), line_(line) {}
     m61_allocator(const m61_allocator<T>&) noexcept = default;
-    template <typename U> m61_allocator(m61_allocator<U>&) noexcept {}
+    template <typename U> m61_allocator(const m61_allocator<U>& other) noexcept
+        : heap_(other.heap()), file_(other.file()), line_(other.line()) {}
+
+    T* allocate(size_t n) {
+        if (heap_ != nullptr)
+            return reinterpret_cast<T*>(m61_heap_aligned_alloc(heap_, alignof(T), n * sizeof(T), file_, line_));
+        if constexpr (alignof(T) > ALIGNMENT)
+            return reinterpret_cast<T*>(m61_aligned_alloc(alignof(T), n * sizeof(T), file_, line_));
+        if (n == 1)     // single objects go straight to their size class
+            return reinterpret_cast<T*>(m61_malloc<sizeof(T)>(file_, line_));
+        return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), file_, line_));
+    }
+    m61_allocation_result<T*> allocate_at_least(size_t n) {
+        size_t actual;
+        T* ptr;
+        if (heap_ != nullptr || alignof(T) > ALIGNMENT)
+            return {allocate(n), n};
+        ptr = reinterpret_cast<T*>(m61_malloc_at_least(n * sizeof(T), &actual, file_, line_));
+        return {ptr, actual / sizeof(T)};
+    }
+    void deallocate(T* ptr, size_t n) {
+        if (heap_ != nullptr)
+            m61_heap_free(heap_, ptr, file_, line_);
+        else if (n == 1)
+            m61_free<sizeof(T)>(ptr, file_, line_);
+        else
+            m61_free_sized(ptr, n * sizeof(T), file_, line_);
+    }
+    m61_heap* heap() const noexcept {
+        return heap_;
+    }
+    const char* file() const noexcept {
+        return file_;
+    }
+    int line() const noexcept {
+        return line_;
+    }
+
+private:
+    m61_heap* heap_ = nullptr;
+    const char* file_ = "?";
+    int line_ = 0;
+};
+template <typename T, typename U>
+inline constexpr bool operator==(const m61_allocator<T>& a, const m61_allocator<U>& b) {
+    return a.heap() == b.heap();
+}
+
+/// m61_memory_resource
+///    A `std::pmr::memory_resource` backed by m61, for `std::pmr`
+///    containers. It allocates from `heap` (nullptr for the default
+///    heap), honors the requested alignment, frees with the size the
+///    container passes back, and records its blocks under the site where
+///    it was constructed. Throws `std::bad_alloc` when the heap is out of
+///    memory. Resources on the same heap are interchangeable.
+class m61_memory_resource : public std::pmr::memory_resource {
+public:
+    explicit m61_memory_resource(m61_heap* heap = nullptr, const char* file = __builtin_FILE(), int line = __builtin_LINE()) noexcept
+        : heap_(heap), file_(file), line_(line) {}
+
+    m61_heap* heap() const noexcept {
+        return heap_;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t align) override {
+        void* ptr;
+        if (bytes == 0)     // every allocation must be distinct
+            bytes = 1;
+        if (heap_ != nullptr)
+            ptr = m61_heap_aligned_alloc(heap_, align, bytes, file_, line_);
+        else
+            ptr = m61_aligned_alloc(align, bytes, file_, line_);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+    void do_deallocate(void* ptr, size_t bytes, size_t) override {
+        if (heap_ != nullptr)
+            m61_heap_free(heap_, ptr, file_, line_);
+        else
+            m61_free_sized(ptr, bytes, file_, line_);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        const m61_memory_resource* m61_other = dynamic_cast<const m61_memory_resource*>(&other);
+        return m61_other != nullptr && m61_other->heap_ == heap_;
+    }
+
+    m61_heap* heap_;
+    const char* file_;
+    int line_;
+};
+
+/// m61_arena
+///    A monotonic allocation region. Chunks are taken from the main heap
+///    with `m61_malloc` (so they appear in statistics and leak reports
+///    under the arena's creation site) and objects are bump-allocated
+///    inside them with no per-object header or footer. The first word of
+///    every chunk links to the previously allocated chunk; the arena
+///    itself lives at the start of its first chunk.
+struct m61_arena {
+    char* chunk;             // most recently allocated chunk
+    char* pos;               // next unused byte in `chunk`
+    char* end;               // one past the last byte of `chunk`
+    size_t chunk_size;       // default size of a new chunk
+    const char* file;        // creation site, recorded for every chunk
+    int line;
+};
+
+/// m61_arena_create(chunk_size, file, line)
+///    Create an arena whose chunks are at least `chunk_size` bytes,
+///    allocated from the main heap at source location `file`:`line`.
+///    Returns nullptr if the first chunk cannot be allocated.
+m61_arena* m61_arena_create(size_t chunk_size = 4096, const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_arena_alloc(arena, sz)
+///    Return a pointer to `sz` bytes from `arena`, aligned to ALIGNMENT.
+///    Adds a new chunk if the current one is exhausted. Returns nullptr
+///    if `sz == 0` or the main heap is out of memory.
+void* m61_arena_alloc(m61_arena* arena, size_t sz);
+
+/// m61_arena_reset(arena)
+///    Release every object allocated from `arena` at once, returning all
+///    chunks but the first to the main heap.
+void m61_arena_reset(m61_arena* arena);
+
+/// m61_arena_destroy(arena)
+///    Return every chunk of `arena`, including the arena itself, to the
+///    main heap.
+void m61_arena_destroy(m61_arena* arena);
+
+/// This class lets standard C++ containers allocate from an `m61_arena`.
+/// Deallocation is a no-op; memory is reclaimed by `m61_arena_reset` or
+/// `m61_arena_destroy`.
+template <typename T>
+class m61_arena_allocator {
+public:
+    using value_type = T;
+    m61_arena_allocator(m61_arena* arena) noexcept : arena_(arena) {}
+    m61_arena_allocator(const m61_arena_allocator<T>&) noexcept = default;
+    template <typename U> m61_arena_allocator(const m61_arena_allocator<U>& other) noexcept
+        : arena_(other.arena()) {}
+
+    T* allocate(size_t n) {
+        return reinterpret_cast<T*>(m61_arena_alloc(arena_, n * sizeof(T)));
+    }
+    void deallocate(T*, size_t) {
+    }
+    m61_arena* arena() const noexcept {
+        return arena_;
+    }
+
+private:
+    m61_arena* arena_;
+};
+template <typename T, typename U>
+inline constexpr bool operator==(const m61_arena_allocator<T>& a, const m61_arena_allocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
+/// m61_slot_pool
+///    A pool of fixed-size slots. Slabs of slots are taken from the main
+///    heap with `m61_malloc` (so they appear in statistics and leak reports
+///    under the pool's creation site) and slots are handed out from an
+///    intrusive free list threaded through the unused ones. The first word
+///    of every slab links to the previously allocated slab. Pools register
+///    themselves so that `m61_print_leak_report` can summarize their use.
+struct m61_slot_pool {
+    void* free_slots;        // unused slots; each holds the next one's address
+    char* slab;              // most recently allocated slab
+    size_t slot_size;        // bytes per slot, a multiple of the alignment
+    size_t align;
+    size_t slab_header;      // bytes before a slab's first slot
+    size_t slots_per_slab;
+    size_t nslabs;           // slabs allocated
+    size_t nlive;            // slots handed out and not yet returned
+    const char* file;        // creation site, recorded for every slab
+    int line;
+    m61_slot_pool* next_pool;
+    pthread_mutex_t lock;    // only taken in threaded builds
+};
+
+/// m61_slot_pool_create(size, align, slots_per_slab, file, line)
+///    Create a pool of slots of `size` bytes aligned to `align`, with
+///    `slots_per_slab` slots per slab (0 picks slabs of about a page),
+///    allocated from the main heap at source location `file`:`line`.
+///    Returns nullptr if `align` is not a power of two or the pool cannot
+///    be allocated.
+m61_slot_pool* m61_slot_pool_create(size_t size, size_t align = ALIGNMENT, size_t slots_per_slab = 0,
+                                    const char* file = __builtin_FILE(), int line = __builtin_LINE());
+
+/// m61_slot_pool_alloc(pool)
+///    Return an unused slot of `pool`, adding a slab if none is left.
+///    Returns nullptr if the main heap is out of memory.
+void* m61_slot_pool_alloc(m61_slot_pool* pool);
+
+/// m61_slot_pool_free(pool, ptr)
+///    Return slot `ptr`, allocated from `pool`, to the pool.
+void m61_slot_pool_free(m61_slot_pool* pool, void* ptr);
+
+/// m61_slot_pool_destroy(pool)
+///    Return every slab of `pool`, and the pool itself, to the main heap.
+///    Slots still in use become invalid.
+void m61_slot_pool_destroy(m61_slot_pool* pool);
+
+/// m61_node_pool(size, align)
+///    Return the shared pool of `size`-byte slots aligned to `align` that
+///    `m61_node_allocator`s use, creating it on first use. Shared pools
+///    last until the program exits and record their slabs as "<node pool>".
+m61_slot_pool* m61_node_pool(size_t size, size_t align);
+
+/// m61_pool<T, Cache>
+///    Typed objects in fixed-size slots. `create` and `destroy` construct
+///    and destroy objects in place. With `Cache`, `acquire` and `release`
+///    additionally keep released objects constructed and hand them out
+///    again, so `T`'s constructor runs once per slot; cached objects are
+///    destroyed with the pool. The cache is not synchronized.
+template <typename T, bool Cache = false>
+class m61_pool {
+public:
+    explicit m61_pool(size_t slots_per_slab = 0, const char* file = __builtin_FILE(), int line = __builtin_LINE())
+        : pool_(m61_slot_pool_create(cache_link + (Cache ? sizeof(void*) : 0), alignof(T),
+                                     slots_per_slab, file, line)) {
+        if (pool_ == nullptr)
+            throw std::bad_alloc();
+    }
+    m61_pool(const m61_pool&) = delete;
+    m61_pool& operator=(const m61_pool&) = delete;
+    ~m61_pool() {
+        while (cached_ != nullptr) {
+            T* obj = cached_;
+            cached_ = next_cached(obj);
+            obj->~T();
+        }
+        m61_slot_pool_destroy(pool_);
+    }
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        void* slot = m61_slot_pool_alloc(pool_);
+        if (slot == nullptr)
+            return nullptr;
+        return new (slot) T(std::forward<Args>(args)...);
+    }
+    void destroy(T* obj) {
+        obj->~T();
+        m61_slot_pool_free(pool_, obj);
+    }
+
+    T* acquire() {
+        static_assert(Cache, "acquire needs a caching pool");
+        T* obj = cached_;
+        if (obj == nullptr)
+            return create();
+        cached_ = next_cached(obj);
+        return obj;
+    }
+    void release(T* obj) {
+        static_assert(Cache, "release needs a caching pool");
+        next_cached(obj) = cached_;
+        cached_ = obj;
+    }
+
+    m61_slot_pool* slot_pool() const noexcept {
+        return pool_;
+    }
+
+private:
+    // a cached object is still live, so its link goes after it
+    static constexpr size_t cache_link = (sizeof(T) + alignof(void*) - 1) & ~(alignof(void*) - 1);
+    static T*& next_cached(T* obj) {
+        return *reinterpret_cast<T**>(reinterpret_cast<char*>(obj) + cache_link);
+    }
+
+    m61_slot_pool* pool_;
+    T* cached_ = nullptr;
+};
+
+/// This class lets node-based containers (`std::list`, `std::map`,
+/// `std::unordered_map`, ...) take their nodes from shared slot pools,
+/// one per node size, instead of searching the heap for each one. Other
+/// allocations go to `m61_malloc`.
+template <typename T>
+class m61_node_allocator {
+public:
+    using value_type = T;
+    m61_node_allocator() noexcept = default;
+    m61_node_allocator(const m61_node_allocator<T>&) noexcept = default;
+    template <typename U> m61_node_allocator(const m61_node_allocator<U>&) noexcept {}
 
     T* allocate(size_t n) {
-        return reinterpret_cast<T*>(m61_malloc(n * sizeof(T), "?", 0));
+        m61_slot_pool* p;
+        if (n != 1)
+            return reinterpret_cast<T*>(m61_aligned_alloc(alignof(T), n * sizeof(T), "?", 0));
+        if ((p = pool()) == nullptr)    // out of memory, like `m61_allocator`
+            return nullptr;
+        return reinterpret_cast<T*>(m61_slot_pool_alloc(p));
     }
-    void deallocate(T* ptr, size_t) {
-        m61_free(ptr, "?", 0);
+    void deallocate(T* ptr, size_t n) {
+        m61_slot_pool* p;
+        if (n != 1)
+            m61_free_sized(ptr, n * sizeof(T), "?", 0);
+        else if ((p = pool()) != nullptr)
+            m61_slot_pool_free(p, ptr);
+    }
+
+private:
+    // a pool that could not be created is asked for again next time
+    static m61_slot_pool* pool() {
+        static m61_slot_pool* shared = nullptr;
+        m61_slot_pool* p = __atomic_load_n(&shared, __ATOMIC_ACQUIRE);
+        if (p == nullptr && (p = m61_node_pool(sizeof(T), alignof(T))) != nullptr)
+            __atomic_store_n(&shared, p, __ATOMIC_RELEASE);
+        return p;
     }
 };
 template <typename T, typename U>
-inline constexpr bool operator==(const m61_allocator<T>&, const m61_allocator<U>&) {
+inline constexpr bool operator==(const m61_node_allocator<T>&, const m61_node_allocator<U>&) {
     return true;
 }
 
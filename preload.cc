@@ -0,0 +1,258 @@
+#include "m61.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+// The malloc family and operator new/delete, backed by m61, for preloading
+// into unmodified programs: build `make libm61.so` and run
+// `LD_PRELOAD=./libm61.so PROGRAM`. Allocations are recorded as "?", line 0.
+//
+// m61 itself can call back into malloc: the C++ runtime allocates when a
+// thread first uses m61's thread-local caches, and stdio may allocate
+// while a MEMORY BUG is reported. Those nested calls are served from a
+// small bootstrap region instead, so they never re-enter the allocator.
+
+#define BOOTSTRAP_SIZE (1 << 20)
+
+alignas(std::max_align_t) static char bootstrap[BOOTSTRAP_SIZE];
+static size_t bootstrap_pos = 0;
+static __thread int in_m61 __attribute__((tls_model("initial-exec"))) = 0;
+
+/// m61_preload_guard
+///    Marks this thread as inside m61 for the guard's lifetime.
+struct m61_preload_guard {
+    m61_preload_guard() {
+        ++in_m61;
+    }
+    ~m61_preload_guard() {
+        --in_m61;
+    }
+};
+
+/// bootstrap_alloc(sz, align)
+///    Return `sz` bytes aligned to `align` (at most a page) from the
+///    bootstrap region, or nullptr once it is exhausted. Each allocation
+///    is preceded by its size; bootstrap memory is never reused.
+static void* bootstrap_alloc(size_t sz, size_t align) {
+    size_t pos = __atomic_load_n(&bootstrap_pos, __ATOMIC_RELAXED);
+    size_t start;
+
+    if (align < ALIGNMENT)
+        align = ALIGNMENT;
+    do {
+        start = (pos + sizeof(size_t) + align - 1) & ~(align - 1);
+        if (sz > BOOTSTRAP_SIZE || start > BOOTSTRAP_SIZE - sz)
+            return nullptr;
+    } while (!__atomic_compare_exchange_n(&bootstrap_pos, &pos, start + sz, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    memcpy(bootstrap + start - sizeof(size_t), &sz, sizeof(size_t));
+    return bootstrap + start;
+}
+
+static inline bool is_bootstrap(void* ptr) {
+    return (char*) ptr >= bootstrap && (char*) ptr < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static size_t bootstrap_size(void* ptr) {
+    size_t sz;
+    memcpy(&sz, (char*) ptr - sizeof(size_t), sizeof(size_t));
+    return sz;
+}
+
+/// preload_alloc(sz, align)
+///    Allocate `sz` bytes (at least 1, so every allocation is unique)
+///    aligned to `align`, setting errno on failure.
+static void* preload_alloc(size_t sz, size_t align) {
+    void* ptr;
+
+    if (sz == 0)
+        sz = 1;
+    if (in_m61)
+        ptr = bootstrap_alloc(sz, align);
+    else {
+        m61_preload_guard guard;
+        ptr = m61_aligned_alloc(align, sz, "?", 0);
+    }
+    if (ptr == nullptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+/// preload_free(ptr, sz)
+///    Free `ptr`, which was allocated with `sz` bytes if `sz` is nonzero.
+static void preload_free(void* ptr, size_t sz) {
+    if (ptr == nullptr || is_bootstrap(ptr))
+        return;
+    m61_preload_guard guard;
+    if (sz != 0)
+        m61_free_sized(ptr, sz, "?", 0);
+    else
+        m61_free(ptr, "?", 0);
+}
+
+/// preload_new(sz, align)
+///    `operator new`: allocate or call the new handler until it throws.
+static void* preload_new(size_t sz, size_t align) {
+    void* ptr;
+
+    while ((ptr = preload_alloc(sz, align)) == nullptr) {
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+    return ptr;
+}
+
+extern "C" {
+
+void* malloc(size_t sz) {
+    return preload_alloc(sz, ALIGNMENT);
+}
+
+void free(void* ptr) {
+    preload_free(ptr, 0);
+}
+
+void* calloc(size_t count, size_t sz) {
+    void* ptr;
+
+    if (sz != 0 && count > SIZE_MAX / sz) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    if (in_m61) {
+        // bootstrap memory is zero and never reused
+        return bootstrap_alloc(count * sz == 0 ? 1 : count * sz, ALIGNMENT);
+    }
+    m61_preload_guard guard;
+    ptr = m61_calloc(count == 0 ? 1 : count, sz == 0 ? 1 : sz, "?", 0);
+    if (ptr == nullptr)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t sz) {
+    void* new_ptr;
+
+    if (ptr == nullptr)
+        return malloc(sz);
+    if (sz == 0) {
+        free(ptr);
+        return nullptr;
+    }
+    if (is_bootstrap(ptr)) {
+        if ((new_ptr = malloc(sz)) != nullptr)
+            memcpy(new_ptr, ptr, std::min(sz, bootstrap_size(ptr)));
+        return new_ptr;
+    }
+    m61_preload_guard guard;
+    if ((new_ptr = m61_realloc(ptr, sz, "?", 0)) == nullptr)
+        errno = ENOMEM;
+    return new_ptr;
+}
+
+void* aligned_alloc(size_t align, size_t sz) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return preload_alloc(sz, align);
+}
+
+int posix_memalign(void** ptr, size_t align, size_t sz) {
+    void* payload;
+
+    if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0 || align == 0)
+        return EINVAL;
+    if ((payload = preload_alloc(sz, align)) == nullptr)
+        return ENOMEM;
+    *ptr = payload;
+    return 0;
+}
+
+void* memalign(size_t align, size_t sz) {
+    size_t pow2 = ALIGNMENT;
+
+    while (pow2 < align && pow2 != 0)
+        pow2 <<= 1;
+    return preload_alloc(sz, pow2);
+}
+
+void* valloc(size_t sz) {
+    return preload_alloc(sz, sysconf(_SC_PAGESIZE));
+}
+
+size_t malloc_usable_size(void* ptr) {
+    if (ptr == nullptr)
+        return 0;
+    if (is_bootstrap(ptr))
+        return bootstrap_size(ptr);
+    m61_preload_guard guard;
+    return m61_usable_size(ptr);
+}
+
+}
+
+void* operator new(size_t sz) {
+    return preload_new(sz, ALIGNMENT);
+}
+void* operator new[](size_t sz) {
+    return preload_new(sz, ALIGNMENT);
+}
+void* operator new(size_t sz, std::align_val_t align) {
+    return preload_new(sz, (size_t) align);
+}
+void* operator new[](size_t sz, std::align_val_t align) {
+    return preload_new(sz, (size_t) align);
+}
+void* operator new(size_t sz, const std::nothrow_t&) noexcept {
+    return preload_alloc(sz, ALIGNMENT);
+}
+void* operator new[](size_t sz, const std::nothrow_t&) noexcept {
+    return preload_alloc(sz, ALIGNMENT);
+}
+void* operator new(size_t sz, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return preload_alloc(sz, (size_t) align);
+}
+void* operator new[](size_t sz, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return preload_alloc(sz, (size_t) align);
+}
+
+void operator delete(void* ptr) noexcept {
+    preload_free(ptr, 0);
+}
+void operator delete[](void* ptr) noexcept {
+    preload_free(ptr, 0);
+}
+void operator delete(void* ptr, size_t sz) noexcept {
+    preload_free(ptr, sz);
+}
+void operator delete[](void* ptr, size_t sz) noexcept {
+    preload_free(ptr, sz);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    preload_free(ptr, 0);
+}
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    preload_free(ptr, 0);
+}
+void operator delete(void* ptr, size_t sz, std::align_val_t) noexcept {
+    preload_free(ptr, sz);
+}
+void operator delete[](void* ptr, size_t sz, std::align_val_t) noexcept {
+    preload_free(ptr, sz);
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    preload_free(ptr, 0);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    preload_free(ptr, 0);
+}
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    preload_free(ptr, 0);
+}
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    preload_free(ptr, 0);
+}
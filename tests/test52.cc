@@ -20,8 +20,8 @@ int main() {
     size_t* prologue_header_from_free = PREV_FROM_HEADER(free_header);
     size_t* free_header_from_prologue = NEXT_FROM_HEADER(prologue_header);
 
-    size_t** free_next = LIST_NEXT(free_header);
-    size_t** free_prev = LIST_PREV(free_header);
+    m61_link* free_next = LIST_NEXT(free_header);
+    m61_link* free_prev = LIST_PREV(free_header);
 
     assert(epilogue_header == epilogue_header_from_free);
     assert(free_header_from_epilogue == free_header);
@@ -0,0 +1,49 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <vector>
+// Check arena allocation, reset, destroy, and leak reporting of arena chunks.
+
+int main() {
+    m61_arena* arena = m61_arena_create(1024);
+    assert(arena);
+
+    // objects are aligned and distinct
+    char* prev = nullptr;
+    for (int i = 0; i != 100; ++i) {
+        char* p = (char*) m61_arena_alloc(arena, 1 + i % 40);
+        assert(p && (uintptr_t) p % ALIGNMENT == 0);
+        assert(p != prev);
+        memset(p, 'A', 1 + i % 40);
+        prev = p;
+    }
+
+    // large objects get their own chunk
+    void* big = m61_arena_alloc(arena, 5000);
+    assert(big);
+    memset(big, 'B', 5000);
+
+    // standard containers can use the arena
+    {
+        std::vector<int, m61_arena_allocator<int>> v{m61_arena_allocator<int>(arena)};
+        for (int i = 0; i != 1000; ++i) {
+            v.push_back(i);
+        }
+        assert(v[999] == 999);
+    }
+
+    m61_arena_reset(arena);
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.nactive == 1 && stat.active_size == 1024);
+    printf("arena %p\n", (void*) ((char*) arena - ALIGNMENT));
+    m61_print_leak_report();
+
+    m61_arena_destroy(arena);
+    m61_print_statistics();
+}
+
+//! arena ??{0x\w+}=ptr??
+//! LEAK CHECK: test60.cc:9: allocated object ??ptr?? with size 1024
+//! alloc count: active          0   total    ??>=5??   fail          0
+//! alloc size:  active          0   total        ???   fail          0
@@ -0,0 +1,77 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// Check that processes can pass shared heap allocations by offset, wherever
+// each maps the heap, and survive a process dying with the heap locked.
+
+int main() {
+    char name[64];
+    snprintf(name, sizeof(name), "/m61-test61-%d", (int) getpid());
+    m61_heap* h = m61_shared_heap_open(name, 1 << 20);
+    assert(h);
+
+    int pipefd[2];
+    int r = pipe(pipefd);
+    assert(r == 0);
+
+    fflush(stdout);
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        // reattach by name, as an unrelated process would, somewhere else
+        void* base = m61_heap_pointer(h, 0);
+        m61_shared_heap_close(h);
+        void* taken = mmap(base, 1 << 20, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        assert(taken == base);
+        h = m61_shared_heap_open(name);
+        assert(h && m61_heap_pointer(h, 0) != base);
+        char* msg = (char*) m61_heap_malloc(h, 100);
+        assert(msg);
+        memset(msg, 0, 100);
+        strcpy(msg, "hello from the producer");
+        size_t offset = m61_heap_offset(h, msg);
+        ssize_t w = write(pipefd[1], &offset, sizeof(offset));
+        assert(w == sizeof(offset));
+        pthread_mutex_lock(&h->lock);       // and die holding the lock
+        _exit(0);
+    }
+
+    size_t offset;
+    ssize_t n = read(pipefd[0], &offset, sizeof(offset));
+    assert(n == sizeof(offset));
+    waitpid(p, nullptr, 0);
+
+    char* msg = (char*) m61_heap_pointer(h, offset);
+    printf("%s\n", msg);
+    m61_statistics stat = m61_heap_get_statistics(h);
+    printf("shared active %llu\n", stat.nactive);
+    fflush(stdout);
+    m61_heap_free(h, msg + 32);         // located with the producer's file name
+    m61_heap_free(h, msg);
+    stat = m61_heap_get_statistics(h);
+    printf("shared active %llu\n", stat.nactive);
+
+    m61_shared_heap_close(h);
+    m61_shared_heap_unlink(name);
+
+    // a heap whose creator never finished setting it up
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    assert(fd >= 0);
+    close(fd);
+    printf("unfinished %p\n", (void*) m61_shared_heap_open(name));
+    m61_shared_heap_unlink(name);
+    m61_print_statistics();
+}
+
+//! hello from the producer
+//! shared active 1
+//! MEMORY BUG: test???.cc:53: invalid free of pointer ???, not allocated
+//!   test???.cc:32: ??? is 32 bytes inside a 100 byte region allocated here
+//! shared active 0
+//! unfinished (nil)
+//! alloc count: active          0   total          0   fail          0
+//! alloc size:  active          0   total          0   fail          0
@@ -0,0 +1,102 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+// Check that a persistent heap keeps its allocations across reopen and crash,
+// and that its lock survives both.
+
+static size_t count_list(size_t* node) {
+    size_t n = 0;
+    for (; node != nullptr; node = *LIST_NEXT(node)) {
+        ++n;
+    }
+    return n;
+}
+
+int main() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/m61-test62-%d.heap", (int) getpid());
+    m61_heap* h = m61_persistent_heap_open(path, 1 << 20);
+    assert(h);
+
+    char* a = (char*) m61_heap_malloc(h, 100);
+    char* b = (char*) m61_heap_malloc(h, 200);
+    char* c = (char*) m61_heap_malloc(h, 300);
+    strcpy(a, "first");
+    strcpy(c, "third");
+    size_t a_offset = m61_heap_offset(h, a);
+    size_t c_offset = m61_heap_offset(h, c);
+    m61_heap_free(h, b);
+
+    // a clean reopen finds the same allocations at the same offsets,
+    // wherever the heap is mapped
+    void* base = m61_heap_pointer(h, 0);
+    m61_persistent_heap_close(h);
+    void* taken = mmap(base, 1 << 20, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    assert(taken == base);
+    h = m61_persistent_heap_open(path);
+    assert(h && m61_heap_pointer(h, 0) != base);
+    a = (char*) m61_heap_pointer(h, a_offset);
+    c = (char*) m61_heap_pointer(h, c_offset);
+    printf("%s %s\n", a, c);
+    int r = m61_heap_recover(h);
+    printf("active %llu recover %d\n", m61_heap_get_statistics(h).nactive, r);
+
+    // opening a heap another process holds the lock of waits for it
+    pthread_mutex_lock(&h->lock);
+    fflush(stdout);
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        h = m61_persistent_heap_open(path);
+        assert(h);
+        printf("second opener\n");
+        fflush(stdout);
+        _exit(0);
+    }
+    usleep(100000);
+    printf("first opener unlocks\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&h->lock);
+    waitpid(p, nullptr, 0);
+    m61_persistent_heap_close(h);
+
+    // a process that dies holding the lock leaves the heap to be recovered
+    p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        h = m61_persistent_heap_open(path);
+        assert(h);
+        strcpy((char*) m61_heap_malloc(h, 50), "fourth");
+        pthread_mutex_lock(&h->lock);
+        h->alloc_list_start = nullptr;    // lose the allocated list
+        _exit(0);
+    }
+    waitpid(p, nullptr, 0);
+
+    h = m61_persistent_heap_open(path);
+    assert(h);
+    m61_statistics stat = m61_heap_get_statistics(h);
+    printf("active %llu alloc list %zu\n", stat.nactive, count_list(h->alloc_list_start));
+
+    // corrupting a list is detected
+    h->free_list_start = nullptr;
+    r = m61_heap_recover(h);
+    printf("recover %d free list %zu\n", r, count_list(h->free_list_start));
+
+    m61_heap_free(h, m61_heap_pointer(h, a_offset));
+    m61_heap_free(h, m61_heap_pointer(h, c_offset));
+    printf("active %llu\n", m61_heap_get_statistics(h).nactive);
+    m61_persistent_heap_close(h);
+    unlink(path);
+}
+
+//! first third
+//! active 2 recover 0
+//! first opener unlocks
+//! second opener
+//! active 3 alloc list 3
+//! recover 1 free list 2
+//! active 1
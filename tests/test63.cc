@@ -0,0 +1,38 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check that rolling back a scope frees exactly the allocations made inside it.
+
+int main() {
+    char* keep = (char*) m61_malloc(10);
+    strcpy(keep, "keep me");
+
+    m61_scope outer = m61_scope_begin();
+    assert(outer);
+    for (int i = 0; i != 100; ++i) {
+        m61_malloc(1 + i);
+    }
+    // a block from before the scope survives being moved inside it
+    keep = (char*) m61_realloc(keep, 5000);
+
+    m61_scope inner = m61_scope_begin();
+    void* committed = m61_malloc(30);
+    m61_scope_commit(inner);
+    m61_scope dangling = m61_scope_begin();
+    m61_calloc(10, 10);
+    (void) committed, (void) dangling;
+
+    m61_scope_rollback(outer);
+    m61_scope_rollback(outer);
+    printf("%s\n", keep);
+    m61_print_statistics();
+    m61_print_leak_report();
+    m61_free(keep);
+}
+
+//! MEMORY BUG: test63.cc:27: invalid scope ??{0x\w+}??, not open
+//! keep me
+//! alloc count: active          1   total        104   fail          0
+//! alloc size:  active       5000   total        ???   fail          0
+//! LEAK CHECK: test63.cc:17: allocated object ??{0x\w+}?? with size 5000
@@ -0,0 +1,79 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <vector>
+// Stress allocation from several threads, including frees of blocks
+// allocated by another thread. Single-threaded unless built with PTHREAD=1.
+
+static std::atomic<void*> mailbox[8];
+
+static void* checked_alloc(unsigned& seed) {
+    seed = seed * 1103515245 + 12345;
+    size_t sz = 16 + (seed >> 8) % 2000;
+    char* p = (char*) (seed & 0x100 ? m61_calloc(1, sz) : m61_malloc(sz));
+    assert(p);
+    memset(p, (int) (sz & 0xFF), sz);
+    memcpy(p, &sz, sizeof(sz));
+    return p;
+}
+
+static void checked_free(void* ptr) {
+    size_t sz;
+    memcpy(&sz, ptr, sizeof(sz));
+    for (size_t i = sizeof(sz); i != sz; ++i) {
+        assert(((unsigned char*) ptr)[i] == (sz & 0xFF));
+    }
+    m61_free(ptr);
+}
+
+static void stress(int t, int nthreads) {
+    void* slots[64] = {};
+    unsigned seed = t + 1;
+
+    for (int i = 0; i != 5000; ++i) {
+        unsigned slot = (seed >> 4) % 64;
+        if (slots[slot]) {
+            checked_free(slots[slot]);
+        }
+        slots[slot] = checked_alloc(seed);
+        if (i % 16 == 0) {
+            // hand a block to the next thread and free whatever was left for us
+            void* theirs = mailbox[(t + 1) % nthreads].exchange(slots[slot]);
+            slots[slot] = nullptr;
+            if (theirs) {
+                checked_free(theirs);
+            }
+        }
+    }
+    for (void* ptr : slots) {
+        if (ptr) {
+            checked_free(ptr);
+        }
+    }
+}
+
+int main() {
+    int nthreads = M61_THREADS ? 8 : 1;
+    std::vector<std::thread> threads;
+    for (int t = 0; t != nthreads; ++t) {
+        threads.emplace_back(stress, t, nthreads);
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    for (auto& slot : mailbox) {
+        if (void* ptr = slot.exchange(nullptr)) {
+            checked_free(ptr);
+        }
+    }
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.nactive == 0 && stat.active_size == 0);
+    assert(stat.ntotal == stat.nfree);
+    printf("nactive %llu\n", (unsigned long long) stat.nactive);
+    m61_print_leak_report();
+}
+
+//! nactive 0
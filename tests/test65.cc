@@ -0,0 +1,42 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <thread>
+#include <vector>
+// Check that threads allocate from separate arenas and that blocks are
+// freed into the arena they came from. Single-threaded unless built with
+// PTHREAD=1.
+
+int main() {
+    int nthreads = M61_THREADS ? 4 : 1;
+    std::vector<void*> ptrs(nthreads);
+    std::vector<std::thread> threads;
+
+    // each arena has room for one of these, the default heap for only one
+    for (int t = 0; t != nthreads; ++t) {
+        threads.emplace_back([&ptrs, t] {
+            ptrs[t] = m61_malloc(6 << 20);
+            assert(ptrs[t]);
+            memset(ptrs[t], t, 6 << 20);
+        });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    // the main thread frees every block, whichever arena it is in
+    for (void* ptr : ptrs) {
+        m61_free(ptr);
+    }
+    void* again = m61_malloc(6 << 20);
+    assert(again);
+    m61_free(again);
+
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.ntotal == (unsigned long long) nthreads + 1);
+    printf("nactive %llu nfail %llu\n", stat.nactive, stat.nfail);
+    m61_print_leak_report();
+}
+
+//! nactive 0 nfail 0
@@ -0,0 +1,66 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <atomic>
+#include <thread>
+// Check that blocks freed by another thread are returned to their arena:
+// one thread allocates 12 MiB in rounds while another frees each round.
+// Single-threaded unless built with PTHREAD=1.
+
+static void* blocks[64];
+static std::atomic<int> round_done(-1);
+static std::atomic<int> round_freed(-1);
+
+static void produce(int round) {
+    for (void*& ptr : blocks) {
+        ptr = m61_malloc(2000);
+        assert(ptr);
+        memset(ptr, round, 2000);
+    }
+}
+
+static void consume() {
+    for (void* ptr : blocks) {
+        m61_free(ptr);
+    }
+}
+
+int main() {
+    if (M61_THREADS) {
+        std::thread producer([] {
+            for (int round = 0; round != 100; ++round) {
+                while (round_freed.load() != round - 1) {
+                    std::this_thread::yield();
+                }
+                produce(round);
+                round_done.store(round);
+            }
+        });
+        for (int round = 0; round != 100; ++round) {
+            while (round_done.load() != round) {
+                std::this_thread::yield();
+            }
+            if (round != 99) {
+                consume();
+            }
+            round_freed.store(round);
+        }
+        producer.join();
+    } else {
+        for (int round = 0; round != 100; ++round) {
+            produce(round);
+            if (round != 99) {
+                consume();
+            }
+        }
+    }
+
+    consume();
+    m61_free(blocks[0]);
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu nfail %llu\n", stat.nactive, stat.nfail);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, double free
+//! nactive 0 nfail 0
@@ -0,0 +1,78 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <vector>
+// Check per-thread statistics: thread t allocates (t + 1) * 100 blocks of
+// 100 bytes, and the breakdown attributes each count to its thread. The
+// totals outlive the threads. Single-threaded unless built with PTHREAD=1.
+
+static std::atomic<int> nready(0);
+static std::atomic<bool> done(false);
+
+static void work(int t, pthread_t* self) {
+    *self = pthread_self();
+    std::vector<void*> ptrs;
+    for (int i = 0; i != (t + 1) * 100; ++i) {
+        ptrs.push_back(m61_malloc(100));
+        assert(ptrs.back());
+    }
+    for (size_t i = 0; i != ptrs.size(); i += 2) {
+        m61_free(ptrs[i]);
+    }
+    ++nready;
+    while (M61_THREADS && !done.load()) {
+        std::this_thread::yield();
+    }
+    for (size_t i = 1; i < ptrs.size(); i += 2) {
+        m61_free(ptrs[i]);
+    }
+}
+
+int main() {
+    pthread_t selves[3];
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 3; ++t) {
+        if (M61_THREADS) {
+            threads.emplace_back(work, t, &selves[t]);
+        }
+    }
+    if (M61_THREADS) {
+        while (nready.load() != 3) {
+            std::this_thread::yield();
+        }
+
+        m61_thread_statistics ts[8];
+        size_t n = m61_get_thread_statistics(ts, 8);
+        assert(n == 3);
+        for (int t = 0; t != 3; ++t) {
+            size_t i = 0;
+            while (i != n && !pthread_equal(ts[i].thread, selves[t])) {
+                ++i;
+            }
+            assert(i != n);
+            assert(ts[i].stats.ntotal == (t + 1) * 100u);
+            assert(ts[i].stats.total_size == (t + 1) * 10000u);
+            assert(ts[i].stats.nfree == (t + 1) * 50u);
+            assert(ts[i].stats.nactive == (t + 1) * 50u);
+        }
+        done.store(true);
+        for (auto& th : threads) {
+            th.join();
+        }
+    } else {
+        for (int t = 0; t != 3; ++t) {
+            work(t, &selves[t]);
+        }
+        m61_thread_statistics ts[1];
+        assert(m61_get_thread_statistics(ts, 1) == 1);
+        assert(ts[0].stats.ntotal == 600);
+    }
+
+    m61_statistics stat = m61_get_statistics();
+    printf("ntotal %llu nfree %llu nactive %llu total_size %llu\n",
+           stat.ntotal, stat.nfree, stat.nactive, stat.total_size);
+}
+
+//! ntotal 600 nfree 600 nactive 0 total_size 60000
@@ -0,0 +1,77 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <atomic>
+#include <thread>
+// Check epoch-based retirement: a reader thread follows a shared pointer
+// inside critical sections while the main thread replaces and retires the
+// node it points to. Retired nodes stay intact while a reader may hold
+// them. Single-threaded unless built with PTHREAD=1.
+
+struct node {
+    long value;
+    long check;
+};
+
+static std::atomic<node*> shared(nullptr);
+static std::atomic<bool> done(false);
+
+static node* make_node(long value) {
+    node* n = (node*) m61_malloc(sizeof(node));
+    assert(n);
+    n->value = n->check = value;
+    return n;
+}
+
+static void read_once() {
+    m61_epoch_enter();
+    node* n = shared.load();
+    assert(n->value == n->check);
+    m61_epoch_exit();
+}
+
+int main() {
+    shared.store(make_node(-1));
+    std::thread reader;
+    if (M61_THREADS) {
+        reader = std::thread([] {
+            while (!done.load()) {
+                read_once();
+            }
+        });
+    }
+    for (long i = 0; i != 5000; ++i) {
+        m61_retire(shared.exchange(make_node(i)));
+        if (!M61_THREADS) {
+            read_once();
+        }
+    }
+    done.store(true);
+    if (M61_THREADS) {
+        reader.join();
+    }
+
+    // a block retired inside a critical section outlives it
+    m61_epoch_enter();
+    node* old = shared.exchange(make_node(5000));
+    m61_retire(old);
+    m61_epoch_reclaim();
+    assert(old->value == 4999 && old->check == 4999);
+    m61_epoch_exit();
+
+    m61_epoch_reclaim();
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu ntotal %llu\n", stat.nactive, stat.ntotal);
+    fflush(stdout);
+
+    node* last = shared.load();
+    m61_retire(last);
+    m61_free(last);
+    m61_epoch_reclaim();
+    stat = m61_get_statistics();
+    printf("nactive %llu\n", stat.nactive);
+}
+
+//! nactive 1 ntotal 5002
+//! MEMORY BUG???: invalid free of pointer ???, double free
+//! nactive 0
@@ -0,0 +1,52 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <cerrno>
+// Check aligned allocation: payloads are aligned, leading slack is given
+// back to the heap, and aligned blocks free like any other.
+
+int main() {
+    void* ptrs[40];
+    size_t aligns[] = {32, 64, 256, 4096, 65536};
+    int n = 0;
+
+    for (int round = 0; round != 8; ++round) {
+        for (size_t align : aligns) {
+            ptrs[n] = m61_aligned_alloc(align, 100 + round * 37);
+            assert(ptrs[n] && (uintptr_t) ptrs[n] % align == 0);
+            memset(ptrs[n], round, 100 + round * 37);
+            ++n;
+        }
+    }
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.nactive == 40);
+    // the slack in front of each block went back to the free list
+    assert(stat.heap_max - stat.heap_min < 8 * 65536 + 4 * 65536);
+    for (int i = 0; i != n; i += 2) {
+        m61_free(ptrs[i]);
+    }
+    for (int i = 1; i < n; i += 2) {
+        m61_free(ptrs[i]);
+    }
+
+    // everything coalesces back into one free block
+    size_t* free_list = m61_get_free_list();
+    assert(free_list != nullptr && *LIST_NEXT(free_list) == nullptr);
+
+    void* ptr;
+    assert(m61_posix_memalign(&ptr, 24, 10) == EINVAL);
+    assert(m61_aligned_alloc(48, 10) == nullptr);
+    assert(m61_posix_memalign(&ptr, 128, 10) == 0 && (uintptr_t) ptr % 128 == 0);
+    m61_free(ptr);
+    ptr = m61_memalign(48, 10);
+    assert((uintptr_t) ptr % 64 == 0);
+    m61_free(ptr);
+    m61_free(ptr);
+
+    stat = m61_get_statistics();
+    printf("nactive %llu nfail %llu\n", stat.nactive, stat.nfail);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, double free
+//! nactive 0 nfail 0
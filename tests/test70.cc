@@ -0,0 +1,49 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check usable sizes: every byte m61_usable_size reports can be written
+// without a wild-write report, and the slack claimed by
+// m61_malloc_at_least is counted.
+
+int main() {
+    char* a = (char*) m61_malloc(1);
+    size_t usable = m61_usable_size(a);
+    assert(usable == 1);
+    memset(a, 'a', usable);
+    assert(m61_usable_size(a + 1) == 0);
+
+    size_t actual;
+    char* b = (char*) m61_malloc_at_least(100, &actual);
+    assert(b && actual >= 100 && actual % ALIGNMENT == 0 && actual < 100 + ALIGNMENT);
+    memset(b, 'b', actual);
+    assert(m61_usable_size(b) == actual);
+
+    m61_allocator<int> alloc;
+    auto result = alloc.allocate_at_least(5);
+    assert(result.ptr && result.count >= 5);
+    for (size_t i = 0; i != result.count; ++i) {
+        result.ptr[i] = i;
+    }
+
+    m61_statistics stat = m61_get_statistics();
+    printf("active_size %llu\n", stat.active_size);
+    fflush(stdout);
+    alloc.deallocate(result.ptr, result.count);
+    m61_free(b);
+    m61_free(a);
+
+    // the reported size is safe to fill
+    char* c = (char*) m61_malloc(10);
+    usable = m61_usable_size(c);
+    assert(usable >= 10);
+    memset(c, 'c', usable);
+    m61_free(c);
+    assert(m61_usable_size(c) == 0);
+
+    stat = m61_get_statistics();
+    printf("nactive %llu\n", stat.nactive);
+}
+
+//! active_size 145
+//! nactive 0
@@ -0,0 +1,40 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <vector>
+// Check sized frees: matching sizes free quickly, a size larger than the
+// allocation is reported, and bad pointers still get the full checks.
+
+int main() {
+    void* ptrs[100];
+    for (int i = 0; i != 100; ++i) {
+        ptrs[i] = m61_malloc(i * 13 + 1);
+    }
+    for (int i = 0; i != 100; ++i) {
+        m61_free_sized(ptrs[i], i * 13 + 1);
+    }
+
+    std::vector<int, m61_allocator<int>> v;
+    for (int i = 0; i != 1000; ++i) {
+        v.push_back(i);
+    }
+    v.clear();
+    v.shrink_to_fit();
+
+    void* a = m61_malloc(40);
+    m61_free_sized(a, 41);
+    m61_free_sized(a, 39);
+    m61_free_sized(a, 40);
+    char* b = (char*) m61_calloc(100, 1);
+    m61_free_sized(b + 16, 1);
+    m61_free_sized(b, 100);
+
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu\n", stat.nactive);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, size 41 larger than the 40 bytes allocated
+//! MEMORY BUG???: invalid free of pointer ???, double free
+//! MEMORY BUG???: invalid free of pointer ???, not allocated
+//! ???
+//! nactive 0
@@ -0,0 +1,52 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <random>
+#include <algorithm>
+// Check batch allocation and free: a batch is carved side by side from one
+// free block, and freeing it in any order coalesces back to one free block.
+
+int main() {
+    void* ptrs[302];
+    size_t n = m61_malloc_batch(48, 300, ptrs);
+    assert(n == 300);
+    for (int i = 0; i != 300; ++i) {
+        assert((uintptr_t) ptrs[i] % ALIGNMENT == 0);
+        if (i != 0) {
+            assert((char*) ptrs[i] - (char*) ptrs[i - 1] == (ptrdiff_t) m61_get_adjusted_size(48));
+        }
+        memset(ptrs[i], i, 48);
+    }
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.nactive == 300 && stat.active_size == 300 * 48);
+
+    // the batch is on the allocated list like any other blocks
+    void* other = m61_malloc(10);
+    m61_free(ptrs[7]);
+    ptrs[7] = other;
+
+    std::mt19937 rng(61);
+    std::shuffle(ptrs, ptrs + 300, rng);
+    ptrs[300] = nullptr;
+    ptrs[301] = ptrs[42];
+    m61_free_batch(ptrs, 302);
+
+    size_t* free_list = m61_get_free_list();
+    assert(free_list != nullptr && *LIST_NEXT(free_list) == nullptr);
+    assert(m61_get_alloc_list() == nullptr);
+
+    void* big[2];
+    assert(m61_malloc_batch(8 << 20, 2, big) == 0 && big[0] == nullptr);
+
+    // a batch whose total size overflows fails without touching the heap
+    void* huge[4];
+    assert(m61_malloc_batch(((size_t) 1 << 62) - ALLOC_META_SIZE, 4, huge) == 0);
+    assert(huge[0] == nullptr && huge[3] == nullptr);
+
+    stat = m61_get_statistics();
+    printf("nactive %llu ntotal %llu nfail %llu\n", stat.nactive, stat.ntotal, stat.nfail);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, double free
+//! nactive 0 ntotal 301 nfail 6
@@ -0,0 +1,74 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check in-place realloc: growing takes whole free neighbors, even when
+// nothing is left over, moving down into the previous block with its data;
+// m61_try_expand never moves; and a failed move leaves the block alone.
+
+static void fill(char* ptr, size_t sz) {
+    for (size_t i = 0; i != sz; ++i) {
+        ptr[i] = (char) i;
+    }
+}
+
+static void check(char* ptr, size_t sz) {
+    for (size_t i = 0; i != sz; ++i) {
+        assert(ptr[i] == (char) i);
+    }
+}
+
+int main() {
+    // the next block fits exactly
+    char* blocks[3];
+    m61_malloc_batch(100, 3, (void**) blocks);      // side by side
+    char* a = blocks[0];
+    char* b = blocks[1];
+    char* guard1 = blocks[2];
+    fill(a, 100);
+    m61_free(b);
+    m61_tcache_flush();
+    char* a2 = (char*) m61_realloc(a, 100 + m61_get_adjusted_size(100));
+    assert(a2 == a);
+    check(a2, 100);
+
+    // the previous block fits, with its data moved down
+    m61_malloc_batch(100, 3, (void**) blocks);
+    char* c = blocks[0];
+    char* d = blocks[1];
+    char* guard2 = blocks[2];
+    fill(d, 100);
+    m61_free(c);
+    m61_tcache_flush();
+    char* d2 = (char*) m61_realloc(d, 250);
+    assert(d2 == c);
+    check(d2, 100);
+
+    // try_expand grows into the next block but never moves
+    m61_malloc_batch(100, 3, (void**) blocks);
+    char* e = blocks[0];
+    char* f = blocks[1];
+    char* guard3 = blocks[2];
+    fill(e, 100);
+    m61_free(f);
+    m61_tcache_flush();
+    assert(m61_try_expand(e, 200));
+    check(e, 100);
+    assert(!m61_try_expand(e, 5000));
+    memset(e + 100, 0, 100);
+
+    // a move that cannot be satisfied returns nullptr and keeps the block
+    assert(m61_realloc(e, 8 << 20) == nullptr);
+    check(e, 100);
+
+    m61_free(a2);
+    m61_free(d2);
+    m61_free(e);
+    m61_free(guard1);
+    m61_free(guard2);
+    m61_free(guard3);
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu nfail %llu\n", stat.nactive, stat.nfail);
+}
+
+//! nactive 0 nfail 1
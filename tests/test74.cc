@@ -0,0 +1,49 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check realloc reserves: a block grown over and over from one site moves
+// O(log n) times even when every growth is followed by an allocation, and
+// its reserve is given back when memory runs out.
+
+int main() {
+    char* builder = (char*) m61_malloc(8);
+    void* others[2000];
+    int moves = 0;
+    for (int i = 0; i != 2000; ++i) {
+        char* grown = (char*) m61_realloc(builder, 8 * (i + 2));
+        assert(grown);
+        moves += grown != builder;
+        builder = grown;
+        memset(builder, 'b', 8 * (i + 2));
+        others[i] = m61_malloc(16);     // would sit right after an exact block
+    }
+    assert(moves < 40);
+    for (void* ptr : others) {
+        m61_free(ptr);
+    }
+    m61_free(builder);
+
+    // a reserve is trimmed to make room for a big allocation
+    char* big = nullptr;
+    for (size_t sz : {1 << 20, 2 << 20, (2 << 20) + 16}) {
+        big = (char*) m61_realloc(big, sz);
+        assert(big);
+    }
+    void* other = m61_malloc((5 << 20) + (1 << 19));
+    assert(other);
+    memset(big, 'x', (2 << 20) + 16);
+    m61_free(other);
+
+    // and on shrink
+    big = (char*) m61_realloc(big, 100);
+    other = m61_malloc(7 << 20);
+    assert(other);
+    m61_free(other);
+    m61_free(big);
+
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu nfail %llu\n", stat.nactive, stat.nfail);
+}
+
+//! nactive 0 nfail 0
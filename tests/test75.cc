@@ -0,0 +1,50 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <list>
+#include <utility>
+// Check compile-time size classes: they agree with the run-time ones, and
+// m61_malloc<N>/m61_free<N> and single-object m61_allocator calls use them.
+
+template <size_t... Ns>
+static void check_classes(std::index_sequence<Ns...>) {
+    ((void) assert(m61_size_class(Ns + 1) == m61_get_adjusted_size(Ns + 1)), ...);
+}
+
+struct node {
+    long key;
+    char name[40];
+};
+
+int main() {
+    check_classes(std::make_index_sequence<300>());
+
+    void* small = m61_malloc<1>();
+    void* medium = m61_malloc<sizeof(node)>();
+    void* large = m61_malloc<5000>();
+    assert(small && medium && large);
+    memset(large, 0, 5000);
+    assert(*REQ_SIZE_FROM_PAYLOAD(medium) == sizeof(node));
+    m61_free<1>(small);
+    m61_free<sizeof(node)>(medium);
+    m61_free<5000>(large);
+
+    {
+        std::list<node, m61_allocator<node>> nodes;
+        for (long i = 0; i != 100; ++i) {
+            nodes.push_back(node{i, "n"});
+        }
+        assert(m61_get_statistics().nactive == 100);
+    }
+
+    void* ptr = m61_malloc<100>();
+    m61_free<200>(ptr);
+    m61_free<100>(ptr);
+
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu ntotal %llu\n", stat.nactive, stat.ntotal);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, size 200 larger than the 100 bytes allocated
+//! nactive 0 ntotal 104
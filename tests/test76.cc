@@ -0,0 +1,66 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#include <unistd.h>
+// Check m61_memory_resource and heap-bound m61_allocators: they honor
+// alignment, send blocks to their heap, and record their construction site.
+
+struct alignas(64) line_buffer {
+    char bytes[64];
+};
+
+int main() {
+    m61_memory_resource resource;
+    {
+        std::pmr::vector<int> v(&resource);
+        std::pmr::map<int, std::pmr::string> m(&resource);
+        for (int i = 0; i != 100; ++i) {
+            v.push_back(i);
+            m.emplace(i, "a string too long for the small-string buffer");
+        }
+        assert(m61_get_statistics().nactive > 100);
+    }
+    assert(m61_get_statistics().nactive == 0);
+
+    void* aligned = resource.allocate(100, 256);
+    assert((uintptr_t) aligned % 256 == 0);
+    resource.deallocate(aligned, 100, 256);
+
+    m61_memory_resource other;
+    assert(resource.is_equal(other));
+    assert(!resource.is_equal(*std::pmr::new_delete_resource()));
+
+    char name[64];
+    snprintf(name, sizeof(name), "/m61-test76-%d", (int) getpid());
+    m61_heap* h = m61_shared_heap_open(name, 1 << 20);
+    assert(h);
+    m61_memory_resource shared(h);
+    assert(!resource.is_equal(shared));
+    {
+        std::pmr::vector<long> v(&shared);
+        v.resize(1000);
+        assert(m61_heap_get_statistics(h).nactive == 1);
+        assert(m61_get_statistics().nactive == 0);
+
+        std::vector<line_buffer, m61_allocator<line_buffer>> lines{m61_allocator<line_buffer>(h)};
+        lines.resize(3);
+        assert((uintptr_t) lines.data() % 64 == 0);
+        assert(m61_heap_get_statistics(h).nactive == 2);
+    }
+    assert(m61_heap_get_statistics(h).nactive == 0);
+    m61_shared_heap_close(h);
+    m61_shared_heap_unlink(name);
+
+    m61_allocator<int> sited(nullptr);
+    m61_allocator<long> rebound(sited);
+    assert(rebound == sited && rebound.line() == sited.line());
+    long* leaked = rebound.allocate(5);     // recorded at sited's construction
+    assert(leaked);
+    m61_print_leak_report();
+}
+
+//! LEAK CHECK: test???.cc:58: allocated object ??{\w+}?? with size 40
@@ -0,0 +1,73 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <list>
+#include <map>
+#include <unordered_map>
+// Check slot pools: objects come from slabs, cached objects are constructed
+// once, node containers share pools, and leak reports show pools in use.
+
+static int nconstructed = 0;
+
+struct connection {
+    char buffer[100];
+    int fd;
+    connection() : fd(-1) {
+        ++nconstructed;
+    }
+    explicit connection(int f) : fd(f) {
+        ++nconstructed;
+    }
+};
+
+int main() {
+    m61_pool<connection> pool(16);
+    connection* c[20];
+    for (int i = 0; i != 20; ++i) {
+        c[i] = pool.create(i);
+        assert(c[i] && c[i]->fd == i);
+    }
+    assert((char*) c[1] - (char*) c[0] == 104);   // slots are packed
+    assert(pool.slot_pool()->nslabs == 2 && pool.slot_pool()->nlive == 20);
+    assert(m61_get_statistics().nactive == 3);      // the pool and two slabs
+    pool.destroy(c[7]);
+    assert(pool.create(70) == c[7]);
+    for (int i = 0; i != 20; ++i) {
+        pool.destroy(c[i]);
+    }
+
+    {
+        m61_pool<connection, true> cache;
+        nconstructed = 0;
+        connection* a = cache.acquire();
+        a->fd = 3;
+        cache.release(a);
+        connection* b = cache.acquire();
+        assert(b == a && b->fd == 3 && nconstructed == 1);
+        cache.release(b);
+    }
+
+    connection* leaked = pool.create(9);
+    assert(leaked);
+    m61_print_leak_report();
+    pool.destroy(leaked);
+
+    {
+        size_t before = m61_get_statistics().nactive;
+        std::map<int, int, std::less<int>, m61_node_allocator<std::pair<const int, int>>> m;
+        std::list<int, m61_node_allocator<int>> l;
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           m61_node_allocator<std::pair<const int, int>>> u;
+        for (int i = 0; i != 1000; ++i) {
+            m[i] = i;
+            l.push_back(i);
+            u[i] = i;
+        }
+        assert(m61_get_statistics().nactive - before < 100);
+    }
+}
+
+//! LEAK CHECK: test???.cc:24: allocated object ??{\w+}?? with size 1672
+//! LEAK CHECK: test???.cc:24: allocated object ??{\w+}?? with size 1672
+//! LEAK CHECK: test???.cc:24: allocated object ??{\w+}?? with size ??{\d+}??
+//! LEAK CHECK: test???.cc:24: pool of 104-byte slots with 1 of 32 slots in use
@@ -0,0 +1,53 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check tagged allocations: per-tag statistics, budgets that fail fast,
+// tags kept across realloc, and freeing a whole tag at once.
+
+enum { TAG_CACHE = 1, TAG_PARSER = 2 };
+
+int main() {
+    void* untagged = m61_malloc(100);
+    void* cache[10];
+    for (int i = 0; i != 10; ++i) {
+        cache[i] = m61_malloc_tagged(100, TAG_CACHE);
+        assert(cache[i]);
+    }
+    void* parser = m61_malloc_tagged(50, TAG_PARSER);
+    assert(parser);
+
+    m61_statistics stat = m61_get_tag_statistics(TAG_CACHE);
+    assert(stat.nactive == 10 && stat.active_size == 1000);
+    assert(m61_get_statistics().nactive == 12);
+
+    m61_free(cache[0]);
+    cache[1] = m61_realloc(cache[1], 400);
+    assert(cache[1]);
+    stat = m61_get_tag_statistics(TAG_CACHE);
+    assert(stat.nactive == 9 && stat.active_size == 1200 && stat.nfree == 2);
+
+    m61_set_tag_budget(TAG_PARSER, 1000);
+    void* big = m61_malloc_tagged(951, TAG_PARSER);
+    assert(big == nullptr);
+    void* fits = m61_malloc_tagged(950, TAG_PARSER);
+    assert(fits);
+    stat = m61_get_tag_statistics(TAG_PARSER);
+    assert(stat.nactive == 2 && stat.nfail == 1 && stat.fail_size == 951);
+    assert(m61_get_statistics().nfail == 0);
+
+    size_t n = m61_free_tag(TAG_CACHE);
+    stat = m61_get_tag_statistics(TAG_CACHE);
+    printf("freed %zu, %llu active\n", n, stat.nactive);
+    m61_free(untagged);
+    m61_free(parser);
+    m61_free(fits);
+    stat = m61_get_statistics();
+    printf("nactive %llu\n", stat.nactive);
+    fflush(stdout);
+    m61_free(cache[5]);
+}
+
+//! freed 9, 0 active
+//! nactive 0
+//! MEMORY BUG???: invalid free of pointer ???
@@ -0,0 +1,49 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+// Check reserved blocks: allocations of the reserved size class are served
+// from them side by side, other classes are not, statistics count reserved
+// versus used blocks, and reserved blocks cannot be freed.
+
+int main() {
+    void* early = m61_malloc(10);
+    assert(m61_reserve(200, 16) == 16);
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.nreserved == 16 && stat.nreserved_used == 0 && stat.nactive == 1);
+
+    void* other = m61_malloc(100);      // another size class
+    void* p[16];
+    for (int i = 0; i != 16; ++i) {
+        p[i] = m61_malloc(200 - i % 8);   // all in the class of 200 bytes
+        assert(p[i]);
+        assert(i == 0 || (char*) p[i] - (char*) p[i - 1] == 272);
+    }
+    assert(other < p[0] || other > p[15]);
+    stat = m61_get_statistics();
+    assert(stat.nreserved_used == 16 && stat.nactive == 18);
+    for (int i = 0; i != 16; ++i) {
+        m61_free(p[i]);
+    }
+    m61_free(other);
+
+    assert(m61_reserve(1000, 4) == 4);
+    m61_print_statistics();
+    m61_print_leak_report();
+    assert(m61_release_reserved(1000) == 4);
+    assert(m61_release_reserved(1000) == 0);
+    stat = m61_get_statistics();
+    assert(stat.nreserved == 16);
+
+    assert(m61_reserve(100, 2) == 2);
+    char* q = (char*) m61_malloc(100);
+    m61_free(q);
+    fflush(stdout);
+    m61_free(q + 176);                  // the second block, never handed out
+    m61_free(early);
+}
+
+//! alloc count: active          1   total         18   fail          0
+//! alloc size:  active         10   total ??{\d+}??   fail          0
+//! reserved:    blocks         20   used          16
+//! LEAK CHECK: test???.cc:9: allocated object ??{\w+}?? with size 10
+//! MEMORY BUG???: invalid free of pointer ???, not allocated
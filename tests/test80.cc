@@ -0,0 +1,73 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Check relocatable allocations: compaction slides unlocked objects down,
+// keeps their contents, leaves locked and ordinary blocks in place, and
+// merges the free space; allocations that find no fit compact first.
+
+int main() {
+    m61_handle h[40];
+    void* pinned[5];
+    for (int i = 0; i != 40; ++i) {
+        h[i] = m61_halloc(2000);
+        assert(h[i]);
+        memset(m61_hlock(h[i]), i, 2000);
+        m61_hunlock(h[i]);
+        if (i % 8 == 7)
+            pinned[i / 8] = m61_malloc(2000);
+    }
+    for (int i = 0; i < 40; i += 2) {
+        m61_hfree(h[i]);
+    }
+    char* locked = (char*) m61_hlock(h[39]);
+
+    m61_fragmentation before = m61_get_fragmentation();
+    assert(m61_compact(1) == 2080);         // one block at a time, if asked
+    assert(m61_compact() != 0);
+    assert(m61_compact() == 0);
+    m61_fragmentation after = m61_get_fragmentation();
+    assert(after.free_size == before.free_size);
+    assert(after.nfree_blocks < before.nfree_blocks && after.ratio <= before.ratio);
+
+    assert(m61_hlock(h[39]) == locked);
+    m61_hunlock(h[39]);
+    m61_hunlock(h[39]);
+    for (int i = 1; i < 40; i += 2) {
+        char* p = (char*) m61_hlock(h[i]);
+        assert(p[0] == i && p[1999] == i);
+        m61_hunlock(h[i]);
+    }
+
+    // fill the heap with objects and free every other one
+    static m61_handle fill[16 << 10];
+    int n = 0;
+    while ((fill[n] = m61_halloc(900)) != nullptr) {
+        ++n;
+    }
+    for (int i = 0; i < n; i += 2) {
+        m61_hfree(fill[i]);
+    }
+    assert(m61_get_fragmentation().largest_free < (1 << 20));
+    void* big = m61_malloc(1 << 20);
+    assert(big);
+    m61_free(big);
+    for (int i = 1; i < n; i += 2) {
+        m61_hfree(fill[i]);
+    }
+    for (int i = 0; i != 5; ++i) {
+        m61_free(pinned[i]);
+    }
+    for (int i = 3; i < 40; i += 2) {
+        m61_hfree(h[i]);
+    }
+
+    m61_print_leak_report();
+    fflush(stdout);
+    m61_hunlock(h[1]);
+    m61_hfree(h[3]);
+}
+
+//! LEAK CHECK: test???.cc:13: allocated relocatable object ??{\w+}?? with size 2000
+//! MEMORY BUG???: invalid unlock of handle ???, not locked
+//! MEMORY BUG???: invalid free of handle ???, not allocated
@@ -0,0 +1,67 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+// Check sampled allocations: objects end at the end of a page, survive
+// realloc, count in the statistics and the leak report, and accesses past
+// either end or after the free fault and are reported with the site that
+// allocated them.
+
+static void expect_fault(void (*access)(char*), char* ptr) {
+    fflush(stdout);
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        access(ptr);
+        _exit(0);
+    }
+    int status;
+    waitpid(p, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+}
+
+int main() {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    signal(SIGSEGV, SIG_DFL);       // faults reach this after m61's report,
+    m61_set_sample_rate(1);         // not a sanitizer's
+    char* p = (char*) m61_malloc(100);
+    assert(((uintptr_t) p + 112) % page == 0);
+    memset(p, 'x', 100);
+    p = (char*) m61_realloc(p, page);
+    assert((uintptr_t) p % page == 0 && p[99] == 'x');
+    char* big = (char*) m61_malloc(page + 1);   // only objects up to a page
+    char* q = (char*) m61_malloc(30);
+    m61_statistics stat = m61_get_statistics();
+    assert(stat.nsampled == 3 && stat.nactive == 3);
+
+    expect_fault([](char* x) { x[32] = 1; }, q);
+    expect_fault([](char* x) { x[-1] = 1; }, p);
+    m61_free(q);
+    expect_fault([](char* x) { (void) *(volatile char*) (x + 10); }, q);
+    m61_free(q);
+
+    q = (char*) m61_malloc(20);
+    q[20] = 1;                                  // short of the guard page
+    m61_free(q);
+    m61_set_sample_rate(0);
+    m61_free(m61_malloc(20));
+    m61_free(big);
+    stat = m61_get_statistics();
+    assert(stat.nsampled == 4 && stat.nactive == 2);
+    m61_print_leak_report();
+}
+
+//! MEMORY BUG: invalid access at ???, 2 bytes past the end of a 30 byte region
+//! ???test81.cc:36: region ??? allocated here
+//! MEMORY BUG: invalid access at ???, 1 bytes before a 4096 byte region
+//! ???test81.cc:33: region ??? allocated here
+//! MEMORY BUG: invalid access at ???, 10 bytes into a freed 30 byte region
+//! ???test81.cc:36: region ??? allocated here
+//! ???test81.cc:42: and freed here
+//! MEMORY BUG???: invalid free of pointer ???, double free
+//! MEMORY BUG???: detected wild write during free of pointer ???
+//! LEAK CHECK: test???.cc:33: allocated object ??{\w+}?? with size 4096
+//! LEAK CHECK: test???.cc:46: allocated object ??{\w+}?? with size 20
@@ -0,0 +1,61 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+// Check that a thread whose arena is contended does not move to another
+// arena while it has a scope open, so rolling the scope back frees
+// everything allocated inside it. Single-threaded unless built with
+// PTHREAD=1.
+
+int main() {
+    std::atomic<bool> done(false);
+    std::vector<void*> padding;
+    std::thread helper;
+
+    // the helper keeps walking the main thread's arena, which holds its
+    // lock against the main thread most of the time
+    for (int i = 0; i != 10000; ++i) {
+        padding.push_back(m61_malloc(1));
+    }
+    m61_scope scope = m61_scope_begin();
+    assert(scope);
+    if (M61_THREADS) {
+        helper = std::thread([&done] {
+            while (!done.load()) {
+                m61_free_tag(1);
+            }
+        });
+    }
+
+    char* first = (char*) m61_malloc(2048);
+    bool same_arena = true;
+    for (int i = 0; i != 100; ++i) {
+        usleep(100);
+        char* p = (char*) m61_malloc(2048);
+        assert(p);
+        if (p < first - M61_HEAP_SIZE || p > first + M61_HEAP_SIZE) {
+            same_arena = false;
+        }
+        if (i % 2 != 0) {
+            m61_free(p);
+        }
+    }
+    done = true;
+    if (M61_THREADS) {
+        helper.join();
+    }
+
+    m61_scope_rollback(scope);
+    for (void* ptr : padding) {
+        m61_free(ptr);
+    }
+    m61_statistics stat = m61_get_statistics();
+    printf("same arena %d nactive %llu\n", same_arena, stat.nactive);
+    m61_print_leak_report();
+}
+
+//! same arena 1 nactive 0
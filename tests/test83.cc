@@ -0,0 +1,55 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+// Check that a block freed into the arena of a thread that has gone idle
+// is reclaimed without that thread's help. Single-threaded unless built
+// with PTHREAD=1.
+
+int main() {
+    std::mutex m;
+    std::condition_variable cv;
+    int stage = 0;
+    void* big = nullptr;
+    char* small = nullptr;
+
+    void* mine = m61_malloc(10);    // the owner gets an arena of its own
+    std::thread owner([&] {
+        big = m61_malloc(6 << 20);
+        small = (char*) m61_malloc(2048);    // too big for the thread cache
+        assert(big && small);
+        strcpy(small, "owner");
+        std::unique_lock<std::mutex> guard(m);
+        stage = 1;
+        cv.notify_all();
+        cv.wait(guard, [&] { return stage == 2; });
+    });
+    {
+        std::unique_lock<std::mutex> guard(m);
+        cv.wait(guard, [&] { return stage == 1; });
+    }
+
+    // the owner is blocked, so it never drains its arena's queue; the
+    // grown block only fits where `big` was
+    m61_free(big);
+    small = (char*) m61_realloc(small, 7 << 20);
+    assert(small);
+    printf("%s\n", small);
+    m61_free(small);
+
+    {
+        std::unique_lock<std::mutex> guard(m);
+        stage = 2;
+        cv.notify_all();
+    }
+    owner.join();
+    m61_free(mine);
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu nfail %llu\n", stat.nactive, stat.nfail);
+}
+
+//! owner
+//! nactive 0 nfail 0
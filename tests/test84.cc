@@ -0,0 +1,116 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+// Check that scopes hold only the blocks of the thread that opened them,
+// even when other threads allocate in the same arena, with scopes of their
+// own or not: committed blocks survive, and a rollback frees no other
+// thread's blocks. Single-threaded unless built with PTHREAD=1.
+
+int main() {
+    const int nthreads = M61_THREADS ? 16 : 0;     // more threads than arenas
+    std::mutex m;
+    std::condition_variable cv;
+    int nready = 0;
+    int ndone = 0;
+    int stage = 0;
+    std::vector<std::thread> threads;
+    char* kept[10];
+
+    m61_scope committed = m61_scope_begin();
+    assert(committed);
+    for (int i = 0; i != 10; ++i) {
+        kept[i] = (char*) m61_malloc(100);
+        memset(kept[i], 'k', 100);
+    }
+
+    for (int i = 0; i != nthreads; ++i) {
+        threads.emplace_back([&, i] {
+            m61_scope s = nullptr;
+            char* p;
+            if (i % 4 == 1) {           // a scope of its own, rolled back
+                s = m61_scope_begin();
+                m61_malloc(100);
+                m61_scope_rollback(s);
+                s = nullptr;
+                p = (char*) m61_malloc(100);
+            } else if (i % 4 == 3) {    // a scope of its own, committed later
+                s = m61_scope_begin();
+                p = (char*) m61_malloc(100);
+            } else {
+                p = (char*) m61_malloc(100);
+            }
+            assert(p);
+            snprintf(p, 100, "thread %d", i);
+
+            std::unique_lock<std::mutex> guard(m);
+            ++nready;
+            cv.notify_all();
+            cv.wait(guard, [&] { return stage >= 1; });
+            if (s) {
+                m61_scope_commit(s);
+            }
+            ++ndone;
+            cv.notify_all();
+            cv.wait(guard, [&] { return stage >= 2; });
+            guard.unlock();
+
+            char expected[100];
+            snprintf(expected, sizeof(expected), "thread %d", i);
+            assert(strcmp(p, expected) == 0);
+            m61_free(p);
+        });
+    }
+    {
+        std::unique_lock<std::mutex> guard(m);
+        cv.wait(guard, [&] { return nready == nthreads; });
+    }
+
+    // commit while other threads' scopes are open, then open a scope
+    // behind theirs and roll it back after they commit
+    m61_scope_commit(committed);
+    m61_scope scope = m61_scope_begin();
+    assert(scope);
+    for (int i = 0; i != 10; ++i) {
+        m61_malloc(100);
+    }
+    {
+        std::unique_lock<std::mutex> guard(m);
+        stage = 1;
+        cv.notify_all();
+        cv.wait(guard, [&] { return ndone == nthreads; });
+    }
+    m61_scope_rollback(scope);
+
+    // reuse whatever the rollback freed, so wrongly freed blocks get
+    // overwritten
+    std::vector<void*> reuse;
+    for (int i = 0; i != 2 * nthreads + 10; ++i) {
+        reuse.push_back(memset(m61_malloc(100), 'x', 100));
+    }
+    {
+        std::unique_lock<std::mutex> guard(m);
+        stage = 2;
+        cv.notify_all();
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    for (void* ptr : reuse) {
+        m61_free(ptr);
+    }
+    for (char* ptr : kept) {
+        assert(ptr[0] == 'k' && ptr[99] == 'k');
+        m61_free(ptr);
+    }
+
+    m61_statistics stat = m61_get_statistics();
+    printf("nactive %llu\n", stat.nactive);
+    m61_print_leak_report();
+}
+
+//! nactive 0
@@ -0,0 +1,35 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <vector>
+// Check that a node allocator whose shared pool cannot be created fails the
+// allocation, and creates the pool once memory is available again.
+
+struct node {
+    node* next;
+    int value;
+};
+
+int main() {
+    std::vector<void*> fill;
+    for (size_t sz = 1 << 20; sz >= 1; sz /= 2) {
+        while (void* ptr = m61_malloc(sz)) {
+            fill.push_back(ptr);
+        }
+    }
+
+    m61_node_allocator<node> alloc;
+    printf("full: %p\n", (void*) alloc.allocate(1));
+
+    for (void* ptr : fill) {
+        m61_free(ptr);
+    }
+    node* n = alloc.allocate(1);
+    assert(n);
+    n->value = 61;
+    printf("value %d\n", n->value);
+    alloc.deallocate(n, 1);
+}
+
+//! full: (nil)
+//! value 61
@@ -0,0 +1,29 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <thread>
+// Check that the first allocation of each thread is sampled no more often
+// than any other: many short threads allocating once each sample about one
+// in `rate` of their allocations. Single-threaded unless built with
+// PTHREAD=1.
+
+int main() {
+    const int nthreads = 200;
+    m61_set_sample_rate(1000);
+    for (int i = 0; i != nthreads; ++i) {
+        auto work = [] {
+            m61_free(m61_malloc(16));
+        };
+        if (M61_THREADS) {
+            std::thread(work).join();
+        } else {
+            work();
+        }
+    }
+    m61_statistics stat = m61_get_statistics();
+    printf("nsampled %s\n", stat.nsampled < 10 ? "few" : "too many");
+    printf("nactive %llu\n", stat.nactive);
+}
+
+//! nsampled few
+//! nactive 0
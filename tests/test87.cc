@@ -0,0 +1,74 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <cerrno>
+#include <malloc.h>
+#include <string>
+#include <vector>
+// Check libm61.so from an unmodified program, which check.pl runs under
+// LD_PRELOAD: the whole usable size can be written, posix_memalign aligns,
+// realloc keeps contents, and sized delete frees. Any memory bug m61 sees
+// is reported; the double free at the end shows m61 is the allocator.
+
+// volatile stores, which the compiler cannot drop before the free
+static void fill(void* ptr, char c) {
+    volatile char* p = (volatile char*) ptr;
+    for (size_t i = 0; i != malloc_usable_size(ptr); ++i) {
+        p[i] = c;
+    }
+}
+
+struct record {
+    char name[72];
+    long id;
+};
+
+int main() {
+    for (size_t sz = 1; sz <= 5000; sz += sz < 300 ? 13 : 1001) {
+        char* p = (char*) malloc(sz);
+        assert(malloc_usable_size(p) >= sz);
+        fill(p, 'u');
+        free(p);
+    }
+
+    void* a;
+    assert(posix_memalign(&a, 256, 100) == 0 && (uintptr_t) a % 256 == 0);
+    fill(a, 'a');
+    free(a);
+    assert(posix_memalign(&a, 24, 100) == EINVAL);
+
+    char* r = (char*) malloc(20);
+    strcpy(r, "realloc");
+    r = (char*) realloc(r, 100000);
+    assert(r && strcmp(r, "realloc") == 0);
+    r = (char*) realloc(r, 4);
+    assert(r && memcmp(r, "real", 4) == 0);
+    fill(r, 'r');
+    free(r);
+
+    for (int i = 0; i != 100; ++i) {
+        record* volatile rec = new record;      // freed with sized delete
+        rec->id = i;
+        delete rec;
+        void* volatile raw = ::operator new(48);
+        ::operator delete(raw, 48);
+    }
+    std::vector<std::string> v;
+    for (int i = 0; i != 1000; ++i) {
+        v.push_back(std::to_string(i) + " is a string too long for the small buffer");
+    }
+    v.clear();
+    v.shrink_to_fit();
+    printf("done\n");
+    fflush(stdout);
+
+    char* volatile d = (char*) malloc(30);
+    free(d);
+    free(d);
+}
+
+//!!PRELOAD
+//! done
+//! MEMORY BUG???: invalid free of pointer ???, double free